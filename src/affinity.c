@@ -0,0 +1,98 @@
+#define _GNU_SOURCE
+#include "global.h"
+#include "affinity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <dirent.h>
+#include <sys/sysinfo.h>
+
+uint32_t affinity_available() {
+	cpu_set_t set;
+	if(sched_getaffinity(0, sizeof(set), &set))
+		return get_nprocs();
+	return CPU_COUNT(&set);
+}
+
+// Counts entries named `<prefix><number>`; returns the number from the last one matched in `last_out`
+static uint32_t count_numbered(const char *path, const char *prefix, int32_t *last_out) {
+	DIR *dir = opendir(path);
+	if(!dir)
+		return 0;
+	uint32_t count = 0;
+	size_t prefix_len = strlen(prefix);
+	for(struct dirent *entry; (entry = readdir(dir));) {
+		if(strncmp(entry->d_name, prefix, prefix_len) || entry->d_name[prefix_len] < '0' || entry->d_name[prefix_len] > '9')
+			continue;
+		if(last_out)
+			*last_out = atoi(&entry->d_name[prefix_len]);
+		++count;
+	}
+	closedir(dir);
+	return count;
+}
+
+int32_t affinity_node(uint32_t cpu) {
+	char path[64];
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u", cpu);
+	int32_t node = -1;
+	count_numbered(path, "node", &node);
+	return node;
+}
+
+bool affinity_attr_init(pthread_attr_t *attr, const struct CpuList *cpus, uint32_t index, const char *name) {
+	if(pthread_attr_init(attr)) {
+		uprintf("pthread_attr_init() failed\n");
+		return true;
+	}
+	if(!cpus->count)
+		return false;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if(index == AFFINITY_ANY)
+		for(uint32_t i = 0; i < cpus->count; ++i)
+			CPU_SET(cpus->cpus[i], &set);
+	else
+		CPU_SET(cpus->cpus[index % cpus->count], &set);
+	if(pthread_attr_setaffinity_np(attr, sizeof(set), &set)) {
+		uprintf("Failed to set CPU affinity for %s\n", name);
+		pthread_attr_destroy(attr);
+		return true;
+	}
+	if(index == AFFINITY_ANY) {
+		uprintf("Pinned %s to %u CPU%s\n", name, cpus->count, (cpus->count > 1) ? "s" : "");
+	} else {
+		uint32_t cpu = cpus->cpus[index % cpus->count];
+		uprintf("Pinned %s #%u to CPU %u (node %d)\n", name, index, cpu, affinity_node(cpu));
+	}
+	return false;
+}
+
+void affinity_log_topology() {
+	uint32_t nodes = count_numbered("/sys/devices/system/node", "node", NULL);
+	uprintf("%u of %u CPUs available across %u NUMA node%s\n", affinity_available(), get_nprocs_conf(), nodes ? nodes : 1, (nodes > 1) ? "s" : "");
+}
+#else
+uint32_t affinity_available() {
+	return 1; // TODO: Win32 stuff
+}
+
+int32_t affinity_node(uint32_t) {
+	return -1;
+}
+
+bool affinity_attr_init(pthread_attr_t *attr, const struct CpuList *cpus, uint32_t, const char *name) {
+	if(pthread_attr_init(attr)) {
+		uprintf("pthread_attr_init() failed\n");
+		return true;
+	}
+	if(cpus->count)
+		uprintf("CPU affinity not supported on this platform; %s threads will not be pinned\n", name);
+	return false;
+}
+
+void affinity_log_topology() {}
+#endif
@@ -0,0 +1,18 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define AFFINITY_MAX_CPUS 256
+#define AFFINITY_ANY ~0u // Thread index allowing any CPU in the list, for threads spawning their own helpers
+
+// Cores for a group of threads; thread `i` is pinned to `cpus[i % count]`, or left to the kernel if `count == 0`
+struct CpuList {
+	uint16_t count;
+	uint16_t cpus[AFFINITY_MAX_CPUS];
+};
+
+uint32_t affinity_available(); // Number of CPUs this process may run on
+int32_t affinity_node(uint32_t cpu); // NUMA node of `cpu`, or -1 if unknown
+bool affinity_attr_init(pthread_attr_t *attr, const struct CpuList *cpus, uint32_t index, const char *name);
+void affinity_log_topology();
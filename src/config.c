@@ -9,17 +9,8 @@
 
 #ifdef WINDOWS
 #define NEWLINE "\r\n"
-
-static uint16_t GetCoreCount() {
-	return 1; // TODO: Win32 stuff
-}
 #else
-#include <sys/sysinfo.h>
 #define NEWLINE "\n"
-
-static uint16_t GetCoreCount() {
-	return get_nprocs();
-}
 #endif
 
 static void config_read_cert(const char **it, jsonkey_t key, mbedtls_x509_crt *out) {
@@ -138,21 +129,42 @@ static void config_read_uint16(const char **it, jsonkey_t key, uint16_t minValue
 	*out = value;
 }
 
+static void config_read_cpus(const char **it, jsonkey_t key, struct CpuList *out) {
+	out->count = 0;
+	JSON_ITER_ARRAY(it) {
+		if(out->count >= lengthof(out->cpus)) {
+			json_error(it, "Error parsing config value \"%s\": too many entries\n", JSON_KEY_TOSTRING(key));
+			return;
+		}
+		config_read_uint16(it, key, 0, 1023, &out->cpus[out->count++]);
+	}
+}
+
 bool config_load(struct Config *out, const char *path) {
-	bool enableInstance = false, enableMaster = false, enableStatus = false, statusHTTPS = false;
+	bool enableInstance = false, enableMaster = false, enableStatus = false, statusHTTPS = false, instanceCountSet = false;
 
 	mbedtls_x509_crt_init(&out->certs[0]);
 	mbedtls_x509_crt_init(&out->certs[1]);
 	mbedtls_pk_init(&out->keys[0]);
 	mbedtls_pk_init(&out->keys[1]);
 	out->wireKey_len = 0;
-	out->instanceCount = GetCoreCount();
+	out->instanceCount = affinity_available();
+	out->instancePort = 0;
+	out->instanceWorkers = 0;
+	out->instancePipeline = false;
+	out->instanceLatencyPeriod = 2000;
+	out->instanceLatencyDelta = 10;
 	out->masterPort = 2328;
+	out->masterCount = 1;
 	out->statusPort = 0;
+	out->instanceCpus.count = 0;
+	out->masterCpus.count = 0;
+	out->statusCpus.count = 0;
 	*out->instanceAddress[0] = 0;
 	*out->instanceAddress[1] = 0;
 	*out->instanceParent = 0;
 	*out->instanceMapPool = 0;
+	*out->masterSocket = 0;
 	*out->statusAddress = 0;
 	*out->statusPath = 0;
 
@@ -229,19 +241,29 @@ bool config_load(struct Config *out, const char *path) {
 			}
 			case JSON_KEY('m','a','s','t','e','r',0,0): config_read_string(&it, key, out->instanceParent); break;
 			case JSON_KEY('m','a','p','P','o','o','l',0): config_read_string(&it, key, out->instanceMapPool); break;
-			case JSON_KEY('c','o','u','n','t',0,0,0): config_read_uint16(&it, key, 0, 8192, &out->instanceCount); break;
+			case JSON_KEY('c','o','u','n','t',0,0,0): config_read_uint16(&it, key, 0, 8192, &out->instanceCount); instanceCountSet = true; break;
+			case JSON_KEY('p','o','r','t',0,0,0,0): config_read_uint16(&it, key, 1, 65535, &out->instancePort); break;
+			case JSON_KEY('w','o','r','k','e','r','s',0): config_read_uint16(&it, key, 0, 256, &out->instanceWorkers); break;
+			case JSON_KEY('p','i','p','e','l','i','n','e'): out->instancePipeline = json_read_bool(&it); break;
+			case JSON_KEY('l','a','t','e','n','c','y',0): config_read_uint16(&it, key, 100, 60000, &out->instanceLatencyPeriod); break; // Milliseconds between latency updates to legacy clients
+			case JSON_KEY('l','a','t','D','e','l','t','a'): config_read_uint16(&it, key, 0, 1000, &out->instanceLatencyDelta); break; // Milliseconds of change before a legacy client is updated
+			case JSON_KEY('c','p','u','s',0,0,0,0): config_read_cpus(&it, key, &out->instanceCpus); break;
 			default: json_skip_any(&it);
 		} break;
 		case JSON_KEY('m','a','s','t','e','r',0,0): enableMaster = true; JSON_ITER_OBJECT(&it) {
 			case JSON_KEY('c','e','r','t',0,0,0,0): config_read_cert(&it, key, &out->masterCert); break;
 			case JSON_KEY('k','e','y',0,0,0,0,0): config_read_pk(&it, key, &ctr_drbg, &out->masterKey); break;
 			case JSON_KEY('p','o','r','t',0,0,0,0): config_read_uint16(&it, key, 1, 65535, &out->masterPort); break;
+			case JSON_KEY('c','o','u','n','t',0,0,0): config_read_uint16(&it, key, 1, 256, &out->masterCount); break;
+			case JSON_KEY('s','o','c','k','e','t',0,0): config_read_string(&it, key, out->masterSocket); break;
+			case JSON_KEY('c','p','u','s',0,0,0,0): config_read_cpus(&it, key, &out->masterCpus); break;
 			default: json_skip_any(&it);
 		} break;
 		case JSON_KEY('s','t','a','t','u','s',0,0): enableStatus = true; JSON_ITER_OBJECT(&it) {
 			case JSON_KEY('u','r','l',0,0,0,0,0): config_read_url(&it, key, out->statusAddress, out->statusPath, &out->statusPort, &statusHTTPS); break;
 			case JSON_KEY('c','e','r','t',0,0,0,0): config_read_cert(&it, key, &out->statusCert); break;
 			case JSON_KEY('k','e','y',0,0,0,0,0): config_read_pk(&it, key, &ctr_drbg, &out->statusKey); break;
+			case JSON_KEY('c','p','u','s',0,0,0,0): config_read_cpus(&it, key, &out->statusCpus); break;
 			default: json_skip_any(&it);
 		} break;
 		default: json_skip_any(&it);
@@ -249,9 +271,11 @@ bool config_load(struct Config *out, const char *path) {
 	if(json_is_error(it))
 		goto fail;
 
+	if(enableInstance && !instanceCountSet && out->instanceCpus.count)
+		out->instanceCount = out->instanceCpus.count; // One thread per listed core
 	if(!enableInstance) {
 		out->instanceCount = 0;
-	} else if(*out->instanceParent && !out->wireKey_len) {
+	} else if(*out->instanceParent && strncmp(out->instanceParent, "unix:", 5) && !out->wireKey_len) {
 		uprintf("Missing required value \"wireKey\"\n");
 		goto fail;
 	}
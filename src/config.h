@@ -1,6 +1,7 @@
 #include <mbedtls/x509_crt.h>
 #include <mbedtls/pk.h>
 #include <stdbool.h>
+#include "affinity.h"
 #define CONFIG_STRING_LENGTH 4096
 
 struct Config {
@@ -18,10 +19,13 @@ struct Config {
 	};
 	uint8_t wireKey_len;
 	uint8_t wireKey[32];
-	uint16_t instanceCount, masterPort, statusPort;
+	uint16_t instanceCount, instancePort, instanceWorkers, instanceLatencyPeriod, instanceLatencyDelta, masterPort, masterCount, statusPort;
+	bool instancePipeline;
+	struct CpuList instanceCpus, masterCpus, statusCpus;
 	char instanceAddress[2][CONFIG_STRING_LENGTH];
 	char instanceParent[CONFIG_STRING_LENGTH];
 	char instanceMapPool[CONFIG_STRING_LENGTH];
+	char masterSocket[CONFIG_STRING_LENGTH];
 	char statusAddress[CONFIG_STRING_LENGTH];
 	char statusPath[CONFIG_STRING_LENGTH];
 };
@@ -1,6 +1,14 @@
 #pragma once
 #include "global.h"
 
+#if defined(__AVX2__) && defined(MP_EXTENDED_ROUTING)
+#include <immintrin.h>
+#define COUNTERP_AVX2
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define COUNTERP_SSE2
+#endif
+
 struct Counter64 { // Typesafe wrapper for 64-bit bitfield operations
 	uint64_t bits;
 };
@@ -21,12 +29,12 @@ static inline bool Counter64_get(struct Counter64 set, uint32_t bit) {
 }
 static inline bool Counter64_clear(struct Counter64 *set, uint32_t bit) {
 	bool prev = Counter64_get(*set, bit);
-	set->bits &= ~(1 << bit);
+	set->bits &= ~(1llu << bit);
 	return prev;
 }
 static inline bool Counter64_set(struct Counter64 *set, uint32_t bit) {
 	bool prev = Counter64_get(*set, bit);
-	set->bits |= 1 << bit;
+	set->bits |= 1llu << bit;
 	return prev;
 }
 static inline bool Counter64_overwrite(struct Counter64 *set, uint32_t bit, bool state) {
@@ -36,14 +44,14 @@ static inline bool Counter64_clear_next(struct Counter64 *set, uint32_t *bit) {
 	if(set->bits == 0)
 		return false;
 	*bit = __builtin_ctzll(set->bits);
-	Counter64_clear(set, *bit);
+	set->bits &= set->bits - 1;
 	return true;
 }
 static inline bool Counter64_set_next(struct Counter64 *set, uint32_t *bit) {
 	if(~set->bits == 0)
 		return false;
 	*bit = __builtin_ctzll(~set->bits);
-	Counter64_set(set, *bit);
+	set->bits |= set->bits + 1;
 	return true;
 }
 static inline bool Counter64_eq(struct Counter64 a, struct Counter64 b) {
@@ -67,6 +75,9 @@ static inline bool Counter64_contains(struct Counter64 set, struct Counter64 sub
 static inline bool Counter64_containsNone(struct Counter64 set, struct Counter64 subset) {
 	return (set.bits & subset.bits) == 0;
 }
+static inline uint32_t Counter64_count(struct Counter64 set) {
+	return __builtin_popcountll(set.bits);
+}
 
 static inline bool CounterP_get(struct CounterP set, uint32_t bit) {
 	return Counter64_get(set.sub[bit / 64], bit % 64);
@@ -80,41 +91,140 @@ static inline bool CounterP_set(struct CounterP *set, uint32_t bit) {
 static inline bool CounterP_overwrite(struct CounterP *set, uint32_t bit, bool state) {
 	return (state ? CounterP_set : CounterP_clear)(set, bit);
 }
-[[maybe_unused]] static bool CounterP_clear_next(struct CounterP *set, uint32_t *bit) {
-	uint8_t i = Counter64_isEmpty(set->sub[0]);
-	if(!Counter64_clear_next(&set->sub[i], bit))
-		return false;
-	*bit += i * 64;
-	return true;
+// Iteration only has to skip whole empty (or full) words, which keeps `FOR_SOME_PLAYERS` cheap at any lobby size
+static inline bool CounterP_clear_next(struct CounterP *set, uint32_t *bit) {
+	for(uint32_t i = 0; i < lengthof(set->sub); ++i) {
+		if(Counter64_clear_next(&set->sub[i], bit)) {
+			*bit += i * 64;
+			return true;
+		}
+	}
+	return false;
+}
+static inline bool CounterP_set_next(struct CounterP *set, uint32_t *bit) {
+	for(uint32_t i = 0; i < lengthof(set->sub); ++i) {
+		if(Counter64_set_next(&set->sub[i], bit)) {
+			*bit += i * 64;
+			return true;
+		}
+	}
+	return false;
 }
-[[maybe_unused]] static bool CounterP_set_next(struct CounterP *set, uint32_t *bit) {
-	uint8_t i = Counter64_isFilled(set->sub[0]);
-	if(!Counter64_set_next(&set->sub[i], bit))
-		return false;
-	*bit += i * 64;
-	return true;
+
+#if defined(COUNTERP_AVX2)
+static inline __m256i CounterP_load(const struct CounterP *set) {
+	return _mm256_loadu_si256((const __m256i*)set->sub);
+}
+static inline bool CounterP_eq(struct CounterP a, struct CounterP b) {
+	__m256i delta = _mm256_xor_si256(CounterP_load(&a), CounterP_load(&b));
+	return _mm256_testz_si256(delta, delta);
+}
+static inline bool CounterP_contains(struct CounterP set, struct CounterP subset) {
+	return _mm256_testc_si256(CounterP_load(&set), CounterP_load(&subset));
+}
+static inline bool CounterP_containsNone(struct CounterP set, struct CounterP subset) {
+	return _mm256_testz_si256(CounterP_load(&set), CounterP_load(&subset));
+}
+static inline bool CounterP_isEmpty(struct CounterP set) {
+	__m256i v = CounterP_load(&set);
+	return _mm256_testz_si256(v, v);
+}
+static inline struct CounterP CounterP_and(struct CounterP a, struct CounterP b) {
+	struct CounterP out;
+	_mm256_storeu_si256((__m256i*)out.sub, _mm256_and_si256(CounterP_load(&a), CounterP_load(&b)));
+	return out;
+}
+static inline struct CounterP CounterP_or(struct CounterP a, struct CounterP b) {
+	struct CounterP out;
+	_mm256_storeu_si256((__m256i*)out.sub, _mm256_or_si256(CounterP_load(&a), CounterP_load(&b)));
+	return out;
+}
+#elif defined(COUNTERP_SSE2)
+#define COUNTERP_LANES (sizeof(struct CounterP) / sizeof(__m128i))
+static inline __m128i CounterP_load(const struct CounterP *set, uint32_t lane) {
+	return _mm_loadu_si128(&((const __m128i*)set->sub)[lane]);
+}
+static inline bool CounterP_isZero(__m128i v) { // SSE2 has no PTEST
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) == 0xffff;
+}
+static inline bool CounterP_eq(struct CounterP a, struct CounterP b) {
+	__m128i delta = _mm_setzero_si128();
+	for(uint32_t i = 0; i < COUNTERP_LANES; ++i)
+		delta = _mm_or_si128(delta, _mm_xor_si128(CounterP_load(&a, i), CounterP_load(&b, i)));
+	return CounterP_isZero(delta);
+}
+static inline bool CounterP_contains(struct CounterP set, struct CounterP subset) {
+	__m128i missing = _mm_setzero_si128();
+	for(uint32_t i = 0; i < COUNTERP_LANES; ++i)
+		missing = _mm_or_si128(missing, _mm_andnot_si128(CounterP_load(&set, i), CounterP_load(&subset, i)));
+	return CounterP_isZero(missing);
+}
+static inline bool CounterP_containsNone(struct CounterP set, struct CounterP subset) {
+	__m128i shared = _mm_setzero_si128();
+	for(uint32_t i = 0; i < COUNTERP_LANES; ++i)
+		shared = _mm_or_si128(shared, _mm_and_si128(CounterP_load(&set, i), CounterP_load(&subset, i)));
+	return CounterP_isZero(shared);
+}
+static inline bool CounterP_isEmpty(struct CounterP set) {
+	__m128i any = _mm_setzero_si128();
+	for(uint32_t i = 0; i < COUNTERP_LANES; ++i)
+		any = _mm_or_si128(any, CounterP_load(&set, i));
+	return CounterP_isZero(any);
+}
+static inline struct CounterP CounterP_and(struct CounterP a, struct CounterP b) {
+	struct CounterP out;
+	for(uint32_t i = 0; i < COUNTERP_LANES; ++i)
+		_mm_storeu_si128(&((__m128i*)out.sub)[i], _mm_and_si128(CounterP_load(&a, i), CounterP_load(&b, i)));
+	return out;
+}
+static inline struct CounterP CounterP_or(struct CounterP a, struct CounterP b) {
+	struct CounterP out;
+	for(uint32_t i = 0; i < COUNTERP_LANES; ++i)
+		_mm_storeu_si128(&((__m128i*)out.sub)[i], _mm_or_si128(CounterP_load(&a, i), CounterP_load(&b, i)));
+	return out;
 }
+#undef COUNTERP_LANES
+#else
 static inline bool CounterP_eq(struct CounterP a, struct CounterP b) {
-	return Counter64_eq(a.sub[0], b.sub[0]) && Counter64_eq(a.sub[1], b.sub[1]);
+	uint64_t delta = 0;
+	for(uint32_t i = 0; i < lengthof(a.sub); ++i)
+		delta |= a.sub[i].bits ^ b.sub[i].bits;
+	return delta == 0;
 }
 static inline bool CounterP_contains(struct CounterP set, struct CounterP subset) {
-	return Counter64_contains(set.sub[0], subset.sub[0]) && Counter64_contains(set.sub[1], subset.sub[1]);
+	uint64_t missing = 0;
+	for(uint32_t i = 0; i < lengthof(set.sub); ++i)
+		missing |= subset.sub[i].bits & ~set.sub[i].bits;
+	return missing == 0;
 }
 static inline bool CounterP_containsNone(struct CounterP set, struct CounterP subset) {
-	return Counter64_containsNone(set.sub[0], subset.sub[0]) && Counter64_containsNone(set.sub[1], subset.sub[1]);
+	uint64_t shared = 0;
+	for(uint32_t i = 0; i < lengthof(set.sub); ++i)
+		shared |= set.sub[i].bits & subset.sub[i].bits;
+	return shared == 0;
 }
 static inline bool CounterP_isEmpty(struct CounterP set) {
-	return Counter64_isEmpty(set.sub[0]) && Counter64_isEmpty(set.sub[1]);
+	uint64_t any = 0;
+	for(uint32_t i = 0; i < lengthof(set.sub); ++i)
+		any |= set.sub[i].bits;
+	return any == 0;
 }
 static inline struct CounterP CounterP_and(struct CounterP a, struct CounterP b) {
-	return (struct CounterP){{
-		Counter64_and(a.sub[0], b.sub[0]),
-		Counter64_and(a.sub[1], b.sub[1]),
-	}};
+	struct CounterP out;
+	for(uint32_t i = 0; i < lengthof(out.sub); ++i)
+		out.sub[i] = Counter64_and(a.sub[i], b.sub[i]);
+	return out;
 }
 static inline struct CounterP CounterP_or(struct CounterP a, struct CounterP b) {
-	return (struct CounterP){{
-		Counter64_or(a.sub[0], b.sub[0]),
-		Counter64_or(a.sub[1], b.sub[1]),
-	}};
+	struct CounterP out;
+	for(uint32_t i = 0; i < lengthof(out.sub); ++i)
+		out.sub[i] = Counter64_or(a.sub[i], b.sub[i]);
+	return out;
+}
+#endif
+static inline uint32_t CounterP_count(struct CounterP set) {
+	uint32_t count = 0;
+	for(uint32_t i = 0; i < lengthof(set.sub); ++i)
+		count += Counter64_count(set.sub[i]);
+	return count;
 }
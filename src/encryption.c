@@ -48,6 +48,7 @@ bool EncryptionState_init(struct EncryptionState *state, const mbedtls_mpi *preM
 		uprintf("mbedtls_mpi_write_binary() failed: %s\n", mbedtls_high_level_strerr(res));
 		return true;
 	}
+	EncryptionState_free(state); // Rekeying
 	uint8_t seed[80], sourceArray[192];
 	PRF(sourceArray, preMasterSecretBytes, sizeof(preMasterSecretBytes), seed, MakeSeed(seed, "master secret", serverRandom, clientRandom), 48);
 	PRF(sourceArray, sourceArray, 48, seed, MakeSeed(seed, "key expansion", serverRandom, clientRandom), 192);
@@ -59,6 +60,8 @@ bool EncryptionState_init(struct EncryptionState *state, const mbedtls_mpi *preM
 	state->receiveWindowEnd = 0;
 	state->receiveWindow = 0;
 	mbedtls_aes_init(&state->aes);
+	mbedtls_aes_init(&state->sendAes);
+	mbedtls_aes_setkey_enc(&state->sendAes, state->sendKey, 256);
 	state->initialized = true;
 	return false;
 }
@@ -67,6 +70,7 @@ void EncryptionState_free(struct EncryptionState *state) {
 	if(!state->initialized)
 		return;
 	mbedtls_aes_free(&state->aes);
+	mbedtls_aes_free(&state->sendAes);
 	state->initialized = false;
 }
 
@@ -145,7 +149,7 @@ uint32_t EncryptionState_decrypt(struct EncryptionState *state, const uint8_t ra
 	return length;
 }
 
-static int SignMessage(struct EncryptionState *state, const uint8_t *restrict data, uint32_t data_len, uint32_t sequence, uint8_t *restrict hash_out) {
+static int SignMessage(const uint8_t sendMacKey[static 64], const uint8_t *restrict data, uint32_t data_len, uint32_t sequence, uint8_t *restrict hash_out) {
 	uint8_t sequenceLE[sizeof(uint32_t)];
 	unchecked_u32_write(sequence, (uint8_t*[]){sequenceLE});
 
@@ -153,7 +157,7 @@ static int SignMessage(struct EncryptionState *state, const uint8_t *restrict da
 	mbedtls_md_init(&ctx);
 	int res = mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1);
 	if(res < 0) goto cleanup;
-	res = mbedtls_md_hmac_starts(&ctx, state->sendMacKey, sizeof(state->sendMacKey));
+	res = mbedtls_md_hmac_starts(&ctx, sendMacKey, 64);
 	if(res < 0) goto cleanup;
 	res = mbedtls_md_hmac_update(&ctx, data, data_len);
 	if(res < 0) goto cleanup;
@@ -165,27 +169,27 @@ static int SignMessage(struct EncryptionState *state, const uint8_t *restrict da
 	return res;
 }
 
-uint32_t EncryptionState_encrypt(struct EncryptionState *state, mbedtls_ctr_drbg_context *ctr_drbg, const uint8_t *restrict buf, uint32_t buf_len, uint8_t out[static 1536]) {
+// Only reads `sendAes`, so sessions can be sealed on a different thread than the one decrypting with `state->aes`
+uint32_t Encryption_seal(mbedtls_aes_context *sendAes, const uint8_t *sendMacKey, uint32_t sequence, mbedtls_ctr_drbg_context *ctr_drbg, const uint8_t *restrict buf, uint32_t buf_len, uint8_t out[static 1536]) {
 	const uint8_t *out_start = out, *out_end = &out[1536];
-	if(state && state->initialized) {
+	if(sendAes) {
 		struct PacketEncryptionLayer header = {
 			.encrypted = true,
-			.sequenceId = ++state->outboundSequence,
+			.sequenceId = sequence,
 		};
 		mbedtls_ctr_drbg_random(ctr_drbg, header.iv, sizeof(header.iv));
 		pkt_write(&header, &out, out_end, PV_LEGACY_DEFAULT);
 		uint8_t cap[32], cap_len = buf_len & 15, pad = 16 - ((buf_len + 10) & 15);
 		uint32_t cut_len = buf_len - cap_len;
 		memcpy(cap, &buf[cut_len], cap_len);
-		int res = SignMessage(state, buf, buf_len, header.sequenceId, &cap[cap_len]); cap_len += 10;
+		int res = SignMessage(sendMacKey, buf, buf_len, header.sequenceId, &cap[cap_len]); cap_len += 10;
 		if(res < 0) {
 			uprintf("SignMessage() failed: %s\n", mbedtls_high_level_strerr(res));
 			return 0;
 		}
 		memset(&cap[cap_len], pad - 1, pad); cap_len += pad;
-		mbedtls_aes_setkey_enc(&state->aes, state->sendKey, sizeof(state->sendKey) * 8);
-		mbedtls_aes_crypt_cbc(&state->aes, MBEDTLS_AES_ENCRYPT, cut_len, header.iv, buf, out); out += cut_len;
-		mbedtls_aes_crypt_cbc(&state->aes, MBEDTLS_AES_ENCRYPT, cap_len, header.iv, cap, out); out += cap_len;
+		mbedtls_aes_crypt_cbc(sendAes, MBEDTLS_AES_ENCRYPT, cut_len, header.iv, buf, out); out += cut_len;
+		mbedtls_aes_crypt_cbc(sendAes, MBEDTLS_AES_ENCRYPT, cap_len, header.iv, cap, out); out += cap_len;
 	} else {
 		pkt_write_c(&out, out_end, PV_LEGACY_DEFAULT, PacketEncryptionLayer, {
 			.encrypted = false,
@@ -195,3 +199,9 @@ uint32_t EncryptionState_encrypt(struct EncryptionState *state, mbedtls_ctr_drbg
 	}
 	return out - out_start;
 }
+
+uint32_t EncryptionState_encrypt(struct EncryptionState *state, mbedtls_ctr_drbg_context *ctr_drbg, const uint8_t *restrict buf, uint32_t buf_len, uint8_t out[static 1536]) {
+	if(state && state->initialized)
+		return Encryption_seal(&state->sendAes, state->sendMacKey, ++state->outboundSequence, ctr_drbg, buf, buf_len, out);
+	return Encryption_seal(NULL, NULL, 0, ctr_drbg, buf, buf_len, out);
+}
@@ -5,6 +5,7 @@
 
 struct EncryptionState {
 	mbedtls_aes_context aes;
+	mbedtls_aes_context sendAes; // Expanded once at key exchange rather than per packet
 	uint8_t sendKey[32];
 	uint8_t receiveKey[32];
 	uint8_t sendMacKey[64];
@@ -18,4 +19,5 @@ struct EncryptionState {
 bool EncryptionState_init(struct EncryptionState *state, const mbedtls_mpi *preMasterSecret, const uint8_t serverRandom[32], const uint8_t clientRandom[32], bool isClient);
 void EncryptionState_free(struct EncryptionState *state);
 uint32_t EncryptionState_decrypt(struct EncryptionState *state, const uint8_t raw[static 1536], const uint8_t *raw_end, uint8_t out[restrict static 1536]);
+uint32_t Encryption_seal(mbedtls_aes_context *sendAes, const uint8_t *sendMacKey, uint32_t sequence, mbedtls_ctr_drbg_context *ctr_drbg, const uint8_t *restrict buf, uint32_t buf_len, uint8_t out[static 1536]); // `sendAes == NULL` writes plaintext
 uint32_t EncryptionState_encrypt(struct EncryptionState *state, mbedtls_ctr_drbg_context *ctr_drbg, const uint8_t *restrict buf, uint32_t buf_len, uint8_t out[static 1536]);
@@ -22,6 +22,8 @@ void instance_channels_init(struct Channels *channels) {
 	channels->ro.base.backlog = NULL;
 	channels->ro.base.backlogEnd = &channels->ro.base.backlog;
 	channels->incomingFragmentsList = NULL;
+	channels->sentPackets = 0;
+	channels->sentBytes = 0;
 }
 
 void instance_channels_free(struct Channels *channels) {
@@ -66,6 +68,8 @@ static void instance_send_backlog(struct PacketContext version, struct Channels
 		uprintf("instance_send_channeled(DeliveryMethod_%s) not implemented\n", reflect(DeliveryMethod, channelId));
 		abort();
 	}
+	++channels->sentPackets;
+	channels->sentBytes += len;
 	struct ReliableChannel *channel = &channels->ro.base;
 	if(RelativeSequenceNumber(channel->outboundSequence, channel->outboundWindowStart) >= (int32_t)version.windowSize) {
 		*channels->ro.base.backlogEnd = malloc(sizeof(struct InstancePacketList));
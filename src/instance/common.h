@@ -4,6 +4,8 @@
 #define LOAD_TIMEOUT 15
 #define IDLE_TIMEOUT_MS 10000
 #define KICK_TIMEOUT_MS 3000
+#define LATENCY_UPDATE_MS 2000 // Defaults for the `latency` and `latDelta` config keys
+#define LATENCY_UPDATE_THRESHOLD .01f
 
 #define bitsize(e) (sizeof(e) * 8)
 #define indexof(a, e) ((uintptr_t)((e) - (a)))
@@ -132,6 +134,8 @@ struct Channels {
 	struct ReliableOrderedChannel ro;
 	struct SequencedChannel rs;
 	struct IncomingFragments *incomingFragmentsList;
+	uint32_t sentPackets;
+	uint64_t sentBytes;
 };
 struct PingPong {
 	uint64_t lastPing;
@@ -1,6 +1,8 @@
 #include "instance.h"
 #include "common.h"
+#include "scheduler.h"
 #include "../counter.h"
+#include "../status/status.h"
 #include <mbedtls/error.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,11 +29,19 @@ typedef uint32_t playerid_t;
 #define FOR_EXCLUDING_PLAYER(id, counter, exc) \
 	FOR_SOME_PLAYERS(id, counter, CounterP_clear(&COUNTER_VAR, exc))
 
+#define PAGE_WORD_VAR CONCAT(_w_,__LINE__)
+#define PAGE_VAR CONCAT(_p_,__LINE__)
+
 #define FOR_ALL_ROOMS(ctx, room) \
-	struct Counter64 COUNTER_VAR = (ctx)->roomMask; \
-	for(uint32_t group; Counter64_clear_next(&COUNTER_VAR, &group);) \
-		for(struct Room **(room) = (ctx)->rooms[group]; (room) < endof((ctx)->rooms[group]); ++(room)) \
-			if(*room)
+	for(uint32_t PAGE_WORD_VAR = 0, PAGE_VAR; PAGE_WORD_VAR < lengthof((ctx)->pageMask); ++PAGE_WORD_VAR) \
+		for(struct Counter64 COUNTER_VAR = (ctx)->pageMask[PAGE_WORD_VAR]; Counter64_clear_next(&COUNTER_VAR, &PAGE_VAR);) \
+			for(struct Room **(room) = (ctx)->pages[PAGE_WORD_VAR * 64 + PAGE_VAR]->rooms; (room) < endof((ctx)->pages[PAGE_WORD_VAR * 64 + PAGE_VAR]->rooms); ++(room)) \
+				if(*room)
+
+#define IDENTITY_SLOTS 4 // Client versions a serialized identity is cached for
+#define ROOM_PACKET_BUDGET 16 // Datagrams handled per room in each run
+#define ROOM_TIME_BUDGET_NS 2000000
+#define ROOM_BACKLOG_MAX 32 // Further datagrams for a room are dropped once this many are waiting
 
 struct InstanceSession {
 	struct NetSession net;
@@ -45,20 +55,32 @@ struct InstanceSession {
 	struct ByteArrayNetSerializable publicEncryptionKey;
 	bool sentIdentity, directDownloads;
 	uint32_t joinOrder;
+	struct {
+		struct {
+			struct PacketContext version;
+			uint32_t offset, length;
+		} slots[IDENTITY_SLOTS];
+		uint32_t count;
+		uint8_t data[sizeof(struct PlayerIdentity)]; // Shared by all slots; serialized identities are far smaller than the struct
+	} serializedIdentity;
 
 	ServerState state;
+	float latency, reportedLatency;
 	float recommendTime;
 	struct BeatmapIdentifierNetSerializable recommendedBeatmap;
 	struct GameplayModifiers recommendedModifiers;
 	struct PlayerSpecificSettingsNetSerializable settings;
+	uint32_t generation; // Bumped on every join, so datagrams queued for an earlier occupant of the slot are dropped
 };
 struct Room {
+	struct SchedTask task; // First, so `room_run()` can recover the room from it
 	struct NetKeypair keys;
 	playerid_t serverOwner;
 	struct GameplayServerConfiguration configuration;
 	float syncBase, shortCountdown, longCountdown;
 	bool skipResults, perPlayerDifficulty, perPlayerModifiers;
 	uint32_t joinCount;
+	uint32_t latencyTick;
 
 	ServerState state;
 	struct {
@@ -97,18 +119,275 @@ struct Room {
 		} game;
 	};
 
+	struct {
+		uint32_t count;
+		struct BeatmapVote {
+			uint32_t hash;
+			struct CounterP voters;
+		} entries[sizeof(struct CounterP) * 8];
+		uint16_t index[sizeof(struct CounterP) * 16]; // Open addressing; holds `entries` positions offset by 1
+	} votes;
+
 	struct CounterP connected;
 	struct CounterP playerSort;
+	struct CounterP linked; // Sessions the IO thread hasn't released yet; a superset of `playerSort`, only touched by that thread
+	struct CounterP unreleased; // Disconnected sessions whose `SessionReleaseTask` has yet to be posted
+	struct InstanceContext *ctx; // Thread currently hosting the room
+	atomic_uint_fast32_t run; // `ROOM_QUEUED`, `ROOM_HELD`, and pending work
+	atomic_uint_fast32_t wakeTime; // Next timer, published by whichever thread last ran the room
+	atomic_uint_fast32_t playerCount; // Size of `playerSort`, for the IO thread
+	atomic_uint_fast32_t releasing; // Sessions in `unreleased` or in flight to the IO thread; the room can't close or migrate until they're back
+	struct RoomStats {
+		atomic_uint_fast64_t packets, deferred, dropped; // `deferred` counts datagrams still waiting when a run used up its budget
+		atomic_uint_fast64_t busyNs;
+	} stats;
+	struct RoomInbox { // Filled by the IO thread, drained by whichever thread runs the room
+		atomic_uint_fast32_t head, tail;
+		struct InstanceDatagram {
+			struct InstanceSession *session;
+			uint32_t generation;
+			uint16_t len;
+			bool encrypted;
+			uint8_t data[1536];
+		} datagrams[ROOM_BACKLOG_MAX];
+	} inbox;
+	struct InstanceContext *origin; // Set on rooms migrated in from another thread
+	uint16_t originID;
+	uint16_t roomID;
 	struct InstanceSession players[];
 };
 
+#define ROOM_PAGE_SIZE 64
+#define ROOM_PAGE_COUNT (65536 / ROOM_PAGE_SIZE) // Room IDs are 16 bits on the wire
+#define ROOM_PAGE_SPARE 4 // Emptied pages kept for reuse rather than returned to the allocator
+#define ROOM_PAGE_HEADROOM 4 // Minimum pages advertised to the master
+#define INSTANCE_MIGRATE_PAGE (ROOM_PAGE_COUNT - 1) // Highest room IDs; never advertised to the master, reserved for rooms migrating in
+#define MIGRATE_INTERVAL_MS 5000
+#define MIGRATE_LOAD_HIGH .75
+#define MIGRATE_LOAD_LOW .4
+
+#define ROOM_STATS_INTERVAL_MS 1000
+
+// Rooms run from their inbox on the shared pool, one thread at a time; a room over budget goes to the back of the queue
+#define ROOM_QUEUED 1 // On the pool, or on the thread's `runnable` list when there are no workers
+#define ROOM_HELD 2 // Claimed by the IO thread; a worker gives the room up at the end of its current run
+#define ROOM_TICK 4 // Timers are due
+#define ROOM_INBOX 8 // Datagrams arrived since the room last drained its inbox
+
+// Every session on a thread by address, for `instance_onResolve()`; only changed under the ingress lock
+struct SessionIndex {
+	uint32_t count, capacity; // `capacity` is 0 or a power of two
+	struct SessionIndexEntry {
+		struct Room **room; // NULL if unused
+		struct InstanceSession *session;
+		uint32_t hash;
+	} *entries;
+};
+
 struct InstanceContext {
 	struct NetContext net;
+	uint32_t index; // Position in `contexts`, and the socket's steering index
 	union WireLink *master;
-	struct Counter64 roomMask;
-	struct Room *rooms[64][8];
+	struct SessionIndex sessions;
+	struct SchedTask *runnable, **runnable_tail; // Rooms waiting to run on this thread when there are no workers
+	struct RoomJoinOp *joins, **joins_tail; // Joins waiting for a worker to give up their room
+	struct Counter64 pageMask[ROOM_PAGE_COUNT / 64]; // Pages holding at least one open room
+	struct RoomPage *pages[ROOM_PAGE_COUNT], *freePages;
+	uint32_t freePages_len;
+	uint32_t capacity; // Room count last advertised to the master
+	bool resize;
+	atomic_uint_fast64_t migrateSlots; // Slots in `INSTANCE_MIGRATE_PAGE`, reserved by other threads before posting a `RoomMigrateTask`
+	uint32_t nextBalance, nextStats;
+	uint32_t lastHeartbeat;
+	struct Traffic traffic; // Totals as of `lastHeartbeat`
+	uint32_t connectTime, reconnectTime, reconnectDelay; // Backoff for re-dialing a lost remote master
 };
+
+// Rooms are stored in pages allocated on first use; pages left empty are released by `instance_resize()`
+struct RoomPage {
+	struct RoomPage *next; // Free list
+	uint32_t open, forwarded;
+	struct Room *rooms[ROOM_PAGE_SIZE];
+	struct RoomForward { // Rooms migrated away; the master still addresses them by their original ID
+		struct InstanceContext *target;
+		uint16_t room;
+	} forward[ROOM_PAGE_SIZE];
+};
+static uint32_t threads_len = 0;
+static pthread_t *threads = NULL;
 static struct InstanceContext *contexts = NULL;
+static struct NetSteering instance_steering = CLEAR_NETSTEERING;
+static atomic_bool instance_migrate = false;
+
+static struct SessionIndexEntry *SessionIndex_lookup(struct SessionIndex *index, const struct SS *addr, uint32_t hash) {
+	for(uint32_t i = hash & (index->capacity - 1);; i = (i + 1) & (index->capacity - 1)) {
+		struct SessionIndexEntry *entry = &index->entries[i];
+		if(!entry->room || (entry->hash == hash && SS_equal(addr, NetSession_get_addr(&entry->session->net))))
+			return entry;
+	}
+}
+
+static struct SessionIndexEntry *SessionIndex_find(struct SessionIndex *index, const struct SS *addr) {
+	if(!index->count)
+		return NULL;
+	struct SessionIndexEntry *entry = SessionIndex_lookup(index, addr, SS_hash(addr));
+	return entry->room ? entry : NULL;
+}
+
+static bool SessionIndex_insert(struct SessionIndex *index, struct Room **room, struct InstanceSession *session) {
+	if((index->count + 1) * 2 > index->capacity) {
+		uint32_t capacity = index->capacity ? index->capacity * 2 : 256;
+		struct SessionIndexEntry *entries = calloc(capacity, sizeof(*entries));
+		if(!entries) {
+			uprintf("alloc error\n");
+			return true;
+		}
+		struct SessionIndex old = *index;
+		index->capacity = capacity;
+		index->entries = entries;
+		for(uint32_t i = 0; i < old.capacity; ++i)
+			if(old.entries[i].room)
+				*SessionIndex_lookup(index, NetSession_get_addr(&old.entries[i].session->net), old.entries[i].hash) = old.entries[i];
+		free(old.entries);
+	}
+	const struct SS *addr = NetSession_get_addr(&session->net);
+	uint32_t hash = SS_hash(addr);
+	struct SessionIndexEntry *entry = SessionIndex_lookup(index, addr, hash);
+	index->count += !entry->room;
+	*entry = (struct SessionIndexEntry){room, session, hash};
+	return false;
+}
+
+// Matches by identity, since a later join from the same address replaces the entry
+static void SessionIndex_remove(struct SessionIndex *index, struct InstanceSession *session) {
+	if(!index->count)
+		return;
+	uint32_t mask = index->capacity - 1, i = SS_hash(NetSession_get_addr(&session->net)) & mask;
+	for(; index->entries[i].session != session; i = (i + 1) & mask)
+		if(!index->entries[i].room)
+			return;
+	for(uint32_t j = (i + 1) & mask; index->entries[j].room; j = (j + 1) & mask) {
+		uint32_t home = index->entries[j].hash & mask;
+		if((j > i) ? (home <= i || home > j) : (home <= i && home > j))
+			index->entries[i] = index->entries[j], i = j;
+	}
+	index->entries[i] = (struct SessionIndexEntry){0};
+	--index->count;
+}
+
+static bool PacketContext_eq(struct PacketContext a, struct PacketContext b) {
+	return a.netVersion == b.netVersion && a.protocolVersion == b.protocolVersion && a.beatUpVersion == b.beatUpVersion && a.windowSize == b.windowSize;
+}
+
+// Packs consecutive messages sharing a routing header into as few reliable packets as possible
+struct ReliableBatch {
+	struct InstanceSession *session;
+	uint8_t *start, *end;
+	uint8_t data[65536];
+};
+
+static void batch_open(struct ReliableBatch *batch, struct InstanceSession *session, struct RoutingHeader routing) {
+	batch->session = session;
+	batch->end = batch->data;
+	pkt_write(&routing, &batch->end, endof(batch->data), session->net.version);
+	batch->start = batch->end;
+}
+
+static void batch_flush(struct ReliableBatch *batch) {
+	if(batch->end != batch->start)
+		instance_send_channeled(&batch->session->net, &batch->session->channels, batch->data, batch->end - batch->data, DeliveryMethod_ReliableOrdered);
+	batch->end = batch->start;
+}
+
+// Anything pushed so far goes out under the previous header
+static void batch_route(struct ReliableBatch *batch, struct RoutingHeader routing) {
+	batch_flush(batch);
+	batch_open(batch, batch->session, routing);
+}
+
+static void batch_commit(struct ReliableBatch *batch, uint8_t *mark) {
+	if(mark == batch->start || batch->end - batch->data <= batch->session->net.maxChanneledSize)
+		return;
+	uint32_t len = batch->end - mark; // Only fragment messages which can't fit in a packet by themselves
+	batch->end = mark;
+	batch_flush(batch);
+	memmove(batch->start, mark, len);
+	batch->end = &batch->start[len];
+}
+
+// Messages that don't fit behind what's already pending are retried on an empty batch
+static bool batch_push(struct ReliableBatch *batch, const struct InternalMessage *message) {
+	uint8_t *mark = batch->end;
+	if(!pkt_serialize(message, &batch->end, endof(batch->data), batch->session->net.version)) {
+		if(mark == batch->start)
+			goto fail;
+		batch_flush(batch);
+		mark = batch->end;
+		if(!pkt_serialize(message, &batch->end, endof(batch->data), batch->session->net.version))
+			goto fail;
+	}
+	batch_commit(batch, mark);
+	return false;
+	fail:
+	uprintf("Dropping oversized message [%s]\n", reflect(InternalMessageType, message->type));
+	return true;
+}
+
+static bool batch_push_serialized(struct ReliableBatch *batch, const uint8_t *data, uint32_t length) {
+	if(length > (uint32_t)(endof(batch->data) - batch->end)) {
+		batch_flush(batch);
+		if(length > (uint32_t)(endof(batch->data) - batch->end)) {
+			uprintf("Dropping oversized message (%u bytes)\n", length);
+			return true;
+		}
+	}
+	uint8_t *mark = batch->end;
+	memcpy(batch->end, data, length);
+	batch->end += length;
+	batch_commit(batch, mark);
+	return false;
+}
+
+// Identities are re-sent to every late joiner, so the serialized form is kept per client version until the player's state changes
+static void batch_push_identity(struct ReliableBatch *batch, struct InstanceSession *player) {
+	struct PacketContext version = batch->session->net.version;
+	uint32_t slot = 0;
+	while(slot < player->serializedIdentity.count && !PacketContext_eq(player->serializedIdentity.slots[slot].version, version))
+		++slot;
+	if(slot == player->serializedIdentity.count) {
+		struct InternalMessage r_identity = {
+			.type = InternalMessageType_PlayerIdentity,
+			.playerIdentity = {
+				.playerState = player->stateHash,
+				.playerAvatar = player->avatar,
+				.random.length = sizeof(player->random),
+				.publicEncryptionKey = player->publicEncryptionKey,
+			},
+		};
+		memcpy(r_identity.playerIdentity.random.data, player->random, sizeof(player->random));
+		uint32_t offset = 0;
+		if(slot == IDENTITY_SLOTS)
+			slot = 0;
+		else if(slot)
+			offset = player->serializedIdentity.slots[slot - 1].offset + player->serializedIdentity.slots[slot - 1].length;
+		uint8_t *data_end = &player->serializedIdentity.data[offset];
+		bool serialized = pkt_serialize(&r_identity, &data_end, endof(player->serializedIdentity.data), version);
+		if(!serialized && offset) { // Out of room; start over with this version alone
+			slot = 0, offset = 0, data_end = player->serializedIdentity.data;
+			serialized = pkt_serialize(&r_identity, &data_end, endof(player->serializedIdentity.data), version);
+		}
+		if(!serialized) {
+			player->serializedIdentity.count = 0;
+			batch_push(batch, &r_identity);
+			return;
+		}
+		player->serializedIdentity.slots[slot].version = version;
+		player->serializedIdentity.slots[slot].offset = offset;
+		player->serializedIdentity.slots[slot].length = data_end - &player->serializedIdentity.data[offset];
+		player->serializedIdentity.count = slot + 1;
+	}
+	batch_push_serialized(batch, &player->serializedIdentity.data[player->serializedIdentity.slots[slot].offset], player->serializedIdentity.slots[slot].length);
+}
 
 static float room_get_syncTime(struct Room *room) {
 	struct timespec now;
@@ -169,6 +448,17 @@ static bool BeatmapIdentifierNetSerializable_eq(const struct BeatmapIdentifierNe
 	return ignoreDifficulty || (String_eq(a->beatmapCharacteristicSerializedName, b->beatmapCharacteristicSerializedName) && a->difficulty == b->difficulty);
 }
 
+static uint32_t BeatmapIdentifierNetSerializable_hash(const struct BeatmapIdentifierNetSerializable *id, bool ignoreDifficulty) {
+	uint32_t hash = 2166136261;
+	for(uint32_t i = 0; i < id->levelID.length; ++i)
+		hash = (hash ^ (uint8_t)id->levelID.data[i]) * 16777619;
+	if(ignoreDifficulty)
+		return hash;
+	for(uint32_t i = 0; i < id->beatmapCharacteristicSerializedName.length; ++i)
+		hash = (hash ^ (uint8_t)id->beatmapCharacteristicSerializedName.data[i]) * 16777619;
+	return (hash ^ (uint32_t)id->difficulty) * 16777619;
+}
+
 static bool GameplayModifiers_eq(const struct GameplayModifiers *a, const struct GameplayModifiers *b, bool optional) {
 	struct GameplayModifiers delta = {a->raw ^ b->raw};
 	struct GameplayModifiers mask = {REQUIRED_MODIFIER_MASK};
@@ -201,6 +491,115 @@ static struct GameplayModifiers session_get_modifiers(const struct Room *room, c
 	return room->global.selectedModifiers;
 }
 
+// Votes are grouped by beatmap as recommendations change, so picking a winner only needs to look at each distinct map once
+static uint16_t *room_vote_lookup(struct Room *room, const struct BeatmapIdentifierNetSerializable *beatmap, uint32_t hash) {
+	for(uint32_t i = hash % lengthof(room->votes.index);; i = (i + 1) % lengthof(room->votes.index)) {
+		if(!room->votes.index[i])
+			return &room->votes.index[i];
+		struct BeatmapVote *vote = &room->votes.entries[room->votes.index[i] - 1];
+		if(vote->hash != hash)
+			continue;
+		struct CounterP voters = vote->voters;
+		playerid_t id = 0;
+		CounterP_clear_next(&voters, &id);
+		if(BeatmapIdentifierNetSerializable_eq(&room->players[id].recommendedBeatmap, beatmap, room->perPlayerDifficulty))
+			return &room->votes.index[i];
+	}
+}
+
+static void room_vote_add(struct Room *room, const struct InstanceSession *session) {
+	if(!session->recommendedBeatmap.beatmapCharacteristicSerializedName.length)
+		return;
+	uint32_t hash = BeatmapIdentifierNetSerializable_hash(&session->recommendedBeatmap, room->perPlayerDifficulty);
+	uint16_t *slot = room_vote_lookup(room, &session->recommendedBeatmap, hash);
+	if(!*slot) {
+		if(room->votes.count >= lengthof(room->votes.entries))
+			return;
+		room->votes.entries[room->votes.count] = (struct BeatmapVote){hash, COUNTER128_CLEAR};
+		*slot = ++room->votes.count;
+	}
+	CounterP_set(&room->votes.entries[*slot - 1].voters, indexof(room->players, session));
+}
+
+static void room_vote_remove(struct Room *room, const struct InstanceSession *session) {
+	if(!session->recommendedBeatmap.beatmapCharacteristicSerializedName.length)
+		return;
+	uint16_t *slot = room_vote_lookup(room, &session->recommendedBeatmap, BeatmapIdentifierNetSerializable_hash(&session->recommendedBeatmap, room->perPlayerDifficulty));
+	if(!*slot)
+		return;
+	uint16_t pos = *slot;
+	CounterP_clear(&room->votes.entries[pos - 1].voters, indexof(room->players, session));
+	if(!CounterP_isEmpty(room->votes.entries[pos - 1].voters))
+		return;
+	uint32_t i = indexof(room->votes.index, slot);
+	for(uint32_t j = (i + 1) % lengthof(room->votes.index); room->votes.index[j]; j = (j + 1) % lengthof(room->votes.index)) {
+		uint32_t home = room->votes.entries[room->votes.index[j] - 1].hash % lengthof(room->votes.index);
+		if((j > i) ? (home <= i || home > j) : (home <= i && home > j))
+			room->votes.index[i] = room->votes.index[j], i = j;
+	}
+	room->votes.index[i] = 0;
+	if(pos != room->votes.count) {
+		const struct BeatmapVote *last = &room->votes.entries[room->votes.count - 1];
+		for(i = last->hash % lengthof(room->votes.index); room->votes.index[i] != room->votes.count; i = (i + 1) % lengthof(room->votes.index));
+		room->votes.index[i] = pos;
+		room->votes.entries[pos - 1] = *last;
+	}
+	--room->votes.count;
+}
+
+static void room_vote_reset(struct Room *room) {
+	room->votes.count = 0;
+	memset(room->votes.index, 0, sizeof(room->votes.index));
+	FOR_SOME_PLAYERS(id, room->connected,)
+		room_vote_add(room, &room->players[id]);
+}
+
+static void session_set_recommendedBeatmap(struct Room *room, struct InstanceSession *session, struct BeatmapIdentifierNetSerializable beatmap) {
+	bool voting = CounterP_get(room->connected, indexof(room->players, session));
+	if(voting)
+		room_vote_remove(room, session);
+	session->recommendedBeatmap = beatmap;
+	if(voting)
+		room_vote_add(room, session);
+}
+
+// Players at or after `roundRobin` get one bonus vote; ties go to the lowest player ID with the highest (biased) count
+static playerid_t room_vote_winner(const struct Room *room) {
+	struct CounterP biased;
+	for(uint32_t i = 0; i < lengthof(biased.sub); ++i) {
+		uint32_t start = i * 64;
+		if(room->global.roundRobin <= start)
+			biased.sub[i].bits = ~0llu;
+		else if(room->global.roundRobin >= start + 64)
+			biased.sub[i].bits = 0;
+		else
+			biased.sub[i].bits = ~0llu << (room->global.roundRobin - start);
+	}
+	const struct BeatmapVote *best = NULL;
+	uint32_t max = 0;
+	playerid_t lead = ~0u;
+	for(const struct BeatmapVote *vote = room->votes.entries; vote < &room->votes.entries[room->votes.count]; ++vote) {
+		struct CounterP first = CounterP_and(vote->voters, biased);
+		uint32_t biasedVotes = CounterP_count(vote->voters) + !CounterP_isEmpty(first);
+		if(CounterP_isEmpty(first))
+			first = vote->voters;
+		playerid_t id = 0;
+		CounterP_clear_next(&first, &id);
+		if(biasedVotes < max || (biasedVotes == max && id > lead))
+			continue;
+		max = biasedVotes;
+		lead = id;
+		best = vote;
+	}
+	if(!best)
+		return ~0u;
+	playerid_t firstRequest = lead;
+	FOR_EXCLUDING_PLAYER(id, best->voters, lead)
+		if(room->players[id].recommendTime < room->players[firstRequest].recommendTime)
+			firstRequest = id;
+	return firstRequest;
+}
+
 static uint32_t instance_mapPool_len = 0;
 static struct MpBeatmapPacket *instance_mapPool = NULL;
 static void mapPool_init(const char *filename) {
@@ -302,7 +701,9 @@ static void session_set_state(struct InstanceContext *ctx, struct Room *room, st
 	uint8_t *start = resp_end;
 	if(STATE_EDGE(session->state, state, ServerState_Connected)) {
 		CounterP_set(&room->connected, indexof(room->players, session));
+		room_vote_add(room, session);
 	} else if(STATE_EDGE(state, session->state, ServerState_Connected)) {
+		room_vote_remove(room, session);
 		CounterP_clear(&room->connected, indexof(room->players, session));
 		if(room->configuration.songSelectionMode != SongSelectionMode_Random && room->global.roundRobin == indexof(room->players, session))
 			room->global.roundRobin = roundRobin_next(room->global.roundRobin, room->connected);
@@ -327,7 +728,7 @@ static void session_set_state(struct InstanceContext *ctx, struct Room *room, st
 		bool needSetSelectedBeatmap = (state & ServerState_Lobby_Entitlement) != 0;
 		if(!(session->state & ServerState_Lobby)) {
 			needSetSelectedBeatmap = true;
-			session->recommendedBeatmap = CLEAR_BEATMAP;
+			session_set_recommendedBeatmap(room, session, CLEAR_BEATMAP);
 			SERIALIZE_GAMEPLAYRPC(&resp_end, endof(resp), session->net.version, {
 				.type = GameplayRpcType_ReturnToMenu,
 				.returnToMenu = {
@@ -575,30 +976,7 @@ static void room_set_state(struct InstanceContext *ctx, struct Room *room, Serve
 		case ServerState_Lobby_Entitlement: {
 			playerid_t select = ~0u;
 			switch(room->configuration.songSelectionMode) {
-				case SongSelectionMode_Vote: vote_beatmap: {
-					uint32_t max = 0;
-					FOR_SOME_PLAYERS(id, room->connected,) {
-						if(!room->players[id].recommendedBeatmap.beatmapCharacteristicSerializedName.length)
-							continue;
-						uint32_t biasedVotes = (id >= room->global.roundRobin) + 1;
-						float requestTime = room->players[id].recommendTime;
-						playerid_t firstRequest = id;
-						FOR_EXCLUDING_PLAYER(cmp, room->connected, id) { // TODO: this scales horribly
-							if(!BeatmapIdentifierNetSerializable_eq(&room->players[id].recommendedBeatmap, &room->players[cmp].recommendedBeatmap, room->perPlayerDifficulty))
-								continue;
-							++biasedVotes;
-							if(room->players[cmp].recommendTime >= requestTime)
-								continue;
-							requestTime = room->players[cmp].recommendTime;
-							firstRequest = cmp;
-						}
-						if(biasedVotes <= max)
-							continue;
-						max = biasedVotes;
-						select = firstRequest;
-					}
-					break;
-				}
+				case SongSelectionMode_Vote: vote_beatmap: select = room_vote_winner(room); break;
 				case SongSelectionMode_Random: select = room->configuration.maxPlayerCount; break;
 				case SongSelectionMode_OwnerPicks: {
 					if(!CounterP_get(room->connected, room->serverOwner))
@@ -689,7 +1067,7 @@ static void room_set_state(struct InstanceContext *ctx, struct Room *room, Serve
 				if(room_try_finish(ctx, room))
 					return;
 			}
-			mbedtls_ctr_drbg_random(&ctx->net.ctr_drbg, (uint8_t*)room->global.sessionId, sizeof(room->global.sessionId));
+			mbedtls_ctr_drbg_random(net_get_ctr_drbg(&ctx->net), (uint8_t*)room->global.sessionId, sizeof(room->global.sessionId));
 			room->game.loadingSong.isLoaded = COUNTER128_CLEAR;
 			room->global.timeout = room_get_syncTime(room) + LOAD_TIMEOUT;
 			break;
@@ -800,7 +1178,7 @@ static void handle_MenuRpc(struct InstanceContext *ctx, struct Room *room, struc
 				break;
 			if(!BeatmapIdentifierNetSerializable_eq(&session->recommendedBeatmap, &beatmap.identifier, room->perPlayerDifficulty))
 				session->recommendTime = room_get_syncTime(room);
-			session->recommendedBeatmap = beatmap.identifier;
+			session_set_recommendedBeatmap(room, session, beatmap.identifier);
 			room_set_state(ctx, room, ServerState_Lobby_Entitlement);
 			break;
 		}
@@ -1126,6 +1504,7 @@ static void handle_PlayerIdentity(struct InstanceContext *ctx, struct Room *room
 	else
 		memset(session->random, 0, sizeof(session->random));
 	session->publicEncryptionKey = identity->publicEncryptionKey;
+	session->serializedIdentity.count = 0;
 	if(session->sentIdentity)
 		return;
 	session->sentIdentity = true;
@@ -1140,13 +1519,6 @@ static void handle_PlayerIdentity(struct InstanceContext *ctx, struct Room *room
 				.isConnectionOwner = 0,
 			},
 		};
-		FOR_EXCLUDING_PLAYER(id, room->connected, indexof(room->players, session)) {
-			uint8_t resp[65536], *resp_end = resp;
-			pkt_write_c(&resp_end, endof(resp), room->players[id].net.version, RoutingHeader, {0, 0, false});
-			if(pkt_serialize(&r_connected, &resp_end, endof(resp), room->players[id].net.version))
-				instance_send_channeled(&room->players[id].net, &room->players[id].channels, resp, resp_end - resp, DeliveryMethod_ReliableOrdered);
-		}
-
 		struct InternalMessage r_sort = {
 			.type = InternalMessageType_PlayerSortOrderUpdate,
 			.playerSortOrderUpdate = {
@@ -1155,21 +1527,14 @@ static void handle_PlayerIdentity(struct InstanceContext *ctx, struct Room *room
 			},
 		};
 		FOR_SOME_PLAYERS(id, room->connected,) {
-			uint8_t resp[65536], *resp_end = resp;
-			pkt_write_c(&resp_end, endof(resp), room->players[id].net.version, RoutingHeader, {0, 0, false});
-			if(pkt_serialize(&r_sort, &resp_end, endof(resp), room->players[id].net.version))
-				instance_send_channeled(&room->players[id].net, &room->players[id].channels, resp, resp_end - resp, DeliveryMethod_ReliableOrdered);
-		}
-
-		struct InternalMessage r_identity = {
-			.type = InternalMessageType_PlayerIdentity,
-			.playerIdentity = *identity,
-		};
-		FOR_SOME_PLAYERS(id, room->connected,) {
-			uint8_t resp[65536], *resp_end = resp;
-			pkt_write_c(&resp_end, endof(resp), room->players[id].net.version, RoutingHeader, {InstanceSession_connectionId(room->players, session), 0, false});
-			if(pkt_serialize(&r_identity, &resp_end, endof(resp), room->players[id].net.version))
-				instance_send_channeled(&room->players[id].net, &room->players[id].channels, resp, resp_end - resp, DeliveryMethod_ReliableOrdered);
+			struct ReliableBatch batch;
+			batch_open(&batch, &room->players[id], (struct RoutingHeader){0, 0, false});
+			if(&room->players[id] != session)
+				batch_push(&batch, &r_connected);
+			batch_push(&batch, &r_sort);
+			batch_route(&batch, (struct RoutingHeader){InstanceSession_connectionId(room->players, session), 0, false});
+			batch_push_identity(&batch, session);
+			batch_flush(&batch);
 		}
 	}
 
@@ -1278,6 +1643,7 @@ static void process_message(struct InstanceContext *ctx, struct Room *room, stru
 			case InternalMessageType_KickPlayer: uprintf("BAD TYPE: InternalMessageType_KickPlayer\n"); break;
 			case InternalMessageType_PlayerStateUpdate: {
 				session->stateHash = message.playerStateUpdate.playerState;
+				session->serializedIdentity.count = 0;
 				session_refresh_stateHash(ctx, room, session);
 				break;
 			}
@@ -1350,8 +1716,11 @@ static void handle_ConnectRequest(struct InstanceContext *ctx, struct Room *room
 		if(indexof(room->players, session) == room->serverOwner) {
 			room->shortCountdown = info.countdownDuration / 4.f;
 			room->skipResults = info.skipResults;
-			room->perPlayerDifficulty = info.perPlayerDifficulty;
 			room->perPlayerModifiers = info.perPlayerModifiers;
+			if(room->perPlayerDifficulty != info.perPlayerDifficulty) {
+				room->perPlayerDifficulty = info.perPlayerDifficulty;
+				room_vote_reset(room);
+			}
 		}
 		check_length("BAD MOD HEADER LENGTH", sub, *data, mod.length, session->net.version);
 	}
@@ -1396,9 +1765,10 @@ static void handle_ConnectRequest(struct InstanceContext *ctx, struct Room *room
 
 	uprintf("connect[%zu]: %.*s (%.*s)\n", indexof(room->players, session), session->userName.length, session->userName.data, session->userId.length, session->userId.data);
 
+	struct ReliableBatch batch;
+	batch_open(&batch, session, (struct RoutingHeader){0, 0, false});
 	FOR_SOME_PLAYERS(id, room->connected,) {
-		resp_end = resp;
-		struct InternalMessage r_connected = {
+		batch_push(&batch, &(struct InternalMessage){
 			.type = InternalMessageType_PlayerConnected,
 			.playerConnected = {
 				.remoteConnectionId = InstanceSession_connectionId(room->players, &room->players[id]),
@@ -1406,39 +1776,28 @@ static void handle_ConnectRequest(struct InstanceContext *ctx, struct Room *room
 				.userName = room->players[id].userName,
 				.isConnectionOwner = 0,
 			},
-		};
-		pkt_write_c(&resp_end, endof(resp), session->net.version, RoutingHeader, {0, 0, false});
-		if(pkt_serialize(&r_connected, &resp_end, endof(resp), session->net.version))
-			instance_send_channeled(&session->net, &session->channels, resp, resp_end - resp, DeliveryMethod_ReliableOrdered);
-
-		resp_end = resp;
-		struct InternalMessage r_sort = {
+		});
+		batch_push(&batch, &(struct InternalMessage){
 			.type = InternalMessageType_PlayerSortOrderUpdate,
 			.playerSortOrderUpdate = {
 				.userId = room->players[id].userId,
 				.sortIndex = id,
 			},
-		};
-		pkt_write_c(&resp_end, endof(resp), session->net.version, RoutingHeader, {0, 0, false});
-		if(pkt_serialize(&r_sort, &resp_end, endof(resp), session->net.version))
-			instance_send_channeled(&session->net, &session->channels, resp, resp_end - resp, DeliveryMethod_ReliableOrdered);
+		});
+	}
 
-		resp_end = resp;
-		struct InternalMessage r_identity = {
-			.type = InternalMessageType_PlayerIdentity,
-			.playerIdentity = {
-				.playerState = room->players[id].stateHash,
-				.playerAvatar = room->players[id].avatar,
-				.random.length = 32,
-				.publicEncryptionKey = room->players[id].publicEncryptionKey,
-			},
-		};
-		memcpy(r_identity.playerIdentity.random.data, room->players[id].random, sizeof(room->players->random));
-		uprintf("TODO: do we need to include the encrytion key?\n");
-		pkt_write_c(&resp_end, endof(resp), session->net.version, RoutingHeader, {InstanceSession_connectionId(room->players, &room->players[id]), 0, false});
-		if(pkt_serialize(&r_identity, &resp_end, endof(resp), session->net.version))
-			instance_send_channeled(&session->net, &session->channels, resp, resp_end - resp, DeliveryMethod_ReliableOrdered);
+	bool sendLatency = (session->net.version.protocolVersion < 7); // Same gate as `room_flush_latency()`, on the receiving client
+	FOR_SOME_PLAYERS(id, room->connected,) {
+		batch_route(&batch, (struct RoutingHeader){InstanceSession_connectionId(room->players, &room->players[id]), 0, false});
+		batch_push_identity(&batch, &room->players[id]);
+		if(sendLatency && room->players[id].reportedLatency != 0) {
+			batch_push(&batch, &(struct InternalMessage){
+				.type = InternalMessageType_PlayerLatencyUpdate,
+				.playerLatencyUpdate.latency = room->players[id].reportedLatency,
+			});
+		}
 	}
+	batch_flush(&batch);
 
 	resp_end = resp;
 	pkt_write_c(&resp_end, endof(resp), session->net.version, RoutingHeader, {0, 0, false});
@@ -1474,36 +1833,295 @@ static void log_players(const struct Room *room, struct InstanceSession *session
 }
 
 static inline struct Room **instance_get_room(struct InstanceContext *ctx, uint16_t roomID) {
-	return &ctx->rooms[0][roomID];
+	struct RoomPage *page = ctx->pages[roomID / ROOM_PAGE_SIZE];
+	return page ? &page->rooms[roomID % ROOM_PAGE_SIZE] : NULL;
 }
 
-static void room_free(struct InstanceContext *ctx, struct Room **room) {
-	size_t roomID = indexof(*ctx->rooms, room);
-	net_keypair_free(&(*room)->keys);
-	free(*room);
+static inline struct Room *instance_find_room(struct InstanceContext *ctx, uint16_t roomID) {
+	struct Room **room = instance_get_room(ctx, roomID);
+	return room ? *room : NULL;
+}
+
+static inline struct RoomForward *instance_get_forward(struct InstanceContext *ctx, uint16_t roomID) {
+	struct RoomPage *page = ctx->pages[roomID / ROOM_PAGE_SIZE];
+	return page ? &page->forward[roomID % ROOM_PAGE_SIZE] : NULL;
+}
+
+static struct RoomPage *instance_page_alloc(struct InstanceContext *ctx, uint32_t index) {
+	if(ctx->pages[index])
+		return ctx->pages[index];
+	struct RoomPage *page = ctx->freePages;
+	if(page) {
+		ctx->freePages = page->next;
+		--ctx->freePages_len;
+	} else if(!(page = malloc(sizeof(*page)))) {
+		uprintf("alloc error\n");
+		return NULL;
+	}
+	memset(page, 0, sizeof(*page));
+	ctx->pages[index] = page; // Only reachable from the ingress stage once `pageMask` is set
+	ctx->resize = true;
+	return page;
+}
+
+static struct Room **room_install(struct InstanceContext *ctx, uint16_t roomID, struct Room *room) {
+	struct RoomPage *page = instance_page_alloc(ctx, roomID / ROOM_PAGE_SIZE);
+	if(!page)
+		return NULL;
+	struct Room **slot = &page->rooms[roomID % ROOM_PAGE_SIZE];
+	room->roomID = roomID;
+	room->ctx = ctx;
+	net_ingress_lock(&ctx->net);
+	*slot = room;
+	if(!page->open++)
+		Counter64_set(&ctx->pageMask[roomID / ROOM_PAGE_SIZE / 64], roomID / ROOM_PAGE_SIZE % 64);
+	net_ingress_unlock(&ctx->net);
+	ctx->resize = true;
+	return slot;
+}
+
+static void instance_announce(struct InstanceContext *ctx) {
+	wire_send(&ctx->net, ctx->master, &(struct WireMessage){
+		.cookie = 0,
+		.type = WireMessageType_WireSetAttribs,
+		.setAttribs = {
+			.capacity = ctx->capacity,
+			.discover = true,
+		},
+	});
+}
+
+// Releases empty pages and re-announces the capacity; the master fills the lowest free IDs first, so advertising twice the pages in use lets bursts of new rooms land without waiting on a round trip per page
+static void instance_resize(struct InstanceContext *ctx) {
+	if(!ctx->resize)
+		return;
+	ctx->resize = false;
+	uint32_t top = 0;
+	for(uint32_t i = 0; i < INSTANCE_MIGRATE_PAGE; ++i) {
+		struct RoomPage *page = ctx->pages[i];
+		if(!page)
+			continue;
+		if(page->open || page->forwarded) {
+			top = i + 1;
+			continue;
+		}
+		net_ingress_lock(&ctx->net);
+		ctx->pages[i] = NULL;
+		net_ingress_unlock(&ctx->net);
+		if(ctx->freePages_len < ROOM_PAGE_SPARE) {
+			page->next = ctx->freePages;
+			ctx->freePages = page;
+			++ctx->freePages_len;
+		} else {
+			free(page);
+		}
+	}
+	uint32_t pages = top * 2;
+	if(pages < ROOM_PAGE_HEADROOM)
+		pages = ROOM_PAGE_HEADROOM;
+	if(pages > INSTANCE_MIGRATE_PAGE)
+		pages = INSTANCE_MIGRATE_PAGE;
+	uint32_t capacity = pages * ROOM_PAGE_SIZE;
+	if(capacity == ctx->capacity || (capacity < ctx->capacity && capacity + ROOM_PAGE_SIZE >= ctx->capacity)) // Only shrink by two pages or more, so a room opening and closing at a page boundary doesn't flap
+		return;
+	uprintf("capacity (%u): %u -> %u\n", ctx->index, ctx->capacity, capacity);
+	ctx->capacity = capacity;
+	if(ctx->master)
+		instance_announce(ctx);
+}
+
+static void instance_pages_free(struct InstanceContext *ctx) {
+	for(uint32_t i = 0; i < lengthof(ctx->pages); ++i)
+		free(ctx->pages[i]);
+	memset(ctx->pages, 0, sizeof(ctx->pages));
+	memset(ctx->pageMask, 0, sizeof(ctx->pageMask));
+	while(ctx->freePages) {
+		struct RoomPage *page = ctx->freePages;
+		ctx->freePages = page->next;
+		free(page);
+	}
+	ctx->freePages_len = 0;
+}
+
+static void room_enqueue(struct Room *room) {
+	if(!sched_submit(&room->task))
+		return;
+	room->task.next = NULL;
+	*room->ctx->runnable_tail = &room->task;
+	room->ctx->runnable_tail = &room->task.next;
+}
+
+// Flags work for a room and queues it, unless a thread already has it; that thread sees the flag before letting go. IO thread only
+static void room_schedule(struct Room *room, uint_fast32_t work) {
+	uint_fast32_t run = atomic_load(&room->run), next;
+	do {
+		next = run | work;
+		if(!(run & (ROOM_QUEUED | ROOM_HELD)))
+			next |= ROOM_QUEUED;
+	} while(next != run && !atomic_compare_exchange_weak(&room->run, &run, next));
+	if(!(run & (ROOM_QUEUED | ROOM_HELD)))
+		room_enqueue(room);
+}
+
+// Claims a room for the IO thread; while a worker still has it, this returns false and the claim stays in place until the caller retries
+static bool room_hold(struct Room *room) {
+	return !(atomic_fetch_or(&room->run, ROOM_HELD) & ROOM_QUEUED);
+}
+
+// Claims a room only if no thread has it
+static bool room_try_hold(struct Room *room) {
+	uint_fast32_t run = atomic_load(&room->run);
+	do {
+		if(run & (ROOM_QUEUED | ROOM_HELD))
+			return false;
+	} while(!atomic_compare_exchange_weak(&room->run, &run, run | ROOM_HELD));
+	return true;
+}
+
+static void room_release(struct Room *room) {
+	if(atomic_fetch_and(&room->run, ~ROOM_HELD) & (ROOM_TICK | ROOM_INBOX))
+		room_schedule(room, 0);
+}
+
+// Datagrams already in the room's inbox stay there, and follow it if it migrates
+static void room_unlink(struct InstanceContext *ctx, struct Room **room) {
+	uint32_t index = (*room)->roomID / ROOM_PAGE_SIZE;
+	net_ingress_lock(&ctx->net);
+	FOR_SOME_PLAYERS(id, (*room)->linked,)
+		SessionIndex_remove(&ctx->sessions, &(*room)->players[id]);
 	*room = NULL;
-	uprintf("closing room (%zu,%hu)\n", indexof(contexts, ctx), roomID);
-	uint32_t group = roomID / lengthof(*ctx->rooms);
-	for(uint32_t i = 0; i < lengthof(*ctx->rooms); ++i)
-		if(ctx->rooms[group][i])
-			return;
-	Counter64_clear(&ctx->roomMask, group);
+	net_ingress_purge(&ctx->net, room);
+	if(!--ctx->pages[index]->open)
+		Counter64_clear(&ctx->pageMask[index / 64], index % 64);
+	net_ingress_unlock(&ctx->net);
+	ctx->resize = true; // The page itself is released later, since callers may still be iterating over it
+}
+
+static void room_free(struct InstanceContext *ctx, struct Room **room) {
+	uint16_t roomID = (*room)->roomID;
+	struct Room *data = *room;
+	room_unlink(ctx, room); // The ingress stage may still be resolving against this room
+	net_keypair_free(&data->keys);
+	free(data);
+	uprintf("closing room (%u,%hu)\n", ctx->index, roomID);
 }
 
 enum DisconnectMode {
 	DC_RESET = 1,
 	DC_NOTIFY = 2,
+	DC_DEFER = 4, // Off the IO thread: the session is released through a `SessionReleaseTask`, and empty rooms are left for the IO thread to close
+};
+
+static void room_close_notify(struct InstanceContext *ctx, uint16_t roomID) {
+	wire_send(&ctx->net, ctx->master, &(struct WireMessage){
+		.cookie = 0,
+		.type = WireMessageType_WireRoomCloseNotify,
+		.roomCloseNotify.room = roomID,
+	});
+}
+
+struct RoomCloseTask {
+	struct NetTask base;
+	uint16_t room;
+};
+
+static void RoomCloseTask_run(struct InstanceContext *ctx, struct RoomCloseTask *task) {
+	struct RoomForward *forward = instance_get_forward(ctx, task->room);
+	if(forward && forward->target) {
+		forward->target = NULL;
+		--ctx->pages[task->room / ROOM_PAGE_SIZE]->forwarded;
+		ctx->resize = true;
+	}
+	room_close_notify(ctx, task->room);
+}
+
+// Migrated rooms are closed through their origin, since that's where the master expects them
+static void room_close(struct InstanceContext *ctx, struct Room **room) {
+	uint16_t roomID = (*room)->roomID;
+	struct InstanceContext *origin = (*room)->origin;
+	uint16_t originID = (*room)->originID;
+	room_free(ctx, room);
+	if(!origin) {
+		room_close_notify(ctx, roomID);
+		return;
+	}
+	atomic_fetch_and(&ctx->migrateSlots, ~(1llu << (roomID - INSTANCE_MIGRATE_PAGE * ROOM_PAGE_SIZE)));
+	struct RoomCloseTask *task = malloc(sizeof(*task));
+	if(!task) {
+		uprintf("alloc error\n");
+		return;
+	}
+	*task = (struct RoomCloseTask){
+		.base.run = (void (*)(void*, struct NetTask*))RoomCloseTask_run,
+		.room = originID,
+	};
+	if(net_post(&origin->net, &task->base)) {
+		uprintf("net_post() failed\n");
+		free(task);
+	}
+}
+
+// Drops everything tying a session to this thread's socket; IO thread only
+static void session_release(struct InstanceContext *ctx, struct Room *room, struct InstanceSession *session, bool reset) {
+	net_ingress_lock(&ctx->net);
+	SessionIndex_remove(&ctx->sessions, session);
+	net_ingress_purge(&ctx->net, &session->net);
+	if(reset) {
+		net_session_reset(&ctx->net, &session->net);
+	} else {
+		if(!SessionIndex_find(&ctx->sessions, NetSession_get_addr(&session->net))) // The address may have joined again in another slot
+			net_steering_unroute(&instance_steering, NetSession_get_addr(&session->net), ctx->index);
+		net_session_free(&session->net);
+		CounterP_clear(&room->linked, indexof(room->players, session));
+	}
+	net_ingress_unlock(&ctx->net);
+}
+
+struct SessionReleaseTask {
+	struct NetTask base;
+	struct Room *room; // Pinned to this thread by `releasing`
+	playerid_t id;
 };
 
+static void SessionReleaseTask_run(struct InstanceContext *ctx, struct SessionReleaseTask *task) {
+	session_release(ctx, task->room, &task->room->players[task->id], false);
+	atomic_fetch_sub(&task->room->releasing, 1);
+}
+
+// Hands sessions disconnected during a run back to the IO thread; returns true if any are left for a later run
+static bool room_post_releases(struct InstanceContext *ctx, struct Room *room) {
+	FOR_SOME_PLAYERS(id, room->unreleased,) {
+		struct SessionReleaseTask *task = malloc(sizeof(*task));
+		if(!task) {
+			uprintf("alloc error\n");
+			return true;
+		}
+		*task = (struct SessionReleaseTask){
+			.base.run = (void (*)(void*, struct NetTask*))SessionReleaseTask_run,
+			.room = room,
+			.id = id,
+		};
+		if(net_post(&ctx->net, &task->base)) {
+			free(task);
+			return true;
+		}
+		CounterP_clear(&room->unreleased, id);
+	}
+	return false;
+}
+
 static void room_disconnect(struct InstanceContext *ctx, struct Room **room, struct InstanceSession *session, enum DisconnectMode mode) {
 	playerid_t id = indexof((*room)->players, session);
 	CounterP_clear(&(*room)->playerSort, id);
+	atomic_store(&(*room)->playerCount, CounterP_count((*room)->playerSort));
 	log_players(*room, session, (mode & DC_RESET) ? "reconnect" : "disconnect");
 	instance_channels_free(&session->channels);
-	if(mode & DC_RESET)
-		net_session_reset(&ctx->net, &session->net);
-	else
-		net_session_free(&session->net);
+	if(mode & DC_DEFER) {
+		CounterP_set(&(*room)->unreleased, id);
+		atomic_fetch_add(&(*room)->releasing, 1);
+	} else {
+		session_release(ctx, *room, session, mode & DC_RESET);
+	}
 
 	if(id == (*room)->serverOwner) {
 		(*room)->serverOwner = 0;
@@ -1538,19 +2156,13 @@ static void room_disconnect(struct InstanceContext *ctx, struct Room **room, str
 			session->state = 0;
 		}
 		return;
-	} else if(mode & DC_RESET) {
+	} else if(mode & (DC_RESET | DC_DEFER)) {
 		return;
 	}
-
-	room_free(ctx, room);
-	wire_send(&ctx->net, ctx->master, &(struct WireMessage){
-		.cookie = 0,
-		.type = WireMessageType_WireRoomCloseNotify,
-		.roomCloseNotify.room = indexof(*ctx->rooms, room),
-	});
+	room_close(ctx, room);
 }
 
-static inline void handle_packet(struct InstanceContext *ctx, struct Room **room, struct InstanceSession *session, const uint8_t *data, const uint8_t *end) {
+static inline void handle_packet(struct InstanceContext *ctx, struct Room **room, struct InstanceSession *session, const uint8_t *data, const uint8_t *end, enum DisconnectMode dcMode) {
 	struct NetPacketHeader header;
 	if(!pkt_read(&header, &data, end, session->net.version))
 		return;
@@ -1584,29 +2196,14 @@ static inline void handle_packet(struct InstanceContext *ctx, struct Room **room
 			case PacketProperty_Ack: handle_Ack(&session->net, &session->channels, &header.ack); break;
 			case PacketProperty_Ping: handle_Ping(&ctx->net, &session->net, &session->tableTennis, header.ping); break;
 			case PacketProperty_Pong: {
-				struct InternalMessage r_latency = {
-					.type = InternalMessageType_PlayerLatencyUpdate,
-					.playerLatencyUpdate = {
-						.latency = handle_Pong(&ctx->net, &session->net, &session->tableTennis, header.pong),
-					},
-				};
-				if(r_latency.playerLatencyUpdate.latency != 0 && session->net.version.protocolVersion < 7) {
-					FOR_EXCLUDING_PLAYER(id, (*room)->connected, indexof((*room)->players, session)) {
-						uint8_t resp[65536], *resp_end = resp;
-						pkt_write_c(&resp_end, endof(resp), (*room)->players[id].net.version, RoutingHeader, {
-							.remoteConnectionId = InstanceSession_connectionId((*room)->players, session),
-							.connectionId = 0,
-							.encrypted = false,
-						});
-						if(pkt_serialize(&r_latency, &resp_end, endof(resp), (*room)->players[id].net.version))
-							instance_send_channeled(&(*room)->players[id].net, &(*room)->players[id].channels, resp, resp_end - resp, DeliveryMethod_ReliableOrdered);
-					}
-				}
+				float latency = handle_Pong(&ctx->net, &session->net, &session->tableTennis, header.pong);
+				if(latency != 0)
+					session->latency = latency; // Recorded for every client, since any of them may be reported to a receiver older than protocol 7 by `room_flush_latency()`
 				break;
 			}
 			case PacketProperty_ConnectRequest: handle_ConnectRequest(ctx, *room, session, &header.connectRequest, &sub, data); break;
 			case PacketProperty_ConnectAccept: uprintf("BAD PROPERTY: PacketProperty_ConnectAccept\n"); break;
-			case PacketProperty_Disconnect: room_disconnect(ctx, room, session, DC_NOTIFY); return;
+			case PacketProperty_Disconnect: room_disconnect(ctx, room, session, dcMode); return;
 			case PacketProperty_UnconnectedMessage: uprintf("BAD PROPERTY: PacketProperty_UnconnectedMessage\n"); break;
 			case PacketProperty_MtuCheck: handle_MtuCheck(&ctx->net, &session->net, &header.mtuCheck); break;
 			case PacketProperty_Merged: uprintf("BAD TYPE: PacketProperty_Merged\n"); break;
@@ -1616,11 +2213,59 @@ static inline void handle_packet(struct InstanceContext *ctx, struct Room **room
 	} while(data < end);
 }
 
+// The IO thread is the only producer; a slot's datagrams are only read once the room is scheduled
+static void room_push(struct Room *room, struct InstanceSession *session, const uint8_t *data, uint32_t len, bool encrypted) {
+	struct RoomInbox *inbox = &room->inbox;
+	uint_fast32_t tail = atomic_load_explicit(&inbox->tail, memory_order_relaxed);
+	if(tail - atomic_load_explicit(&inbox->head, memory_order_acquire) >= ROOM_BACKLOG_MAX) {
+		atomic_fetch_add_explicit(&room->stats.dropped, 1, memory_order_relaxed);
+		return;
+	}
+	struct InstanceDatagram *datagram = &inbox->datagrams[tail % ROOM_BACKLOG_MAX];
+	datagram->session = session;
+	datagram->generation = session->generation;
+	datagram->len = len;
+	datagram->encrypted = encrypted;
+	memcpy(datagram->data, data, len);
+	atomic_store_explicit(&inbox->tail, tail + 1, memory_order_release);
+	room_schedule(room, ROOM_INBOX);
+}
+
+static uint64_t instance_clock_ns() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000llu + now.tv_nsec;
+}
+
+// Without workers, rooms run here between receive passes; rooms requeued along the way wait for the next call
+static void instance_run_inline(struct InstanceContext *ctx) {
+	struct SchedTask *task = ctx->runnable;
+	ctx->runnable = NULL;
+	ctx->runnable_tail = &ctx->runnable;
+	while(task) {
+		struct SchedTask *next = task->next;
+		task->run(task);
+		task = next;
+	}
+}
+
+#define INSTANCE_RECONNECT_MIN_MS 500
+#define INSTANCE_RECONNECT_MAX_MS 15000
+
 static const char *instance_masterAddress = NULL;
+static pthread_mutex_t instance_wire_mutex = PTHREAD_MUTEX_INITIALIZER; // Held while other threads open channels, since the first thread replaces `instance_wire` on reconnect
+static union WireLink *instance_wire = NULL; // One connection to a remote master, shared by every thread through its own channel
+
+static union WireLink *instance_master_channel(struct InstanceContext *ctx) {
+	pthread_mutex_lock(&instance_wire_mutex);
+	union WireLink *link = instance_wire ? wire_connect_channel(&ctx->net, instance_wire) : NULL;
+	pthread_mutex_unlock(&instance_wire_mutex);
+	return link;
+}
 static void *instance_handler(struct InstanceContext *ctx) {
 	net_lock(&ctx->net);
 	if(*instance_masterAddress) {
-		ctx->master = wire_connect_remote(&ctx->net, instance_masterAddress);
+		ctx->master = instance_master_channel(ctx);
 	} else if(ctx->master) {
 		struct NetContext *localMaster = WireLink_cast_local(ctx->master);
 		ctx->master = localMaster ? wire_connect_local(&ctx->net, localMaster) : NULL;
@@ -1629,22 +2274,18 @@ static void *instance_handler(struct InstanceContext *ctx) {
 		uprintf("wire_connect() failed\n");
 		goto fail;
 	}
-	wire_send(&ctx->net, ctx->master, &(struct WireMessage){
-		.cookie = 0,
-		.type = WireMessageType_WireSetAttribs,
-		.setAttribs = {
-			.capacity = sizeof(ctx->rooms) / sizeof(**ctx->rooms),
-			.discover = true,
-		},
-	});
+	instance_announce(ctx);
 	uprintf("Started\n");
-	uint8_t pkt[1536];
-	memset(pkt, 0, sizeof(pkt));
+	uint8_t data[1536];
 	uint32_t len;
 	struct Room **room;
 	struct InstanceSession *session;
-	while((len = net_recv(&ctx->net, pkt, (struct NetSession**)&session, (void**)&room)))
-		handle_packet(ctx, room, session, pkt, &pkt[len]);
+	while((len = net_recv(&ctx->net, data, (struct NetSession**)&session, (void**)&room))) {
+		do {
+			room_push(*room, session, data, len, net_recv_encrypted(&ctx->net));
+		} while((len = net_recv_pending(&ctx->net, data, (struct NetSession**)&session, (void**)&room)));
+		instance_run_inline(ctx);
+	}
 	if(ctx->master)
 		wire_disconnect(&ctx->net, ctx->master);
 	fail:
@@ -1654,60 +2295,373 @@ static void *instance_handler(struct InstanceContext *ctx) {
 
 // TODO: clients aren't guaranteed to use the same IP address when deeplinking from the master server to instances
 static struct NetSession *instance_onResolve(struct InstanceContext *ctx, struct SS addr, void **userdata_out) {
-	FOR_ALL_ROOMS(ctx, room) {
-		FOR_SOME_PLAYERS(id, (*room)->playerSort,) {
-			if(SS_equal(&addr, NetSession_get_addr(&(*room)->players[id].net))) {
-				*userdata_out = room;
-				return &(*room)->players[id].net;
-			}
+	struct SessionIndexEntry *entry = SessionIndex_find(&ctx->sessions, &addr);
+	if(!entry)
+		return NULL;
+	*userdata_out = entry->room;
+	return &entry->session->net;
+}
+
+static uint32_t instance_latencyPeriod = LATENCY_UPDATE_MS;
+static float instance_latencyThreshold = LATENCY_UPDATE_THRESHOLD;
+
+static void room_flush_latency(struct Room *room) {
+	struct CounterP changed = COUNTER128_CLEAR;
+	FOR_SOME_PLAYERS(id, room->connected,) {
+		float delta = room->players[id].latency - room->players[id].reportedLatency;
+		if(delta >= instance_latencyThreshold || delta <= -instance_latencyThreshold)
+			CounterP_set(&changed, id);
+	}
+	if(CounterP_isEmpty(changed))
+		return;
+	FOR_SOME_PLAYERS(id, room->connected,) {
+		if(room->players[id].net.version.protocolVersion >= 7) // Newer clients measure latency themselves
+			continue;
+		struct ReliableBatch batch;
+		batch_open(&batch, &room->players[id], (struct RoutingHeader){0, 0, false});
+		FOR_EXCLUDING_PLAYER(cmp, changed, id) { // Updates are attributed through the routing header, one player per segment
+			batch_route(&batch, (struct RoutingHeader){InstanceSession_connectionId(room->players, &room->players[cmp]), 0, false});
+			batch_push(&batch, &(struct InternalMessage){
+				.type = InternalMessageType_PlayerLatencyUpdate,
+				.playerLatencyUpdate.latency = room->players[cmp].latency,
+			});
 		}
+		batch_flush(&batch);
 	}
-	return NULL;
+	FOR_SOME_PLAYERS(id, changed,)
+		room->players[id].reportedLatency = room->players[id].latency;
 }
 
-static void instance_onResend(struct InstanceContext *ctx, uint32_t currentTime, uint32_t *nextTick) {
-	FOR_ALL_ROOMS(ctx, room) {
-		FOR_SOME_PLAYERS(id, (*room)->playerSort,) {
-			struct InstanceSession *session = &(*room)->players[id];
-			uint32_t kickTime = NetSession_get_lastKeepAlive(&session->net) + IDLE_TIMEOUT_MS;
-			if(currentTime > kickTime) {
-				uprintf("session timeout\n");
-				room_disconnect(ctx, room, session, DC_NOTIFY);
-			} else {
-				if(kickTime < *nextTick)
-					*nextTick = kickTime;
-				for(; session->channels.ru.base.sendAck; session->channels.ru.base.sendAck = 0)
-					flush_ack(&ctx->net, &session->net, &session->channels.ru.base.ack);
-				for(; session->channels.ro.base.sendAck; session->channels.ro.base.sendAck = 0)
-					flush_ack(&ctx->net, &session->net, &session->channels.ro.base.ack);
-				for(uint_fast8_t i = 0; i < 64; ++i)
-					try_resend(&ctx->net, &session->net, &session->channels.ru.base.resend[i], currentTime);
-				for(uint_fast8_t i = 0; i < 64; ++i)
-					try_resend(&ctx->net, &session->net, &session->channels.ro.base.resend[i], currentTime);
-				try_resend(&ctx->net, &session->net, &session->channels.rs.resend, currentTime);
-				*nextTick = currentTime + 15; // TODO: proper resend timing
+// Returns when the room's timers are next due
+static uint32_t room_tick(struct InstanceContext *ctx, struct Room **room, uint32_t currentTime) {
+	uint32_t nextTick = currentTime + 180000;
+	FOR_SOME_PLAYERS(id, (*room)->playerSort,) {
+		struct InstanceSession *session = &(*room)->players[id];
+		uint32_t kickTime = NetSession_get_lastKeepAlive(&session->net) + IDLE_TIMEOUT_MS;
+		if(currentTime > kickTime) {
+			uprintf("session timeout\n");
+			room_disconnect(ctx, room, session, DC_NOTIFY | DC_DEFER);
+		} else {
+			if(kickTime < nextTick)
+				nextTick = kickTime;
+			for(uint_fast8_t i = 0; i < 64; ++i)
+				try_resend(&ctx->net, &session->net, &session->channels.ru.base.resend[i], currentTime);
+			for(uint_fast8_t i = 0; i < 64; ++i)
+				try_resend(&ctx->net, &session->net, &session->channels.ro.base.resend[i], currentTime);
+			try_resend(&ctx->net, &session->net, &session->channels.rs.resend, currentTime);
+			nextTick = currentTime + 15; // TODO: proper resend timing
+		}
+	}
+
+	if((int32_t)(currentTime - (*room)->latencyTick) >= 0) {
+		room_flush_latency(*room);
+		(*room)->latencyTick = currentTime + instance_latencyPeriod;
+	}
+	if((*room)->latencyTick - currentTime < nextTick - currentTime)
+		nextTick = (*room)->latencyTick;
+
+	if((*room)->state & ServerState_Timeout) {
+		float delta = (*room)->global.timeout - room_get_syncTime(*room);
+		if(delta > 0) {
+			uint32_t ms = delta * 1000;
+			if(ms < 10)
+				ms = 10;
+			if(nextTick - currentTime > ms)
+				nextTick = currentTime + ms;
+		} else if((*room)->state & ServerState_Game_Results) { // TODO: ServerState_Lobby_Results = ServerState_Lobby_Idle >> 1
+			room_set_state(ctx, *room, ServerState_Lobby_Idle);
+		} else {
+			room_set_state(ctx, *room, (*room)->state << 1);
+		}
+	}
+	return nextTick;
+}
+
+// Acks and merged packets go out at the end of every run, rather than waiting for the next tick
+static void room_flush(struct InstanceContext *ctx, struct Room *room) {
+	FOR_SOME_PLAYERS(id, room->playerSort,) {
+		struct InstanceSession *session = &room->players[id];
+		for(; session->channels.ru.base.sendAck; session->channels.ru.base.sendAck = 0)
+			flush_ack(&ctx->net, &session->net, &session->channels.ru.base.ack);
+		for(; session->channels.ro.base.sendAck; session->channels.ro.base.sendAck = 0)
+			flush_ack(&ctx->net, &session->net, &session->channels.ro.base.ack);
+		net_flush_merged(&ctx->net, &session->net);
+	}
+}
+
+// Runs on a worker, or on the IO thread when there are none; only touches its own room and sessions
+static void room_run(struct SchedTask *task) {
+	struct Room *room = (struct Room*)task, **slot = &room; // `DC_DEFER` never closes the room, so nothing clears this
+	struct InstanceContext *ctx = room->ctx;
+	struct RoomInbox *inbox = &room->inbox;
+	uint_fast32_t run = atomic_fetch_and(&room->run, ~(ROOM_TICK | ROOM_INBOX));
+	if(run & ROOM_HELD) {
+		atomic_fetch_or(&room->run, run & (ROOM_TICK | ROOM_INBOX)); // Left for whoever runs the room after the IO thread
+	} else {
+		uint64_t start = instance_clock_ns(), busyNs = 0;
+		uint32_t done = 0;
+		uint_fast32_t head = atomic_load_explicit(&inbox->head, memory_order_relaxed);
+		for(; done < ROOM_PACKET_BUDGET && busyNs < ROOM_TIME_BUDGET_NS && head != atomic_load_explicit(&inbox->tail, memory_order_acquire); ++done) {
+			struct InstanceDatagram *datagram = &inbox->datagrams[head % ROOM_BACKLOG_MAX];
+			struct InstanceSession *session = datagram->session;
+			if(CounterP_get(room->playerSort, indexof(room->players, session)) && session->generation == datagram->generation) {
+				net_session_accept(&session->net, datagram->len, datagram->encrypted);
+				handle_packet(ctx, slot, session, datagram->data, &datagram->data[datagram->len], DC_NOTIFY | DC_DEFER);
 			}
+			atomic_store_explicit(&inbox->head, ++head, memory_order_release);
+			busyNs = instance_clock_ns() - start;
+		}
+		uint_fast32_t left = atomic_load(&inbox->tail) - head;
+		if(left) { // Over budget; the rest waits until every other queued room has had a turn
+			atomic_fetch_or(&room->run, ROOM_INBOX);
+			atomic_fetch_add_explicit(&room->stats.deferred, left, memory_order_relaxed);
+		}
+		if(run & ROOM_TICK)
+			atomic_store(&room->wakeTime, room_tick(ctx, slot, net_time()));
+		room_flush(ctx, room);
+		if(room_post_releases(ctx, room))
+			atomic_store(&room->wakeTime, net_time()); // Retried on the next tick
+		net_flush_staged(&ctx->net); // Before the IO thread can claim the room and send on its sessions
+		atomic_fetch_add_explicit(&room->stats.packets, done, memory_order_relaxed);
+		atomic_fetch_add_explicit(&room->stats.busyNs, instance_clock_ns() - start, memory_order_relaxed);
+	}
+	run = atomic_load(&room->run);
+	do {
+		if(!(run & ROOM_HELD) && (run & (ROOM_TICK | ROOM_INBOX))) {
+			room_enqueue(room);
+			return;
 		}
-		if(!*room)
+	} while(!atomic_compare_exchange_weak(&room->run, &run, run & ~ROOM_QUEUED)); // The room may be freed as soon as this succeeds
+}
+
+struct RoomMigrateTask {
+	struct NetTask base;
+	struct Room *room;
+	uint16_t roomID;
+};
+
+// Installs a room along with its sessions; the inverse of `room_unlink()`
+static struct Room **room_link(struct InstanceContext *ctx, uint16_t roomID, struct Room *room) {
+	struct Room **slot = room_install(ctx, roomID, room);
+	if(!slot)
+		return NULL;
+	net_ingress_lock(&ctx->net);
+	FOR_SOME_PLAYERS(id, room->linked,) {
+		if(SessionIndex_insert(&ctx->sessions, slot, &room->players[id]))
+			continue;
+		net_steering_route(&instance_steering, NetSession_get_addr(&room->players[id].net), ctx->index);
+	}
+	net_ingress_unlock(&ctx->net);
+	return slot;
+}
+
+static void RoomMigrateTask_run(struct InstanceContext *ctx, struct RoomMigrateTask *task) {
+	struct Room **room = room_link(ctx, task->roomID, task->room); // `INSTANCE_MIGRATE_PAGE` is allocated up front, so this can't fail
+	uprintf("room (%u,%hu) migrated to (%u,%hu)\n", (*room)->origin->index, (*room)->originID, ctx->index, task->roomID);
+	room_release(*room); // Held since `instance_balance()` on the origin
+}
+
+// Hands a held room to another thread without any client-visible change; datagrams dropped while in flight are covered by the reliable channels
+// Returns true if the room stays here, still held
+static bool room_migrate(struct InstanceContext *ctx, struct Room **room, struct InstanceContext *target) {
+	uint_fast64_t slots = atomic_load(&target->migrateSlots);
+	uint32_t bit;
+	do {
+		if(!~slots)
+			return true;
+		bit = __builtin_ctzll(~slots);
+	} while(!atomic_compare_exchange_weak(&target->migrateSlots, &slots, slots | 1llu << bit));
+	struct RoomMigrateTask *task = malloc(sizeof(*task));
+	if(!task) {
+		uprintf("alloc error\n");
+		goto release;
+	}
+	uint16_t roomID = (*room)->roomID, targetID = INSTANCE_MIGRATE_PAGE * ROOM_PAGE_SIZE + bit;
+	*task = (struct RoomMigrateTask){
+		.base.run = (void (*)(void*, struct NetTask*))RoomMigrateTask_run,
+		.room = *room,
+		.roomID = targetID,
+	};
+	struct Room *data = *room;
+	data->origin = ctx;
+	data->originID = roomID;
+	room_unlink(ctx, room); // Nothing here may resolve to the room, or hold datagrams for it, once the target can run it
+	if(net_post(&target->net, &task->base)) {
+		data->origin = NULL;
+		free(task);
+		room_link(ctx, roomID, data); // The page outlives this call, so the room goes back into the same slot
+		goto release;
+	}
+	struct RoomPage *page = ctx->pages[roomID / ROOM_PAGE_SIZE];
+	page->forward[roomID % ROOM_PAGE_SIZE] = (struct RoomForward){target, targetID};
+	++page->forwarded;
+	return false;
+	release:
+	atomic_fetch_and(&target->migrateSlots, ~(1llu << bit));
+	return true;
+}
+
+static void instance_balance(struct InstanceContext *ctx, uint32_t currentTime) {
+	if(!atomic_load(&instance_migrate) || (int32_t)(currentTime - ctx->nextBalance) < 0)
+		return;
+	ctx->nextBalance = currentTime + MIGRATE_INTERVAL_MS;
+	if(net_get_load(&ctx->net) < MIGRATE_LOAD_HIGH)
+		return;
+	struct InstanceContext *target = NULL;
+	double targetLoad = MIGRATE_LOAD_LOW;
+	for(struct InstanceContext *it = contexts; it < &contexts[threads_len]; ++it) {
+		double load = net_get_load(&it->net);
+		if(it != ctx && load < targetLoad)
+			target = it, targetLoad = load;
+	}
+	if(!target)
+		return;
+	// Move the largest room holding at most half of this thread's players, so the hotspot isn't simply relocated
+	uint32_t total = 0, best = 0;
+	struct Room **candidate = NULL;
+	FOR_ALL_ROOMS(ctx, room)
+		total += atomic_load(&(*room)->playerCount);
+	FOR_ALL_ROOMS(ctx, room) {
+		uint32_t count = atomic_load(&(*room)->playerCount);
+		if(!(*room)->origin && !atomic_load(&(*room)->releasing) && count > best && count * 2 <= total)
+			candidate = room, best = count;
+	}
+	if(candidate && room_try_hold(*candidate) && room_migrate(ctx, candidate, target)) // Rooms busy on a worker are left for a later round
+		room_release(*candidate);
+}
+
+// Reports live load to the master, which also treats a missing heartbeat as a stalled thread
+static void instance_heartbeat(struct InstanceContext *ctx, uint32_t currentTime, uint32_t *nextTick) {
+	uint32_t elapsed = currentTime - ctx->lastHeartbeat;
+	if(elapsed < WIRE_HEARTBEAT_INTERVAL_MS) {
+		if(WIRE_HEARTBEAT_INTERVAL_MS - elapsed < *nextTick - currentTime)
+			*nextTick = ctx->lastHeartbeat + WIRE_HEARTBEAT_INTERVAL_MS;
+		return;
+	}
+	struct Traffic traffic = net_get_traffic(&ctx->net);
+	uint32_t rooms = 0, players = 0;
+	FOR_ALL_ROOMS(ctx, room) {
+		++rooms;
+		players += atomic_load(&(*room)->playerCount);
+	}
+	wire_send(&ctx->net, ctx->master, &(struct WireMessage){
+		.cookie = 0,
+		.type = WireMessageType_WireHeartbeat,
+		.heartbeat = {
+			.load = net_get_load(&ctx->net),
+			.rooms = rooms,
+			.players = players,
+			.packetsPerSecond = (traffic.packetsIn + traffic.packetsOut - ctx->traffic.packetsIn - ctx->traffic.packetsOut) * 1000 / elapsed,
+			.bytesPerSecond = (traffic.bytesOut - ctx->traffic.bytesOut) * 1000 / elapsed,
+			.backlog = net_get_backlog(&ctx->net),
+		},
+	});
+	ctx->lastHeartbeat = currentTime;
+	ctx->traffic = traffic;
+	if(WIRE_HEARTBEAT_INTERVAL_MS < *nextTick - currentTime)
+		*nextTick = currentTime + WIRE_HEARTBEAT_INTERVAL_MS;
+}
+
+static void instance_backoff(struct InstanceContext *ctx) {
+	ctx->reconnectDelay = (ctx->reconnectDelay < INSTANCE_RECONNECT_MAX_MS / 2) ? ctx->reconnectDelay * 2 : INSTANCE_RECONNECT_MAX_MS;
+}
+
+// The master treats a new link as a fresh host, so every ID still in use here is reserved before it can be handed out again
+static void instance_announce_rooms(struct InstanceContext *ctx) {
+	for(uint32_t i = 0; i < INSTANCE_MIGRATE_PAGE; ++i) {
+		struct RoomPage *page = ctx->pages[i];
+		if(!page || (!page->open && !page->forwarded))
 			continue;
+		for(uint32_t slot = 0; slot < ROOM_PAGE_SIZE; ++slot) {
+			if(!page->rooms[slot] && !page->forward[slot].target)
+				continue;
+			wire_send(&ctx->net, ctx->master, &(struct WireMessage){
+				.cookie = 0,
+				.type = WireMessageType_WireRoomReserve,
+				.roomReserve.room = i * ROOM_PAGE_SIZE + slot,
+			});
+		}
+	}
+}
 
-		if((*room)->state & ServerState_Timeout) {
-			float delta = (*room)->global.timeout - room_get_syncTime(*room);
-			if(delta > 0) {
-				uint32_t ms = delta * 1000;
-				if(ms < 10)
-					ms = 10;
-				if(*nextTick - currentTime > ms)
-					*nextTick = currentTime + ms;
-			} else if((*room)->state & ServerState_Game_Results) { // TODO: ServerState_Lobby_Results = ServerState_Lobby_Idle >> 1
-				room_set_state(ctx, *room, ServerState_Lobby_Idle);
-			} else {
-				room_set_state(ctx, *room, (*room)->state << 1);
-			}
+// Re-dials a lost remote master, doubling the delay after each failure; the first thread owns the connection and the rest reopen their channels on it
+static void instance_reconnect(struct InstanceContext *ctx, uint32_t currentTime, uint32_t *nextTick) {
+	if(ctx->master || !instance_masterAddress || !*instance_masterAddress)
+		return;
+	if((int32_t)(currentTime - ctx->reconnectTime) < 0) {
+		if(ctx->reconnectTime - currentTime < *nextTick - currentTime)
+			*nextTick = ctx->reconnectTime;
+		return;
+	}
+	if(ctx->index == 0) {
+		pthread_mutex_lock(&instance_wire_mutex);
+		if(!instance_wire) {
+			uprintf("Reconnecting to master\n");
+			instance_wire = wire_connect_remote(&ctx->net, instance_masterAddress);
 		}
+		pthread_mutex_unlock(&instance_wire_mutex);
+	}
+	ctx->master = instance_master_channel(ctx);
+	if(!ctx->master) {
+		instance_backoff(ctx);
+		ctx->reconnectTime = currentTime + ctx->reconnectDelay;
+		if(ctx->reconnectDelay < *nextTick - currentTime)
+			*nextTick = ctx->reconnectTime;
+		return;
+	}
+	ctx->connectTime = currentTime;
+	instance_announce(ctx);
+	instance_announce_rooms(ctx);
+}
 
-		FOR_SOME_PLAYERS(id, (*room)->playerSort,)
-			net_flush_merged(&ctx->net, &(*room)->players[id].net);
+static void instance_run_joins(struct InstanceContext *ctx, uint32_t currentTime, uint32_t *nextTick);
+
+static void instance_onResend(struct InstanceContext *ctx, uint32_t currentTime, uint32_t *nextTick) {
+	instance_balance(ctx, currentTime);
+	instance_resize(ctx);
+	instance_reconnect(ctx, currentTime, nextTick);
+	instance_heartbeat(ctx, currentTime, nextTick);
+	instance_run_joins(ctx, currentTime, nextTick);
+	FOR_ALL_ROOMS(ctx, room) {
+		if(!atomic_load(&(*room)->playerCount) && !atomic_load(&(*room)->releasing) && room_try_hold(*room)) { // Left empty by a worker
+			room_close(ctx, room);
+			continue;
+		}
+		uint32_t wakeTime = atomic_load(&(*room)->wakeTime);
+		if((int32_t)(currentTime - wakeTime) >= 0) {
+			room_schedule(*room, ROOM_TICK);
+			wakeTime = currentTime + 15; // Checked again once the room has had a chance to publish its next wake time
+		}
+		if(wakeTime - currentTime < *nextTick - currentTime)
+			*nextTick = wakeTime;
+	}
+	instance_run_inline(ctx);
+	if(ctx->runnable) // Rooms over budget on the last pass
+		*nextTick = currentTime;
+	if((int32_t)(currentTime - ctx->nextStats) >= 0) {
+		ctx->nextStats = currentTime + ROOM_STATS_INTERVAL_MS;
+		uint32_t stats_len = 0;
+		FOR_ALL_ROOMS(ctx, room)
+			++stats_len;
+		struct StatusRoomStats *stats = malloc(stats_len * sizeof(*stats) + 1);
+		if(!stats) {
+			uprintf("alloc error\n");
+			return;
+		}
+		stats_len = 0;
+		FOR_ALL_ROOMS(ctx, room) {
+			stats[stats_len++] = (struct StatusRoomStats){
+				.thread = (*room)->origin ? (*room)->origin->index : ctx->index,
+				.room = (*room)->origin ? (*room)->originID : (*room)->roomID,
+				.playerCount = atomic_load(&(*room)->playerCount),
+				.packets = atomic_load_explicit(&(*room)->stats.packets, memory_order_relaxed),
+				.deferred = atomic_load_explicit(&(*room)->stats.deferred, memory_order_relaxed),
+				.dropped = atomic_load_explicit(&(*room)->stats.dropped, memory_order_relaxed),
+				.busyNs = atomic_load_explicit(&(*room)->stats.busyNs, memory_order_relaxed),
+			};
+		}
+		status_rooms_publish(ctx->index, stats, stats_len);
+		free(stats);
 	}
 }
 
@@ -1733,8 +2687,11 @@ static struct IPEndPoint instance_get_endpoint(struct NetContext *net, bool ipv4
 }
 
 static struct Room **room_open(struct InstanceContext *ctx, uint16_t roomID, struct GameplayServerConfiguration configuration) {
-	uprintf("opening room (%zu,%hu)\n", indexof(contexts, ctx), roomID);
-	if(*instance_get_room(ctx, roomID)) {
+	uprintf("opening room (%u,%hu)\n", ctx->index, roomID);
+	struct RoomPage *page = instance_page_alloc(ctx, roomID / ROOM_PAGE_SIZE);
+	if(!page)
+		return NULL;
+	if(page->rooms[roomID % ROOM_PAGE_SIZE] || page->forward[roomID % ROOM_PAGE_SIZE].target) {
 		uprintf("Room already open!\n");
 		return NULL;
 	}
@@ -1775,8 +2732,27 @@ static struct Room **room_open(struct InstanceContext *ctx, uint16_t roomID, str
 	room->perPlayerDifficulty = false;
 	room->perPlayerModifiers = false;
 	room->joinCount = 0;
+	room->latencyTick = net_time();
 	room->connected = COUNTER128_CLEAR;
 	room->playerSort = COUNTER128_CLEAR;
+	room->linked = COUNTER128_CLEAR;
+	room->unreleased = COUNTER128_CLEAR;
+	room->task.run = room_run;
+	atomic_init(&room->run, 0);
+	atomic_init(&room->wakeTime, net_time());
+	atomic_init(&room->playerCount, 0);
+	atomic_init(&room->releasing, 0);
+	atomic_init(&room->inbox.head, 0);
+	atomic_init(&room->inbox.tail, 0);
+	atomic_init(&room->stats.packets, 0);
+	atomic_init(&room->stats.deferred, 0);
+	atomic_init(&room->stats.dropped, 0);
+	atomic_init(&room->stats.busyNs, 0);
+	for(uint32_t id = 0; id < (uint32_t)configuration.maxPlayerCount; ++id)
+		room->players[id].generation = 0;
+	room->origin = NULL;
+	room->originID = 0;
+	room_vote_reset(room);
 	room->state = 0;
 	room->global.sessionId[0] = 0;
 	room->global.sessionId[1] = 0;
@@ -1790,9 +2766,7 @@ static struct Room **room_open(struct InstanceContext *ctx, uint16_t roomID, str
 		room->players[room->configuration.maxPlayerCount].userId = String_from("");
 	}
 	room_set_state(ctx, room, ServerState_Lobby_Idle);
-	*instance_get_room(ctx, roomID) = room;
-	Counter64_set(&ctx->roomMask, roomID / lengthof(*ctx->rooms));
-	return instance_get_room(ctx, roomID);
+	return room_install(ctx, roomID, room);
 }
 
 static struct String instance_room_get_managerId(struct Room *room) {
@@ -1801,7 +2775,7 @@ static struct String instance_room_get_managerId(struct Room *room) {
 
 static struct PacketContext instance_room_get_protocol(struct InstanceContext *ctx, uint16_t roomID) {
 	struct PacketContext version = PV_LEGACY_DEFAULT;
-	struct Room *room = *instance_get_room(ctx, roomID);
+	struct Room *room = instance_find_room(ctx, roomID);
 	struct CounterP ct = room->playerSort;
 	uint32_t id = 0;
 	if(CounterP_clear_next(&ct, &id))
@@ -1809,11 +2783,11 @@ static struct PacketContext instance_room_get_protocol(struct InstanceContext *c
 	return version;
 }
 
-static struct WireSessionAllocResp room_resolve_session(struct InstanceContext *ctx, const struct WireSessionAlloc *req) {
+static struct WireSessionAllocResp room_resolve_session_locked(struct InstanceContext *ctx, const struct WireSessionAlloc *req) {
 	struct WireSessionAllocResp resp = {
 		.result = ConnectToServerResponse_Result_UnknownError,
 	};
-	struct Room *room = *instance_get_room(ctx, req->room);
+	struct Room **slot = instance_get_room(ctx, req->room), *room = slot ? *slot : NULL;
 	if(!room)
 		return resp;
 	struct SS addr = {.len = req->address.length};
@@ -1827,7 +2801,7 @@ static struct WireSessionAllocResp room_resolve_session(struct InstanceContext *
 		}
 	}
 	if(!session) {
-		struct CounterP tmp = room->playerSort;
+		struct CounterP tmp = room->linked; // Slots still being released by the IO thread stay taken
 		uint32_t id = 0;
 		if((!CounterP_set_next(&tmp, &id)) || (int32_t)id >= room->configuration.maxPlayerCount) {
 			uprintf("ROOM FULL\n");
@@ -1836,16 +2810,29 @@ static struct WireSessionAllocResp room_resolve_session(struct InstanceContext *
 		session = &room->players[id];
 		net_session_init(&ctx->net, &session->net, addr);
 		session->net.version = req->version;
-		room->playerSort = tmp;
+		if(SessionIndex_insert(&ctx->sessions, slot, session)) {
+			net_session_free(&session->net);
+			return resp;
+		}
+		room->linked = tmp;
+	} else if(SessionIndex_insert(&ctx->sessions, slot, session)) { // Reconnects keep their slot
+		net_session_free(&session->net);
+		return resp;
 	}
+	CounterP_set(&room->playerSort, indexof(room->players, session));
+	atomic_store(&room->playerCount, CounterP_count(room->playerSort));
+	++session->generation; // Datagrams already in the inbox belong to the previous connection
 	session->secret = req->secret;
 	session->userName = req->userName;
 	session->userId = req->userId;
 	session->publicEncryptionKey.length = 0;
 	session->sentIdentity = false;
+	session->serializedIdentity.count = 0;
 	session->directDownloads = false;
 	session->joinOrder = ++room->joinCount;
 	session->state = 0;
+	session->latency = 0;
+	session->reportedLatency = 0;
 	session->recommendTime = 0;
 	session->recommendedBeatmap = CLEAR_BEATMAP;
 	session->recommendedModifiers = CLEAR_MODIFIERS;
@@ -1872,10 +2859,18 @@ static struct WireSessionAllocResp room_resolve_session(struct InstanceContext *
 	            memcmp(((struct sockaddr_in6*)req->address.data)->sin6_addr.s6_addr, (const uint8_t[]){0,0,0,0,0,0,0,0,0,0,255,255}, 12) == 0;
 	resp.endPoint = instance_get_endpoint(&ctx->net, ipv4);
 	resp.result = ConnectToServerResponse_Result_Success;
+	net_steering_route(&instance_steering, &addr, ctx->index);
 	log_players(room, session, "connect");
 	return resp;
 }
 
+static struct WireSessionAllocResp room_resolve_session(struct InstanceContext *ctx, const struct WireSessionAlloc *req) {
+	net_ingress_lock(&ctx->net);
+	struct WireSessionAllocResp resp = room_resolve_session_locked(ctx, req);
+	net_ingress_unlock(&ctx->net);
+	return resp;
+}
+
 static void instance_room_spawn(struct InstanceContext *ctx, union WireLink *link, uint32_t cookie, const struct WireRoomSpawn *req) {
 	struct WireMessage r_alloc = {
 		.type = WireMessageType_WireRoomSpawnResp,
@@ -1893,24 +2888,168 @@ static void instance_room_spawn(struct InstanceContext *ctx, union WireLink *lin
 	wire_send(&ctx->net, link, &r_alloc);
 }
 
-static void instance_room_join(struct InstanceContext *ctx, union WireLink *link, uint32_t cookie, const struct WireRoomJoin *req) {
-	struct WireMessage r_alloc = {
-		.type = WireMessageType_WireRoomJoinResp,
-		.cookie = cookie,
-	};
-	if(instance_room_get_protocol(ctx, req->base.room).protocolVersion != req->base.version.protocolVersion) {
+struct RoomJoinOp {
+	struct RoomJoinOp *next;
+	struct InstanceContext *origin; // Set on joins forwarded to a migrated room; the response goes back out through the origin's master link
+	uint32_t cookie;
+	uint16_t originID;
+	struct WireRoomJoin req;
+};
+
+// Returns true if a worker still has the room, leaving `resp` unset; the IO thread's claim stays in place until the join is retried
+static bool room_join(struct InstanceContext *ctx, const struct RoomJoinOp *op, struct WireSessionAllocResp *resp) {
+	*resp = (struct WireSessionAllocResp){.result = ConnectToServerResponse_Result_UnknownError};
+	struct Room *room = instance_find_room(ctx, op->req.base.room);
+	if(!room || (op->origin && (room->origin != op->origin || room->originID != op->originID))) // The slot may have been reused if the room closed in the meantime
+		return false;
+	if(!room_hold(room))
+		return true;
+	if(instance_room_get_protocol(ctx, op->req.base.room).protocolVersion != op->req.base.version.protocolVersion) {
 		uprintf("Connect to Server Error: Version mismatch\n");
-		r_alloc.roomJoinResp.base.result = ConnectToServerResponse_Result_VersionMismatch;
+		resp->result = ConnectToServerResponse_Result_VersionMismatch;
 	} else {
-		r_alloc.roomJoinResp.base = room_resolve_session(ctx, &req->base);
+		*resp = room_resolve_session(ctx, &op->req.base);
 	}
-	wire_send(&ctx->net, link, &r_alloc);
+	room_release(room);
+	return false;
+}
+
+struct RoomJoinRespTask {
+	struct NetTask base;
+	uint32_t cookie;
+	struct WireSessionAllocResp resp;
+};
+
+static void RoomJoinRespTask_run(struct InstanceContext *ctx, struct RoomJoinRespTask *task) {
+	wire_send(&ctx->net, ctx->master, &(struct WireMessage){
+		.type = WireMessageType_WireRoomJoinResp,
+		.cookie = task->cookie,
+		.roomJoinResp.base = task->resp,
+	});
+}
+
+static void RoomJoinOp_reply(struct InstanceContext *ctx, const struct RoomJoinOp *op, struct WireSessionAllocResp resp) {
+	if(!op->origin) {
+		wire_send(&ctx->net, ctx->master, &(struct WireMessage){
+			.type = WireMessageType_WireRoomJoinResp,
+			.cookie = op->cookie,
+			.roomJoinResp.base = resp,
+		});
+		return;
+	}
+	struct RoomJoinRespTask *task = malloc(sizeof(*task));
+	if(!task) {
+		uprintf("alloc error\n");
+		return;
+	}
+	*task = (struct RoomJoinRespTask){
+		.base.run = (void (*)(void*, struct NetTask*))RoomJoinRespTask_run,
+		.cookie = op->cookie,
+		.resp = resp,
+	};
+	if(net_post(&op->origin->net, &task->base)) {
+		uprintf("net_post() failed\n");
+		free(task);
+	}
+}
+
+// Joins for a room a worker has are retried from `instance_onResend()`
+static void room_join_submit(struct InstanceContext *ctx, const struct RoomJoinOp *op) {
+	struct WireSessionAllocResp resp;
+	if(!room_join(ctx, op, &resp)) {
+		RoomJoinOp_reply(ctx, op, resp);
+		return;
+	}
+	struct RoomJoinOp *pending = malloc(sizeof(*pending));
+	if(!pending) {
+		uprintf("alloc error\n");
+		RoomJoinOp_reply(ctx, op, (struct WireSessionAllocResp){.result = ConnectToServerResponse_Result_UnknownError});
+		room_release(instance_find_room(ctx, op->req.base.room));
+		return;
+	}
+	*pending = *op;
+	pending->next = NULL;
+	*ctx->joins_tail = pending;
+	ctx->joins_tail = &pending->next;
+}
+
+static void instance_run_joins(struct InstanceContext *ctx, uint32_t currentTime, uint32_t *nextTick) {
+	for(struct RoomJoinOp **op = &ctx->joins; *op;) {
+		struct WireSessionAllocResp resp;
+		if(room_join(ctx, *op, &resp)) {
+			op = &(*op)->next;
+			continue;
+		}
+		RoomJoinOp_reply(ctx, *op, resp);
+		struct RoomJoinOp *done = *op;
+		if(!(*op = done->next))
+			ctx->joins_tail = op;
+		free(done);
+	}
+	if(ctx->joins && *nextTick - currentTime > 1) // Workers give up held rooms at the end of their current run
+		*nextTick = currentTime + 1;
+}
+
+struct RoomJoinTask {
+	struct NetTask base;
+	struct RoomJoinOp op;
+};
+
+// Runs on the thread a room migrated to
+static void RoomJoinTask_run(struct InstanceContext *ctx, struct RoomJoinTask *task) {
+	room_join_submit(ctx, &task->op);
+}
+
+static void instance_room_join(struct InstanceContext *ctx, union WireLink *link, uint32_t cookie, const struct WireRoomJoin *req) {
+	struct RoomForward *slot = instance_get_forward(ctx, req->base.room);
+	struct RoomForward forward = slot ? *slot : (struct RoomForward){NULL, 0};
+	if(!forward.target) {
+		room_join_submit(ctx, &(struct RoomJoinOp){
+			.origin = NULL,
+			.cookie = cookie,
+			.req = *req,
+		});
+		return;
+	}
+	struct RoomJoinTask *task = malloc(sizeof(*task));
+	if(task) {
+		*task = (struct RoomJoinTask){
+			.base.run = (void (*)(void*, struct NetTask*))RoomJoinTask_run,
+			.op = {
+				.origin = ctx,
+				.cookie = cookie,
+				.originID = req->base.room,
+				.req = *req,
+			},
+		};
+		task->op.req.base.room = forward.room;
+		if(!net_post(&forward.target->net, &task->base))
+			return;
+		free(task);
+	}
+	uprintf("Failed to forward join for migrated room\n");
+	wire_send(&ctx->net, link, &(struct WireMessage){
+		.type = WireMessageType_WireRoomJoinResp,
+		.cookie = cookie,
+		.roomJoinResp.base.result = ConnectToServerResponse_Result_UnknownError,
+	});
 }
 
 static void instance_onWireMessage(struct InstanceContext *ctx, union WireLink *link, const struct WireMessage *message) {
+	if(!message && ctx->index == 0 && link == instance_wire) { // Freed once this returns
+		pthread_mutex_lock(&instance_wire_mutex);
+		instance_wire = NULL;
+		pthread_mutex_unlock(&instance_wire_mutex);
+	}
 	if(link != ctx->master)
 		return;
 	if(!message) {
+		uint32_t currentTime = net_time();
+		if(currentTime - ctx->connectTime >= INSTANCE_RECONNECT_MAX_MS) // Links that stayed up a while start over at the shortest delay
+			ctx->reconnectDelay = INSTANCE_RECONNECT_MIN_MS;
+		else
+			instance_backoff(ctx);
+		ctx->reconnectTime = currentTime + ctx->reconnectDelay;
 		ctx->master = NULL;
 		return;
 	}
@@ -1921,14 +3060,124 @@ static void instance_onWireMessage(struct InstanceContext *ctx, union WireLink *
 	}
 }
 
-static uint32_t threads_len = 0;
-static pthread_t *threads = NULL;
-bool instance_init(const char *domainIPv4, const char *domain, const char *remoteMaster, struct NetContext *localMaster, const char *mapPoolFile, uint32_t count) {
+static bool instance_context_init(struct InstanceContext *ctx, uint32_t index, uint16_t port, bool reusePort, struct NetContext *localMaster) {
+	if(net_init(&ctx->net, port, true, reusePort)) {
+		uprintf("net_init() failed\n");
+		return true;
+	}
+	ctx->net.userptr = ctx;
+	ctx->net.onResolve = (struct NetSession *(*)(void*, struct SS, void**))instance_onResolve;
+	ctx->net.onResend = (void (*)(void*, uint32_t, uint32_t*))instance_onResend;
+	ctx->net.onWireMessage = (void (*)(void*, union WireLink*, const struct WireMessage*))instance_onWireMessage;
+	ctx->index = index;
+	ctx->master = (union WireLink*)localMaster;
+	ctx->sessions = (struct SessionIndex){0, 0, NULL};
+	ctx->runnable = NULL;
+	ctx->runnable_tail = &ctx->runnable;
+	ctx->joins = NULL;
+	ctx->joins_tail = &ctx->joins;
+	net_defer_accept(&ctx->net); // Keepalives are stamped by whichever thread runs the room
+	memset(ctx->pageMask, 0, sizeof(ctx->pageMask));
+	memset(ctx->pages, 0, sizeof(ctx->pages));
+	ctx->freePages = NULL;
+	ctx->freePages_len = 0;
+	ctx->capacity = ROOM_PAGE_HEADROOM * ROOM_PAGE_SIZE;
+	ctx->resize = false;
+	ctx->migrateSlots = 0;
+	ctx->nextBalance = 0;
+	ctx->nextStats = 0;
+	ctx->lastHeartbeat = net_time();
+	ctx->traffic = net_get_traffic(&ctx->net);
+	ctx->connectTime = ctx->lastHeartbeat;
+	ctx->reconnectTime = ctx->lastHeartbeat;
+	ctx->reconnectDelay = INSTANCE_RECONNECT_MIN_MS;
+	return false;
+}
+
+#ifdef BENCHMARK
+// Fills a room one player at a time and totals the reliable traffic generated by the roster sync
+// Runs on a private context that never starts a thread, so nothing else observes the room
+void instance_benchmark_roster(uint32_t playerCount) {
+	struct InstanceContext *ctx = malloc(sizeof(*ctx));
+	if(!ctx) {
+		uprintf("alloc error\n");
+		return;
+	}
+	if(instance_context_init(ctx, 0, 0, false, NULL)) { // Standalone; never added to `contexts`
+		free(ctx);
+		return;
+	}
+	struct Room **room = room_open(ctx, 0, (struct GameplayServerConfiguration){
+		.maxPlayerCount = playerCount,
+		.discoveryPolicy = DiscoveryPolicy_Hidden,
+		.invitePolicy = InvitePolicy_AnyoneCanInvite,
+		.gameplayServerMode = GameplayServerMode_Countdown,
+		.songSelectionMode = SongSelectionMode_Vote,
+		.gameplayServerControlSettings = GameplayServerControlSettings_All,
+	});
+	if(!room)
+		goto cleanup;
+	struct NetKeypair keys;
+	net_keypair_init(&keys);
+	net_keypair_gen(&ctx->net, &keys);
+	uint32_t i = 0;
+	for(; i < (uint32_t)(*room)->configuration.maxPlayerCount; ++i) {
+		struct WireSessionAlloc req = {
+			.room = 0,
+			.address.length = 0,
+			.secret.length = 0,
+			.userId.length = sprintf(req.userId.data, "roster%u", i),
+			.userName.length = sprintf(req.userName.data, "Player %u", i),
+			.publicKey.length = sizeof(req.publicKey.data),
+			.version = PV_LEGACY_DEFAULT,
+		};
+		memcpy(req.random, NetKeypair_get_random(&keys), sizeof(req.random));
+		NetKeypair_write_key(&keys, &ctx->net, req.publicKey.data, &req.publicKey.length);
+		if(room_resolve_session(ctx, &req).result != ConnectToServerResponse_Result_Success)
+			break;
+		struct InstanceSession *session = &(*room)->players[i];
+		const uint8_t *mods = NULL;
+		handle_ConnectRequest(ctx, *room, session, &(struct ConnectRequest){
+			.protocolId = session->net.version.netVersion,
+			.secret = session->secret,
+			.userId = session->userId,
+			.userName = session->userName,
+		}, &mods, mods);
+		struct PlayerIdentity identity = {
+			.playerState.bloomFilter = {0, 0},
+			.playerAvatar = CLEAR_AVATARDATA,
+			.random.length = 32,
+			.publicEncryptionKey.length = 0,
+		};
+		memcpy(identity.random.data, NetKeypair_get_random(&keys), 32);
+		handle_PlayerIdentity(ctx, *room, session, &identity);
+	}
+	uint32_t packets = 0;
+	uint64_t bytes = 0;
+	FOR_SOME_PLAYERS(id, (*room)->playerSort,) {
+		packets += (*room)->players[id].channels.sentPackets;
+		bytes += (*room)->players[id].channels.sentBytes;
+		instance_channels_free(&(*room)->players[id].channels);
+		net_session_free(&(*room)->players[id].net);
+	}
+	uprintf("roster benchmark: %u players, %u reliable packets, %"PRIu64" bytes\n", i, packets, bytes);
+	net_keypair_free(&keys);
+	room_free(ctx, room);
+	cleanup:
+	instance_pages_free(ctx);
+	net_cleanup(&ctx->net);
+	free(ctx);
+}
+#endif
+
+bool instance_init(const char *domainIPv4, const char *domain, const char *remoteMaster, struct NetContext *localMaster, const char *mapPoolFile, uint32_t count, uint16_t port, uint32_t workers, bool pipeline, uint32_t latencyPeriod, uint32_t latencyDelta, const struct CpuList *cpus) {
 	if(mapPoolFile && *mapPoolFile)
 		mapPool_init(mapPoolFile);
 	instance_domainIPv4 = domainIPv4;
 	instance_domain = domain;
 	instance_masterAddress = remoteMaster;
+	instance_latencyPeriod = latencyPeriod;
+	instance_latencyThreshold = latencyDelta / 1000.f;
 	threads_len = 0;
 	contexts = malloc(count * sizeof(*contexts));
 	threads = malloc(count * sizeof(*threads));
@@ -1936,49 +3185,92 @@ bool instance_init(const char *domainIPv4, const char *domain, const char *remot
 		uprintf("alloc error\n");
 		return true;
 	}
+	if(port && net_steering_init(&instance_steering, count))
+		return true;
+	if(sched_init(workers))
+		return true;
+	bool migrate = (port && count > 1); // Migrated sessions need the shared port to keep their address
 	for(; threads_len < count; ++threads_len) {
 		struct InstanceContext *ctx = &contexts[threads_len];
-		if(net_init(&ctx->net, 5000 + threads_len, true)) {
-			uprintf("net_init() failed\n");
+		if(instance_context_init(ctx, threads_len, port ? port : 5000 + threads_len, port != 0, localMaster))
+			return true;
+		if(port && net_steering_attach(&instance_steering, &ctx->net, threads_len)) {
+			net_cleanup(&ctx->net);
 			return true;
 		}
-		ctx->net.userptr = &contexts[threads_len];
-		ctx->net.onResolve = (struct NetSession *(*)(void*, struct SS, void**))instance_onResolve;
-		ctx->net.onResend = (void (*)(void*, uint32_t, uint32_t*))instance_onResend;
-		ctx->net.onWireMessage = (void (*)(void*, union WireLink*, const struct WireMessage*))instance_onWireMessage;
-		ctx->roomMask = COUNTER64_CLEAR;
-		ctx->master = (union WireLink*)localMaster;
-		memset(ctx->rooms, 0, sizeof(ctx->rooms));
+		if(migrate && !instance_page_alloc(ctx, INSTANCE_MIGRATE_PAGE)) {
+			net_cleanup(&ctx->net);
+			return true;
+		}
+		if(pipeline && net_pipeline_start(&ctx->net)) { // `onResolve` runs on the ingress thread from here on
+			net_cleanup(&ctx->net);
+			return true;
+		}
+		if(threads_len == 0 && *instance_masterAddress) // Owned by the first thread; the rest send through it
+			instance_wire = wire_connect_remote(&ctx->net, instance_masterAddress);
 
-		if(pthread_create(&threads[threads_len], NULL, (void *(*)(void*))instance_handler, ctx))
+		pthread_attr_t attr;
+		if(affinity_attr_init(&attr, cpus, threads_len, "instance")) {
+			net_cleanup(&ctx->net);
+			return true;
+		}
+		if(pthread_create(&threads[threads_len], &attr, (void *(*)(void*))instance_handler, ctx))
 			threads[threads_len] = 0;
+		pthread_attr_destroy(&attr);
 		if(!threads[threads_len]) {
 			net_cleanup(&ctx->net);
 			uprintf("Instance thread creation failed\n");
 			return true;
 		}
 	}
+	atomic_store(&instance_migrate, migrate);
 	return false;
 }
 
 void instance_cleanup() {
+	atomic_store(&instance_migrate, false);
 	for(uint32_t i = 0; i < threads_len; ++i) {
 		if(threads[i]) {
-			struct InstanceContext *ctx = &contexts[i];
-			net_stop(&ctx->net);
+			net_stop(&contexts[i].net);
 			uprintf("Stopping #%u\n", i);
 			pthread_join(threads[i], NULL);
-			threads[i] = 0;
+		}
+	}
+	sched_cleanup(); // Every room is idle from here on
+	for(uint32_t i = 0; i < threads_len; ++i) { // Closing a migrated room posts to its origin, so every context must outlive this loop
+		if(threads[i]) {
+			struct InstanceContext *ctx = &contexts[i];
+			for(struct RoomJoinOp *op = ctx->joins, *next; op; op = next) {
+				next = op->next;
+				free(op);
+			}
+			ctx->joins = NULL;
 			FOR_ALL_ROOMS(ctx, room) {
+				FOR_SOME_PLAYERS(id, (*room)->linked,) // Releases still queued behind the stopped thread
+					if(!CounterP_get((*room)->playerSort, id))
+						session_release(ctx, *room, &(*room)->players[id], false);
+				atomic_store(&(*room)->releasing, 0);
 				FOR_SOME_PLAYERS(id, (*room)->playerSort,) {
 					room_disconnect(ctx, room, &(*room)->players[id], 0);
 				}
+				if(*room) // Emptied by a worker before the vacancy check could close it
+					room_close(ctx, room);
 			}
-			ctx->roomMask = COUNTER64_CLEAR; // should be redundant, but just to be safe
-			memset(ctx->rooms, 0, sizeof(ctx->rooms));
+		}
+	}
+	if(instance_wire && threads[0])
+		wire_disconnect(&contexts[0].net, instance_wire);
+	instance_wire = NULL;
+	for(uint32_t i = 0; i < threads_len; ++i) {
+		if(threads[i]) {
+			struct InstanceContext *ctx = &contexts[i];
+			threads[i] = 0;
+			instance_pages_free(ctx);
+			free(ctx->sessions.entries);
 			net_cleanup(&ctx->net);
 		}
 	}
+	net_steering_cleanup(&instance_steering);
 	free(instance_mapPool);
 	free(threads);
 	free(contexts);
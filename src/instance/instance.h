@@ -1,5 +1,10 @@
 #pragma once
 #include "../net.h"
+#include "../affinity.h"
 
-bool instance_init(const char *domainIPv4, const char *domain, const char *remoteMaster, struct NetContext *localMaster, const char *mapPoolFile, uint32_t count);
+bool instance_init(const char *domainIPv4, const char *domain, const char *remoteMaster, struct NetContext *localMaster, const char *mapPoolFile, uint32_t count, uint16_t port, uint32_t workers, bool pipeline, uint32_t latencyPeriod, uint32_t latencyDelta, const struct CpuList *cpus);
 void instance_cleanup();
+
+#ifdef BENCHMARK
+void instance_benchmark_roster(uint32_t playerCount);
+#endif
@@ -0,0 +1,177 @@
+#include "scheduler.h"
+#include "../net.h"
+#include <stdlib.h>
+
+static struct SchedWorker {
+	pthread_t thread;
+	struct SchedDeque { // Chase-Lev; the owner pushes and takes at the bottom, idle workers steal from the top
+		atomic_int_fast64_t top, bottom;
+		_Atomic(struct SchedTask*) tasks[SCHED_DEQUE_SIZE];
+	} deque;
+} *workers = NULL;
+static atomic_uint_fast32_t workers_len = 0; // Grows while `sched_init()` starts workers, which may already be stealing
+static _Thread_local struct SchedWorker *sched_self = NULL;
+
+// Submissions from outside the pool, and overflow from full deques
+static pthread_mutex_t sched_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sched_wake = PTHREAD_COND_INITIALIZER;
+static struct SchedTask *sched_head = NULL, **sched_tail = &sched_head;
+static atomic_uint sched_sleeping = 0;
+static bool sched_running = false;
+
+static bool SchedDeque_push(struct SchedDeque *deque, struct SchedTask *task) {
+	int_fast64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+	if(bottom - atomic_load(&deque->top) >= SCHED_DEQUE_SIZE)
+		return true;
+	atomic_store_explicit(&deque->tasks[bottom % SCHED_DEQUE_SIZE], task, memory_order_relaxed);
+	atomic_store(&deque->bottom, bottom + 1);
+	return false;
+}
+
+static struct SchedTask *SchedDeque_take(struct SchedDeque *deque) {
+	int_fast64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+	atomic_store(&deque->bottom, bottom);
+	int_fast64_t top = atomic_load(&deque->top);
+	if(top > bottom) {
+		atomic_store(&deque->bottom, bottom + 1);
+		return NULL;
+	}
+	struct SchedTask *task = atomic_load_explicit(&deque->tasks[bottom % SCHED_DEQUE_SIZE], memory_order_relaxed);
+	if(top == bottom) { // Last task; race any thief for it
+		if(!atomic_compare_exchange_strong(&deque->top, &top, top + 1))
+			task = NULL;
+		atomic_store(&deque->bottom, bottom + 1);
+	}
+	return task;
+}
+
+static struct SchedTask *SchedDeque_steal(struct SchedDeque *deque) {
+	int_fast64_t top = atomic_load(&deque->top);
+	if(top >= atomic_load(&deque->bottom))
+		return NULL;
+	struct SchedTask *task = atomic_load_explicit(&deque->tasks[top % SCHED_DEQUE_SIZE], memory_order_relaxed);
+	return atomic_compare_exchange_strong(&deque->top, &top, top + 1) ? task : NULL;
+}
+
+static void sched_signal() {
+	if(!atomic_load(&sched_sleeping))
+		return;
+	pthread_mutex_lock(&sched_mutex);
+	pthread_cond_signal(&sched_wake);
+	pthread_mutex_unlock(&sched_mutex);
+}
+
+// Must be called with `sched_mutex` held
+static struct SchedTask *sched_pop_shared() {
+	struct SchedTask *task = sched_head;
+	if(task && !(sched_head = task->next))
+		sched_tail = &sched_head;
+	return task;
+}
+
+static struct SchedTask *sched_find(struct SchedWorker *self) {
+	struct SchedTask *task = SchedDeque_take(&self->deque);
+	if(task)
+		return task;
+	pthread_mutex_lock(&sched_mutex);
+	task = sched_pop_shared();
+	pthread_mutex_unlock(&sched_mutex);
+	for(uint32_t i = 1; !task && i < workers_len; ++i)
+		task = SchedDeque_steal(&workers[((uint32_t)(self - workers) + i) % workers_len].deque);
+	return task;
+}
+
+static void *sched_worker(struct SchedWorker *self) {
+	mbedtls_entropy_context entropy;
+	mbedtls_ctr_drbg_context ctr_drbg;
+	mbedtls_entropy_init(&entropy);
+	mbedtls_ctr_drbg_init(&ctr_drbg);
+	if(mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy, (const uint8_t*)"sched", 5) != 0) {
+		uprintf("mbedtls_ctr_drbg_seed() failed\n");
+		goto fail;
+	}
+	net_set_thread_ctr_drbg(&ctr_drbg); // Room logic never touches the owning context's generator off its thread
+	net_set_thread_stage((uint32_t)(self - workers));
+	sched_self = self;
+	for(;;) {
+		struct SchedTask *task = sched_find(self);
+		if(task) {
+			task->run(task);
+			continue;
+		}
+		pthread_mutex_lock(&sched_mutex);
+		if(!sched_running) {
+			pthread_mutex_unlock(&sched_mutex);
+			break;
+		}
+		atomic_fetch_add(&sched_sleeping, 1); // Announced before the last look, so a concurrent `sched_signal()` can't be missed
+		task = sched_pop_shared();
+		for(uint32_t i = 1; !task && i < workers_len; ++i)
+			task = SchedDeque_steal(&workers[((uint32_t)(self - workers) + i) % workers_len].deque);
+		if(!task)
+			pthread_cond_wait(&sched_wake, &sched_mutex);
+		atomic_fetch_sub(&sched_sleeping, 1);
+		pthread_mutex_unlock(&sched_mutex);
+		if(task)
+			task->run(task);
+	}
+	sched_self = NULL;
+	net_set_thread_stage(~0u);
+	net_set_thread_ctr_drbg(NULL);
+	fail:
+	mbedtls_ctr_drbg_free(&ctr_drbg);
+	mbedtls_entropy_free(&entropy);
+	return 0;
+}
+
+bool sched_init(uint32_t count) {
+	if(count > SCHED_MAX_WORKERS)
+		count = SCHED_MAX_WORKERS;
+	workers_len = 0;
+	if(!count)
+		return false;
+	workers = calloc(count, sizeof(*workers));
+	if(!workers) {
+		uprintf("alloc error\n");
+		return true;
+	}
+	sched_running = true;
+	for(; workers_len < count; ++workers_len) {
+		if(pthread_create(&workers[workers_len].thread, NULL, (void *(*)(void*))sched_worker, &workers[workers_len])) {
+			uprintf("Worker thread creation failed\n");
+			return true;
+		}
+	}
+	uprintf("Started %u room workers\n", (uint32_t)workers_len);
+	return false;
+}
+
+void sched_cleanup() {
+	pthread_mutex_lock(&sched_mutex);
+	sched_running = false;
+	pthread_cond_broadcast(&sched_wake);
+	pthread_mutex_unlock(&sched_mutex);
+	for(uint32_t i = 0; i < workers_len; ++i)
+		pthread_join(workers[i].thread, NULL);
+	free(workers);
+	workers = NULL;
+	workers_len = 0;
+	sched_head = NULL;
+	sched_tail = &sched_head;
+}
+
+bool sched_submit(struct SchedTask *task) {
+	if(!workers_len)
+		return true;
+	if(sched_self && !SchedDeque_push(&sched_self->deque, task)) {
+		sched_signal(); // Lets an idle worker steal it
+		return false;
+	}
+	task->next = NULL;
+	pthread_mutex_lock(&sched_mutex);
+	*sched_tail = task;
+	sched_tail = &task->next;
+	pthread_cond_signal(&sched_wake);
+	pthread_mutex_unlock(&sched_mutex);
+	return false;
+}
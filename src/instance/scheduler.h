@@ -0,0 +1,16 @@
+#pragma once
+#include "../global.h"
+#include <stdatomic.h>
+
+#define SCHED_MAX_WORKERS 256
+#define SCHED_DEQUE_SIZE 1024 // Tasks a worker keeps local before spilling into the shared queue; must be a power of two
+
+// A unit of work for the shared pool; a task may submit itself again from `run()`, but must not be queued twice at once
+struct SchedTask {
+	void (*run)(struct SchedTask *task);
+	struct SchedTask *next; // Links the shared queue, or the caller's own list when there are no workers
+};
+
+bool sched_init(uint32_t workers);
+void sched_cleanup(); // Drops anything still queued
+bool sched_submit(struct SchedTask *task); // Never blocks; returns true if there are no workers, leaving the caller to run the task itself
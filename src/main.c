@@ -1,6 +1,9 @@
 #include "config.h"
 #include "instance/instance.h"
 #include "master/master.h"
+#ifdef BENCHMARK
+#include "master/pool.h"
+#endif
 #include "status/status.h"
 #include <unistd.h>
 #include <stdio.h>
@@ -11,8 +14,29 @@
 static const char *config_path = "./beatupserver.json";
 static bool headless = false;
 
+#ifdef BENCHMARK
+// Benchmarks run in place of the server, so they never share state with a live master or instance
+static int benchmark(const char *name, uint32_t count) {
+	if(strcmp(name, "roster") == 0) {
+		instance_benchmark_roster(count);
+	} else if(strcmp(name, "pool") == 0) {
+		pool_benchmark(count);
+	} else if(strcmp(name, "connect") == 0) {
+		master_benchmark_connect(count);
+	} else {
+		fprintf(stderr, "Unknown benchmark: %s\n", name);
+		return -1;
+	}
+	return 0;
+}
+#endif
+
 static struct Config cfg;
 int main(int argc, const char *argv[]) {
+	#ifdef BENCHMARK
+	if(argc == 4 && strcmp(argv[1], "--benchmark") == 0)
+		return benchmark(argv[2], strtoul(argv[3], NULL, 10));
+	#endif
 	// fprintf(stderr, "MAX CODE: %u\n", StringToServerCode("99999", 5));
 	for(const char **arg = &argv[1]; arg < &argv[argc]; ++arg) {
 		if(strcmp(*arg, "--daemon") == 0) {
@@ -38,23 +62,24 @@ int main(int argc, const char *argv[]) {
 	if(config_load(&cfg, config_path)) // TODO: live config reloading
 		goto fail0;
 	wire_set_key(cfg.wireKey, cfg.wireKey_len);
+	affinity_log_topology();
 	if(cfg.statusPort) {
 		status_internal_init();
 		if(mbedtls_pk_get_type(&cfg.statusKey) != MBEDTLS_PK_NONE) {
-			if(status_ssl_init(cfg.certs, cfg.keys, cfg.statusAddress, cfg.statusPath, cfg.statusPort))
+			if(status_ssl_init(cfg.certs, cfg.keys, cfg.statusAddress, cfg.statusPath, cfg.statusPort, &cfg.statusCpus))
 				goto fail1;
 		} else {
-			if(status_init(cfg.statusPath, cfg.statusPort))
+			if(status_init(cfg.statusPath, cfg.statusPort, &cfg.statusCpus))
 				goto fail1;
 		}
 	}
 	struct NetContext *localMaster = NULL;
 	if(cfg.masterPort) {
-		localMaster = master_init(cfg.certs, cfg.keys, cfg.masterPort);
+		localMaster = master_init(cfg.certs, cfg.keys, cfg.masterPort, cfg.masterSocket, cfg.masterCount, &cfg.masterCpus);
 		if(!localMaster)
 			goto fail3;
 	}
-	if(instance_init(cfg.instanceAddress[0], cfg.instanceAddress[1], cfg.instanceParent, localMaster, cfg.instanceMapPool, cfg.instanceCount))
+	if(instance_init(cfg.instanceAddress[0], cfg.instanceAddress[1], cfg.instanceParent, localMaster, cfg.instanceMapPool, cfg.instanceCount, cfg.instancePort, cfg.instanceWorkers, cfg.instancePipeline, cfg.instanceLatencyPeriod, cfg.instanceLatencyDelta, &cfg.instanceCpus))
 		goto fail4;
 	if(headless) {
 		#ifndef WINDOWS
@@ -84,6 +109,7 @@ int main(int argc, const char *argv[]) {
 			status_cleanup();
 	}
 	fail0:
+	wire_cleanup();
 	config_free(&cfg);
 	return 0;
 }
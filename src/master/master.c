@@ -6,6 +6,7 @@
 #include <string.h>
 
 #define MASTER_WINDOW_SIZE 64
+#define MASTER_CONNECT_HISTORY 8
 #define MASTER_SERIALIZE(data, pkt, end) pkt_serialize(data, pkt, end, PV_LEGACY_DEFAULT)
 
 struct MasterPacket {
@@ -33,6 +34,12 @@ struct MasterMultipartList {
 	uint16_t count;
 	uint8_t data[];
 };
+// Recent `ConnectToServerRequest`s, so client retransmits don't allocate a second room
+// A duplicate only needs another ack: the response either is still being allocated, or sits in `resend` until acknowledged
+struct MasterConnectHistory {
+	uint32_t count, next;
+	uint32_t requestIds[MASTER_CONNECT_HISTORY];
+};
 struct MasterSession {
 	struct NetSession net;
 	struct MasterSession *next;
@@ -41,6 +48,7 @@ struct MasterSession {
 	uint32_t ClientHelloWithCookieRequest_requestId;
 	HandshakeMessageType handshakeStep;
 	struct MasterResend resend;
+	struct MasterConnectHistory connectHistory;
 	struct MasterMultipartList *multipartList;
 };
 
@@ -73,6 +81,8 @@ static struct NetSession *master_onResolve(struct Context *ctx, struct SS addr,
 	session->resend.count = 0;
 	for(uint32_t i = 0; i < MASTER_WINDOW_SIZE; ++i)
 		session->resend.index[i].data = i;
+	session->connectHistory.count = 0;
+	session->connectHistory.next = 0;
 	session->multipartList = NULL;
 	session->next = ctx->sessionList;
 	ctx->sessionList = session;
@@ -99,6 +109,7 @@ static struct MasterSession *master_disconnect(struct MasterSession *session) {
 }
 
 static void master_onResend(struct Context *ctx, uint32_t currentTime, uint32_t *nextTick) {
+	pool_host_check(&ctx->net, currentTime, nextTick);
 	for(struct MasterSession **sp = &ctx->sessionList; *sp;) {
 		uint32_t kickTime = NetSession_get_lastKeepAlive(&(*sp)->net) + 180000;
 		if(currentTime > kickTime) { // this filters the RFC-1149 user
@@ -121,6 +132,18 @@ static void master_onResend(struct Context *ctx, uint32_t currentTime, uint32_t
 	}
 }
 
+// Returns true if `requestId` was already seen
+static bool MasterConnectHistory_add(struct MasterConnectHistory *history, uint32_t requestId) {
+	for(uint32_t i = 0; i < history->count; ++i)
+		if(history->requestIds[i] == requestId)
+			return true;
+	history->requestIds[history->next] = requestId;
+	history->next = (history->next + 1) % MASTER_CONNECT_HISTORY;
+	if(history->count < MASTER_CONNECT_HISTORY)
+		++history->count;
+	return false;
+}
+
 static uint32_t master_getNextRequestId(struct MasterSession *session) {
 	++session->lastSentRequestId;
 	return (session->lastSentRequestId & 63) | session->epoch;
@@ -253,6 +276,8 @@ static void handle_ClientHelloRequest(struct Context *ctx, struct MasterSession
 			return;
 		net_session_reset(&ctx->net, &session->net); // security or something idk
 		session->resend.count = 0;
+		session->connectHistory.count = 0; // Nothing from the old connection can be resent now
+		session->connectHistory.next = 0;
 	}
 	session->epoch = req->base.requestId & 0xff000000;
 	memcpy(session->net.clientRandom, req->random, 32);
@@ -427,6 +452,7 @@ enum {
 
 struct ConnectToServerCookie {
 	MasterCookieType cookieType;
+	struct Context *origin;
 	struct SS addr;
 	struct BaseMasterServerReliableRequest request;
 	uint32_t room;
@@ -434,13 +460,7 @@ struct ConnectToServerCookie {
 	struct BeatmapLevelSelectionMask selectionMask;
 };
 
-static void handle_WireSessionAllocResp(struct Context *ctx, struct PoolHost *host, uint32_t cookie, const struct WireSessionAllocResp *sessionAlloc, bool spawn) {
-	const struct ConnectToServerCookie *state = wire_getCookie(&ctx->net, cookie);
-	if(state == NULL || state->cookieType != MasterCookieType_ConnectToServer) {
-		uprintf("Connect to Server Error: Malformed wire cookie\n");
-		return;
-	}
-
+static void master_connect_finish(struct Context *ctx, const struct ConnectToServerCookie *state, const struct WireSessionAllocResp *sessionAlloc, ServerCode code) {
 	struct MasterSession *session = master_lookup_session(ctx, state->addr);
 	struct UserMessage r_conn = {
 		.type = UserMessageType_ConnectToServerResponse,
@@ -454,7 +474,7 @@ static void handle_WireSessionAllocResp(struct Context *ctx, struct PoolHost *ho
 	};
 
 	if(r_conn.connectToServerResponse.result == ConnectToServerResponse_Result_Success) {
-		r_conn.connectToServerResponse.code = pool_handle_code(host, state->room);
+		r_conn.connectToServerResponse.code = code;
 		r_conn.connectToServerResponse.userId.isNull = false;
 		r_conn.connectToServerResponse.userId.length = sprintf(r_conn.connectToServerResponse.userId.data, "beatupserver:%08x", rand()); // TODO: use meaningful id here
 		r_conn.connectToServerResponse.userName.length = 0;
@@ -469,8 +489,6 @@ static void handle_WireSessionAllocResp(struct Context *ctx, struct PoolHost *ho
 		r_conn.connectToServerResponse.managerId = sessionAlloc->managerId;
 		char scode[8];
 		uprintf("Sending player to room `%s`\n", ServerCodeToString(scode, r_conn.connectToServerResponse.code));
-	} else if(spawn) {
-		pool_handle_free(host, state->room);
 	}
 
 	uint8_t resp[65536], *resp_end = resp;
@@ -478,37 +496,141 @@ static void handle_WireSessionAllocResp(struct Context *ctx, struct PoolHost *ho
 		master_send(&ctx->net, session, MessageType_UserMessage, resp, resp_end, true);
 }
 
+// Hands an allocation result back to the thread owning the client's session
+struct ConnectResultTask {
+	struct NetTask base;
+	struct ConnectToServerCookie state;
+	bool hasSessionAlloc;
+	struct WireSessionAllocResp sessionAlloc;
+	ServerCode code;
+};
+
+static void ConnectResultTask_run(struct Context *ctx, struct ConnectResultTask *task) {
+	master_connect_finish(ctx, &task->state, task->hasSessionAlloc ? &task->sessionAlloc : NULL, task->code);
+}
+
+// Called on the thread owning `host`'s wire link
+static void master_connect_result(struct Context *ctx, struct PoolHost *host, const struct ConnectToServerCookie *state, const struct WireSessionAllocResp *sessionAlloc, bool spawn) {
+	ServerCode code = ServerCode_NONE;
+	if(sessionAlloc && sessionAlloc->result == ConnectToServerResponse_Result_Success)
+		code = pool_handle_code(host, state->room);
+	else if(spawn)
+		pool_handle_free(host, state->room);
+	if(state->origin == ctx) {
+		master_connect_finish(ctx, state, sessionAlloc, code);
+		return;
+	}
+	struct ConnectResultTask *task = malloc(sizeof(*task));
+	if(!task) {
+		uprintf("alloc error\n");
+		return;
+	}
+	*task = (struct ConnectResultTask){
+		.base.run = (void (*)(void*, struct NetTask*))ConnectResultTask_run,
+		.state = *state,
+		.hasSessionAlloc = (sessionAlloc != NULL),
+		.code = code,
+	};
+	if(sessionAlloc)
+		task->sessionAlloc = *sessionAlloc;
+	if(net_post(&state->origin->net, &task->base))
+		free(task);
+}
+
+static void handle_WireSessionAllocResp(struct Context *ctx, struct PoolHost *host, uint32_t cookie, const struct WireSessionAllocResp *sessionAlloc, bool spawn) {
+	const struct ConnectToServerCookie *state = wire_getCookie(&ctx->net, cookie);
+	if(state == NULL || state->cookieType != MasterCookieType_ConnectToServer) {
+		uprintf("Connect to Server Error: Malformed wire cookie\n");
+		return;
+	}
+	master_connect_result(ctx, host, state, sessionAlloc, spawn);
+}
+
 static void master_onWireMessage(struct Context *ctx, union WireLink *link, const struct WireMessage *message) {
 	struct PoolHost *host = pool_host_lookup(link);
 	if(!host) {
-		uprintf("pool_host_lookup() failed\n"); // If we hit this, something went horribly wrong
+		uprintf("pool_host_lookup() failed\n"); // Local links may still have messages queued after detaching; never touch the sender here
 		if(message) {
-			wire_disconnect(&ctx->net, link);
+			wire_releaseCookie(&ctx->net, message->cookie);
 		} else {
-			for(uint32_t cookie = 0; (cookie = wire_nextCookie(&ctx->net, cookie));)
+			for(uint32_t cookie; (cookie = wire_nextCookie(&ctx->net, link));)
 				wire_releaseCookie(&ctx->net, cookie);
 		}
 		return;
 	}
 	if(!message) {
-		for(uint32_t cookie = 0; (cookie = wire_nextCookie(&ctx->net, cookie));) {
-			if(cookie == MasterCookieType_ConnectToServer) // TODO: retry with a different instance if any are still alive
-				handle_WireSessionAllocResp(ctx, host, cookie, NULL, false);
+		for(uint32_t cookie; (cookie = wire_nextCookie(&ctx->net, link));) {
+			handle_WireSessionAllocResp(ctx, host, cookie, NULL, false); // TODO: retry with a different instance if any are still alive
 			wire_releaseCookie(&ctx->net, cookie);
 		}
 		pool_host_detach(host);
 		return;
 	}
 	switch(message->type) {
-		case WireMessageType_WireSetAttribs: TEMPpool_host_setAttribs(host, message->setAttribs.capacity, message->setAttribs.discover); break;
+		case WireMessageType_WireSetAttribs: pool_host_setAttribs(host, message->setAttribs.capacity, message->setAttribs.discover); break;
 		case WireMessageType_WireRoomSpawnResp: handle_WireSessionAllocResp(ctx, host, message->cookie, &message->roomSpawnResp.base, true); break;
 		case WireMessageType_WireRoomJoinResp: handle_WireSessionAllocResp(ctx, host, message->cookie, &message->roomJoinResp.base, false); break;
 		case WireMessageType_WireRoomCloseNotify: pool_handle_free(host, message->roomCloseNotify.room); break;
+		case WireMessageType_WireHeartbeat: pool_host_heartbeat(host, &message->heartbeat, net_time()); break;
+		case WireMessageType_WireRoomReserve: pool_handle_reserve(host, message->roomReserve.room); break;
 		default: uprintf("UNHANDLED WIRE MESSAGE [%s]\n", reflect(WireMessageType, message->type));
 	}
 	wire_releaseCookie(&ctx->net, message->cookie);
 }
 
+// Forwards a request to the thread owning the host's wire link, since only that thread may write to it
+struct WireRequestTask {
+	struct NetTask base;
+	struct PoolHost *host;
+	union WireLink *link;
+	struct ConnectToServerCookie state;
+	struct WireMessage message;
+};
+
+static void master_wire_send(struct Context *ctx, struct PoolHost *host, union WireLink *link, const struct ConnectToServerCookie *state, struct WireMessage *message) {
+	bool spawn = (message->type == WireMessageType_WireRoomSpawn);
+	if(!link || pool_host_wire(host) != link) {
+		uprintf("Connect to Server Error: Instance detached\n");
+		master_connect_result(ctx, host, state, NULL, false); // The room handle went with the old link, and the slot may already belong to a new one
+		return;
+	}
+	message->cookie = wire_reserveCookie(&ctx->net, link, (void*)state, sizeof(*state));
+	if(wire_send(&ctx->net, link, message)) {
+		wire_releaseCookie(&ctx->net, message->cookie);
+		master_connect_result(ctx, host, state, NULL, spawn);
+	}
+}
+
+static void WireRequestTask_run(struct Context *ctx, struct WireRequestTask *task) {
+	master_wire_send(ctx, task->host, task->link, &task->state, &task->message);
+}
+
+static void master_wire_request(struct Context *ctx, struct PoolHost *host, const struct ConnectToServerCookie *state, struct WireMessage *message) {
+	struct NetContext *owner = pool_host_owner(host);
+	union WireLink *link = pool_host_wire(host);
+	if(!owner || owner == &ctx->net) {
+		master_wire_send(ctx, host, link, state, message);
+		return;
+	}
+	struct WireRequestTask *task = malloc(sizeof(*task));
+	if(!task) {
+		uprintf("alloc error\n");
+		master_connect_result(ctx, host, state, NULL, message->type == WireMessageType_WireRoomSpawn);
+		return;
+	}
+	*task = (struct WireRequestTask){
+		.base.run = (void (*)(void*, struct NetTask*))WireRequestTask_run,
+		.host = host,
+		.link = link,
+		.state = *state,
+		.message = *message,
+	};
+	if(net_post(owner, &task->base)) {
+		free(task);
+		master_connect_result(ctx, host, state, NULL, message->type == WireMessageType_WireRoomSpawn);
+	}
+}
+
 // TODO: more consistent naming
 static void SendConnectError(struct Context *ctx, struct MasterSession *session, struct BaseMasterServerReliableRequest request, ConnectToServerResponse_Result result) {
 	struct UserMessage r_conn = {
@@ -530,9 +652,11 @@ static void SendConnectError(struct Context *ctx, struct MasterSession *session,
 
 static void handle_ConnectToServerRequest(struct Context *ctx, struct MasterSession *session, const struct ConnectToServerRequest *req) {
 	master_send_ack(ctx, session, MessageType_UserMessage, req->base.base.requestId);
-	// TODO: do we need to deduplicate this request?
+	if(MasterConnectHistory_add(&session->connectHistory, req->base.base.requestId))
+		return;
 	struct ConnectToServerCookie state = {
 		.cookieType = MasterCookieType_ConnectToServer,
+		.origin = ctx,
 		.addr = *NetSession_get_addr(&session->net),
 		.request = req->base.base,
 		.room = ~0u,
@@ -554,49 +678,42 @@ static void handle_ConnectToServerRequest(struct Context *ctx, struct MasterSess
 	};
 	memcpy(sessionAllocData.address.data, &state.addr.ss, state.addr.len);
 	memcpy(sessionAllocData.random, req->base.random, sizeof(sessionAllocData.random));
-	uint32_t cookie;
-	bool failed;
+	struct PoolHost *host;
+	struct WireMessage message;
 	if(req->code == ServerCode_NONE) {
 		if(!req->secret.length) {
 			uprintf("Connect to Server Error: Quickplay not supported\n");
 			SendConnectError(ctx, session, state.request, ConnectToServerResponse_Result_NoAvailableDedicatedServers); // Quick Play not yet available
 			return;
 		}
-		struct PoolHost *host = pool_handle_new(&state.room, false);
+		host = pool_handle_new(&state.room, true);
 		if(!host) {
 			uprintf("Connect to Server Error: pool_handle_new() failed\n");
 			SendConnectError(ctx, session, state.request, ConnectToServerResponse_Result_NoAvailableDedicatedServers);
 			return;
 		}
 		sessionAllocData.room = state.room;
-		cookie = wire_reserveCookie(&ctx->net, &state, sizeof(state));
-		failed = wire_send(&ctx->net, pool_host_wire(host), &(struct WireMessage){
+		message = (struct WireMessage){
 			.type = WireMessageType_WireRoomSpawn,
-			.cookie = cookie,
 			.roomSpawn = {
 				.base = sessionAllocData,
 				.configuration = req->configuration,
 			},
-		});
+		};
 	} else {
-		struct PoolHost *host = pool_handle_lookup(&state.room, req->code);
+		host = pool_handle_lookup(&state.room, req->code);
 		if(!host) {
 			uprintf("Connect to Server Error: Room code does not exist\n");
 			SendConnectError(ctx, session, state.request, ConnectToServerResponse_Result_InvalidCode);
 			return;
 		}
 		sessionAllocData.room = state.room;
-		cookie = wire_reserveCookie(&ctx->net, &state, sizeof(state));
-		failed = wire_send(&ctx->net, pool_host_wire(host), &(struct WireMessage){
+		message = (struct WireMessage){
 			.type = WireMessageType_WireRoomJoin,
-			.cookie = cookie,
 			.roomJoin.base = sessionAllocData,
-		});
-	}
-	if(failed) {
-		wire_releaseCookie(&ctx->net, cookie);
-		SendConnectError(ctx, session, state.request, ConnectToServerResponse_Result_UnknownError);
+		};
 	}
+	master_wire_request(ctx, host, &state, &message);
 	/*struct BitMask128 customs = get_mask("custom_levelpack_CustomLevels");
 	req->selectionMask.songPacks.bloomFilter.d0 |= customs.d0;
 	req->selectionMask.songPacks.bloomFilter.d1 |= customs.d1;*/
@@ -730,53 +847,174 @@ static void *master_handler(struct Context *ctx) {
 	return 0;
 }
 
-static void master_onWireLink(struct Context*, union WireLink *link) {
-	struct PoolHost *host = pool_host_attach((union WireLink*)link);
+static void master_onWireLink(struct Context *ctx, union WireLink *link) {
+	struct PoolHost *host = pool_host_attach(&ctx->net, (union WireLink*)link);
 	if(!host)
 		uprintf("TEMPwire_attach_local() failed\n");
 }
 
-static pthread_t master_thread = NET_THREAD_INVALID;
-static struct Context ctx = {CLEAR_NETCONTEXT, NULL, NULL, NULL}; // TODO: This "singleton" can't actually scale up due to the pool API no longer being threadsafe
-struct NetContext *master_init(const mbedtls_x509_crt *cert, const mbedtls_pk_context *key, uint16_t port) {
-	if(net_init(&ctx.net, port, false)) {
-		uprintf("net_init() failed\n");
-		return NULL;
-	}
-	uint_fast8_t count = 0;
-	for(const mbedtls_x509_crt *it = cert; it; it = it->next, ++count) {
+// Each thread owns a socket on the shared port and the sessions the kernel hashes to it; the pool is shared
+static uint32_t threads_len = 0;
+static pthread_t *threads = NULL;
+static struct Context *contexts = NULL;
+struct NetContext *master_init(const mbedtls_x509_crt *cert, const mbedtls_pk_context *key, uint16_t port, const char *socketPath, uint32_t count, const struct CpuList *cpus) {
+	uint_fast8_t certCount = 0;
+	for(const mbedtls_x509_crt *it = cert; it; it = it->next, ++certCount) {
 		if(it->raw.len > 4096) {
 			uprintf("Host certificate too large\n");
 			return NULL;
 		}
 	}
-	if(count > lengthof(((struct ServerCertificateRequest*)NULL)->certificateList)) {
+	if(certCount > lengthof(((struct ServerCertificateRequest*)NULL)->certificateList)) {
 		uprintf("Host certificate chain too long\n");
 		return NULL;
 	}
-	ctx.cert = cert;
-	ctx.key = key;
-	ctx.net.userptr = &ctx;
-	ctx.net.onResolve = (struct NetSession *(*)(void*, struct SS, void**))master_onResolve;
-	ctx.net.onResend = (void (*)(void*, uint32_t, uint32_t*))master_onResend;
-	ctx.net.onWireLink = (void (*)(void*, union WireLink*))master_onWireLink;
-	ctx.net.onWireMessage = (void (*)(void*, union WireLink*, const struct WireMessage*))master_onWireMessage;
-	if(pthread_create(&master_thread, NULL, (void *(*)(void*))master_handler, &ctx)) {
-		master_thread = NET_THREAD_INVALID;
+	#ifdef WINDOWS
+	if(count > 1)
+		uprintf("Multiple master threads are not supported on this platform\n");
+	count = 1;
+	#endif
+	if(!count)
+		count = 1;
+	threads_len = 0;
+	contexts = malloc(count * sizeof(*contexts));
+	threads = malloc(count * sizeof(*threads));
+	if(!contexts || !threads) {
+		uprintf("alloc error\n");
 		return NULL;
 	}
-	return &ctx.net;
+	for(; threads_len < count; ++threads_len) {
+		struct Context *ctx = &contexts[threads_len];
+		*ctx = (struct Context){CLEAR_NETCONTEXT, cert, key, NULL};
+		if(net_init(&ctx->net, port, false, count > 1)) {
+			uprintf("net_init() failed\n");
+			return NULL;
+		}
+		if(threads_len == 0 && pool_seed(net_get_ctr_drbg(&ctx->net))) {
+			net_cleanup(&ctx->net);
+			return NULL;
+		}
+		if(threads_len == 0 && *socketPath && net_listen_unix(&ctx->net, socketPath)) {
+			net_cleanup(&ctx->net);
+			return NULL;
+		}
+		ctx->net.userptr = ctx;
+		ctx->net.onResolve = (struct NetSession *(*)(void*, struct SS, void**))master_onResolve;
+		ctx->net.onResend = (void (*)(void*, uint32_t, uint32_t*))master_onResend;
+		ctx->net.onWireLink = (void (*)(void*, union WireLink*))master_onWireLink;
+		ctx->net.onWireMessage = (void (*)(void*, union WireLink*, const struct WireMessage*))master_onWireMessage;
+		pthread_attr_t attr;
+		if(affinity_attr_init(&attr, cpus, threads_len, "master")) {
+			net_cleanup(&ctx->net);
+			return NULL;
+		}
+		bool failed = pthread_create(&threads[threads_len], &attr, (void *(*)(void*))master_handler, ctx);
+		pthread_attr_destroy(&attr);
+		if(failed) {
+			net_cleanup(&ctx->net);
+			uprintf("Master thread creation failed\n");
+			return NULL;
+		}
+	}
+	return &contexts[0].net;
 }
 
 void master_cleanup() {
-	if(master_thread != NET_THREAD_INVALID) {
-		net_stop(&ctx.net);
-		uprintf("Stopping\n");
-		pthread_join(master_thread, NULL);
-		master_thread = NET_THREAD_INVALID;
-		while(ctx.sessionList)
-			ctx.sessionList = master_disconnect(ctx.sessionList);
+	for(uint32_t i = 0; i < threads_len; ++i)
+		net_stop(&contexts[i].net);
+	for(uint32_t i = 0; i < threads_len; ++i) {
+		uprintf("Stopping #%u\n", i);
+		pthread_join(threads[i], NULL);
+		while(contexts[i].sessionList)
+			contexts[i].sessionList = master_disconnect(contexts[i].sessionList);
+	}
+	pool_reset();
+	for(uint32_t i = 0; i < threads_len; ++i)
+		net_cleanup(&contexts[i].net);
+	free(threads);
+	free(contexts);
+	threads_len = 0, threads = NULL, contexts = NULL;
+}
+
+#ifdef BENCHMARK
+#define CONNECT_BENCHMARK_REQUESTS 100000
+#define CONNECT_BENCHMARK_REPLAY_PERCENT 2 // Datagrams the network delivers a second time
+#define CONNECT_BENCHMARK_REPLAY_MS 2000 // Latest a replayed copy arrives after the original
+
+static uint32_t connect_benchmark_random(uint64_t *seed, uint32_t range) {
+	*seed ^= *seed << 13, *seed ^= *seed >> 7, *seed ^= *seed << 17;
+	return *seed % range;
+}
+
+struct ConnectBenchmarkArrival {
+	uint64_t time;
+	uint32_t requestId;
+};
+
+static int ConnectBenchmarkArrival_cmp(const void *a, const void *b) {
+	const struct ConnectBenchmarkArrival *x = a, *y = b;
+	if(x->time != y->time)
+		return (x->time > y->time) - (x->time < y->time);
+	return (x->requestId > y->requestId) - (x->requestId < y->requestId);
+}
+
+static bool connect_benchmark_arrive(struct ConnectBenchmarkArrival **arrivals, uint32_t *arrivals_len, uint32_t *arrivals_cap, uint64_t time, uint32_t requestId) {
+	if(*arrivals_len == *arrivals_cap) {
+		uint32_t cap = *arrivals_cap ? *arrivals_cap * 2 : 65536;
+		struct ConnectBenchmarkArrival *resized = realloc(*arrivals, cap * sizeof(**arrivals));
+		if(!resized) {
+			uprintf("alloc error\n");
+			return true;
+		}
+		*arrivals = resized, *arrivals_cap = cap;
+	}
+	(*arrivals)[(*arrivals_len)++] = (struct ConnectBenchmarkArrival){time, requestId};
+	return false;
+}
+
+// Clients keep several `ConnectToServerRequest`s in flight, each retransmitted every `NET_RESEND_DELAY` until the master's ack gets through
+// Datagrams are lost independently, and a few are replayed long after; copies reach the master interleaved in arrival order
+// Counts the rooms those copies would spawn, with and without `MasterConnectHistory`, which only remembers the last `MASTER_CONNECT_HISTORY` requests
+void master_benchmark_connect(uint32_t lossPercent) {
+	static const struct {uint32_t min, max;} delays[] = {{5, 10}, {20, 40}}; // One-way, in milliseconds
+	static const uint32_t windows[] = {1, MASTER_CONNECT_HISTORY, MASTER_CONNECT_HISTORY * 4}; // Requests in flight per client
+	if(lossPercent > 99)
+		lossPercent = 99;
+	struct ConnectBenchmarkArrival *arrivals = NULL;
+	uint32_t arrivals_cap = 0;
+	for(uint32_t i = 0; i < lengthof(delays); ++i) {
+		for(uint32_t w = 0; w < lengthof(windows); ++w) {
+			uint64_t seed = 0x9e3779b97f4a7c15, slots[MASTER_CONNECT_HISTORY * 4] = {0}; // When each in-flight slot frees up
+			uint32_t arrivals_len = 0;
+			for(uint32_t requestId = 0; requestId < CONNECT_BENCHMARK_REQUESTS; ++requestId) {
+				uint64_t *slot = &slots[requestId % windows[w]], ackAt = ~0llu;
+				for(uint64_t sent = *slot; sent < ackAt; sent += NET_RESEND_DELAY) {
+					if(connect_benchmark_random(&seed, 100) < lossPercent)
+						continue;
+					uint64_t arrival = sent + delays[i].min + connect_benchmark_random(&seed, delays[i].max - delays[i].min + 1);
+					if(connect_benchmark_arrive(&arrivals, &arrivals_len, &arrivals_cap, arrival, requestId))
+						goto fail;
+					if(connect_benchmark_random(&seed, 100) < CONNECT_BENCHMARK_REPLAY_PERCENT)
+						if(connect_benchmark_arrive(&arrivals, &arrivals_len, &arrivals_cap, arrival + 1 + connect_benchmark_random(&seed, CONNECT_BENCHMARK_REPLAY_MS), requestId))
+							goto fail;
+					if(connect_benchmark_random(&seed, 100) < lossPercent)
+						continue;
+					uint64_t ack = arrival + delays[i].min + connect_benchmark_random(&seed, delays[i].max - delays[i].min + 1);
+					if(ack < ackAt)
+						ackAt = ack;
+				}
+				*slot = ackAt;
+			}
+			qsort(arrivals, arrivals_len, sizeof(*arrivals), ConnectBenchmarkArrival_cmp);
+			struct MasterConnectHistory history = {0, 0, {0}};
+			uint32_t spawned = 0;
+			for(const struct ConnectBenchmarkArrival *it = arrivals; it < &arrivals[arrivals_len]; ++it)
+				spawned += !MasterConnectHistory_add(&history, it->requestId);
+			uprintf("connect benchmark: %u%% loss, %u-%ums one-way, %u in flight: %u requests, %u duplicate spawns without dedup, %u with\n",
+				lossPercent, delays[i].min, delays[i].max, windows[w], CONNECT_BENCHMARK_REQUESTS, arrivals_len - CONNECT_BENCHMARK_REQUESTS, spawned - CONNECT_BENCHMARK_REQUESTS);
+		}
 	}
-	pool_reset(&ctx.net);
-	net_cleanup(&ctx.net);
+	fail:
+	free(arrivals);
 }
+#endif
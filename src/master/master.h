@@ -1,5 +1,10 @@
 #pragma once
 #include "../net.h"
+#include "../affinity.h"
 
-struct NetContext *master_init(const mbedtls_x509_crt *cert, const mbedtls_pk_context *key, uint16_t port);
+struct NetContext *master_init(const mbedtls_x509_crt *cert, const mbedtls_pk_context *key, uint16_t port, const char *socketPath, uint32_t count, const struct CpuList *cpus);
 void master_cleanup();
+
+#ifdef BENCHMARK
+void master_benchmark_connect(uint32_t lossPercent);
+#endif
@@ -1,107 +1,344 @@
 #include "pool.h"
 #include "../counter.h"
+#include <mbedtls/aes.h>
 #include <stddef.h>
+#include <string.h>
 #include <stdlib.h>
 #include <pthread.h>
 
 #define MAX_SERVER_CODE 62193780
 #define POOL_BLOCK_COUNT ((MAX_SERVER_CODE+256*16) / (256*16))
+#define POOL_CODE_COUNT 60466176 // 36^5; every 5-character code, the last `POOL_CODE_COUNT` values below `MAX_SERVER_CODE`
+#define POOL_CODE_HALF_BITS 13 // Feistel halves; `1 << (POOL_CODE_HALF_BITS * 2)` must cover `POOL_CODE_COUNT`
+#define POOL_CODE_ROUNDS 4
+#define POOL_LOAD_TOLERANCE .05 // Hosts closer than this in load are compared by room count instead
+#define POOL_CODE_RESERVED (~(ServerCode)0) // Occupies a slot in `codes` without an index entry
 
 struct PoolHost {
 	union WireLink *link;
+	struct NetContext *owner;
 	bool discover;
+	bool stalled; // No heartbeat within `WIRE_HEARTBEAT_TIMEOUT_MS`; skipped for new rooms until the next one arrives
 	uint16_t capacity;
+	uint32_t rooms; // Codes currently assigned, which unlike `load.rooms` includes placements since the last heartbeat
+	uint32_t lastHeartbeat;
+	struct WireHeartbeat load;
 	struct Counter64 blocks;
 	ServerCode *codes;
 };
 
-#define CLEAR_POOLHOST (struct PoolHost){NULL, false, 0, {0}, NULL}
+#define CLEAR_POOLHOST (struct PoolHost){NULL, NULL, false, false, 0, 0, 0, {0}, {0}, NULL}
 
+// Every master thread allocates from the same pool; hosts are never freed before `pool_reset()` so stale pointers stay readable
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
 static uint32_t hosts_len = 0, nextSlot = 0;
-static struct PoolHost *hosts = NULL;
+static struct PoolHost **hosts = NULL;
+static uint64_t placementSeed = 0x9e3779b97f4a7c15; // Only spreads load, so it needn't be unpredictable
+
+// Every assigned code, so lookups and collision checks don't scan each host's `codes`
+// Open addressing with backward-shift deletion, grown at half full
+static uint32_t index_count = 0, index_mask = 0;
+static struct PoolIndexEntry {
+	ServerCode code; // `ServerCode_NONE` (zero, as left by `calloc()`) if empty
+	uint16_t room;
+	struct PoolHost *host;
+} *index_entries = NULL;
+
+// Random codes are a keyed permutation of `codeCounter`, so each one is issued once per `POOL_CODE_COUNT` allocations
+// Freed codes come back around when the counter wraps; the index above skips any still in use by then
+static bool codeKeyed = false;
+static mbedtls_aes_context codeKey;
+static uint32_t codeCounter = 0, sequentialCounter = 0;
+
+static uint32_t pool_index_hash(ServerCode code) {
+	return code * 2654435761u;
+}
+
+// Returns the entry holding `code`, or the empty one ending its probe sequence
+static struct PoolIndexEntry *pool_index_find(ServerCode code) {
+	for(uint32_t i = pool_index_hash(code);; ++i) {
+		struct PoolIndexEntry *entry = &index_entries[i & index_mask];
+		if(entry->code == code || entry->code == ServerCode_NONE)
+			return entry;
+	}
+}
+
+// Makes room for one more entry, so inserting can't fail after a host has been modified
+static bool pool_index_reserve() {
+	uint32_t length = index_entries ? index_mask + 1 : 0;
+	if((index_count + 1) * 2 <= length)
+		return false;
+	length = length ? length * 2 : 256;
+	struct PoolIndexEntry *old = index_entries, *entries = calloc(length, sizeof(*entries));
+	if(!entries) {
+		uprintf("alloc error\n");
+		return true;
+	}
+	uint32_t oldLength = old ? index_mask + 1 : 0;
+	index_entries = entries;
+	index_mask = length - 1;
+	for(uint32_t i = 0; i < oldLength; ++i)
+		if(old[i].code != ServerCode_NONE)
+			*pool_index_find(old[i].code) = old[i];
+	free(old);
+	return false;
+}
+
+static void pool_index_remove(ServerCode code) {
+	if(!index_entries)
+		return;
+	struct PoolIndexEntry *entry = pool_index_find(code);
+	if(entry->code == ServerCode_NONE)
+		return;
+	uint32_t hole = entry - index_entries;
+	for(uint32_t i = hole + 1;; ++i) {
+		struct PoolIndexEntry *it = &index_entries[i & index_mask];
+		if(it->code == ServerCode_NONE)
+			break;
+		if(((i - pool_index_hash(it->code)) & index_mask) >= ((i - hole) & index_mask)) {
+			index_entries[hole & index_mask] = *it;
+			hole = i;
+		}
+	}
+	index_entries[hole & index_mask].code = ServerCode_NONE;
+	--index_count;
+}
 
 static bool pool_grow(uint32_t newLength) {
-	struct PoolHost *newHosts = realloc(hosts, newLength * sizeof(*hosts));
+	struct PoolHost **newHosts = realloc(hosts, newLength * sizeof(*hosts));
 	if(!newHosts) {
 		uprintf("realloc error\n");
 		return true;
 	}
 	hosts = newHosts;
-	while(hosts_len < newLength)
-		hosts[hosts_len++] = CLEAR_POOLHOST;
+	for(; hosts_len < newLength; ++hosts_len) {
+		hosts[hosts_len] = malloc(sizeof(**hosts));
+		if(!hosts[hosts_len]) {
+			uprintf("alloc error\n");
+			return true;
+		}
+		*hosts[hosts_len] = CLEAR_POOLHOST;
+	}
 	return false;
 }
 
-void pool_reset(struct NetContext *self) {
-	for(uint32_t i = 0; i < hosts_len; ++i)
-		if(hosts[i].link)
-			wire_disconnect(self, hosts[i].link);
+void pool_reset() {
+	for(uint32_t i = 0; i < hosts_len; ++i) {
+		pthread_mutex_lock(&pool_mutex);
+		union WireLink *link = hosts[i]->link;
+		struct NetContext *owner = hosts[i]->owner;
+		pthread_mutex_unlock(&pool_mutex);
+		if(link)
+			wire_disconnect(owner, link);
+	}
+	pthread_mutex_lock(&pool_mutex);
+	for(uint32_t i = 0; i < hosts_len; ++i) {
+		free(hosts[i]->codes);
+		free(hosts[i]);
+	}
 	free(hosts);
 	hosts_len = 0, nextSlot = 0, hosts = NULL;
+	free(index_entries);
+	index_count = 0, index_mask = 0, index_entries = NULL;
+	if(codeKeyed)
+		mbedtls_aes_free(&codeKey);
+	codeKeyed = false, codeCounter = 0, sequentialCounter = 0;
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+bool pool_seed(mbedtls_ctr_drbg_context *ctr_drbg) {
+	uint8_t key[16];
+	if(mbedtls_ctr_drbg_random(ctr_drbg, key, sizeof(key))) {
+		uprintf("mbedtls_ctr_drbg_random() failed\n");
+		return true;
+	}
+	pthread_mutex_lock(&pool_mutex);
+	if(codeKeyed)
+		mbedtls_aes_free(&codeKey);
+	mbedtls_aes_init(&codeKey);
+	mbedtls_aes_setkey_enc(&codeKey, key, sizeof(key) * 8);
+	codeKeyed = true;
+	pthread_mutex_unlock(&pool_mutex);
+	memset(key, 0, sizeof(key));
+	return false;
 }
 
-struct PoolHost *pool_host_attach(union WireLink *link) {
+struct PoolHost *pool_host_attach(struct NetContext *owner, union WireLink *link) {
+	pthread_mutex_lock(&pool_mutex);
+	struct PoolHost *host = NULL;
 	if(nextSlot >= hosts_len)
 		if(pool_grow(hosts_len ? (hosts_len * 2) : 8))
-			return NULL;
-	struct PoolHost *host = &hosts[nextSlot];
+			goto unlock;
+	host = hosts[nextSlot];
 	*host = (struct PoolHost){
 		.link = link,
+		.owner = owner,
 		.discover = false,
+		.stalled = false,
 		.capacity = 0,
+		.rooms = 0,
+		.lastHeartbeat = net_time(),
+		.load = {0},
 		.blocks = {0},
 		.codes = NULL,
 	};
+	uint32_t slot = nextSlot;
 	while(++nextSlot < hosts_len)
-		if(hosts[nextSlot].link == NULL)
+		if(hosts[nextSlot]->link == NULL)
 			break;
-	uprintf("pool_host_attach(): nextSlot %zd -> %u\n", host - hosts, nextSlot);
+	uprintf("pool_host_attach(): nextSlot %u -> %u\n", slot, nextSlot);
+	unlock:
+	pthread_mutex_unlock(&pool_mutex);
 	return host;
 }
 
 void pool_host_detach(struct PoolHost *host) {
-	if(host >= &hosts[hosts_len] || host->link == NULL)
-		return;
-	free(host->codes);
-	*host = CLEAR_POOLHOST;
-	if((uint32_t)(host - hosts) < nextSlot)
-		nextSlot = (uint32_t)(host - hosts);
+	pthread_mutex_lock(&pool_mutex);
+	for(uint32_t i = 0; i < hosts_len; ++i) {
+		if(hosts[i] != host || host->link == NULL)
+			continue;
+		for(uint32_t room = 0; room < host->capacity; ++room)
+			if(host->codes[room] != ServerCode_NONE)
+				pool_index_remove(host->codes[room]);
+		free(host->codes);
+		*host = CLEAR_POOLHOST;
+		if(i < nextSlot)
+			nextSlot = i;
+		break;
+	}
+	pthread_mutex_unlock(&pool_mutex);
 }
 
-void TEMPpool_host_setAttribs(struct PoolHost *host, uint32_t capacity, bool discover) { // TODO: `TEMP` since calling multiple times for the same host will break things
+// Instances re-announce their capacity as their room tables grow and shrink; rooms past a lowered capacity stay addressable until they close
+void pool_host_setAttribs(struct PoolHost *host, uint32_t capacity, bool discover) {
+	if(capacity > UINT16_MAX)
+		capacity = UINT16_MAX;
 	capacity &= ~1u; // round down to power of 2 for alignment
-	host->codes = malloc(capacity * sizeof(*hosts->codes));
-	if(!host->codes) {
-		*host = CLEAR_POOLHOST;
+	pthread_mutex_lock(&pool_mutex);
+	host->discover = discover;
+	for(uint32_t i = capacity; i < host->capacity; ++i)
+		if(host->codes[i] != ServerCode_NONE)
+			capacity = i + 1;
+	ServerCode *codes = capacity ? realloc(host->codes, capacity * sizeof(*codes)) : host->codes;
+	if(!codes) {
 		uprintf("alloc error\n");
-		return;
+		goto unlock;
 	}
-	host->discover = discover;
+	for(uint32_t i = host->capacity; i < capacity; ++i)
+		codes[i] = ServerCode_NONE;
+	host->codes = codes;
 	host->capacity = capacity;
-	host->blocks.bits = ~0llu;
-	for(ServerCode *it = host->codes, *end = &host->codes[capacity]; it < end; ++it)
-		*it = ServerCode_NONE;
+	host->blocks = COUNTER64_CLEAR;
+	for(uint32_t block = 0; block < 64; ++block) {
+		for(uint32_t i = capacity * block / 64, end = capacity * (block + 1) / 64; i < end; ++i) {
+			if(codes[i] == ServerCode_NONE) {
+				Counter64_set(&host->blocks, block);
+				break;
+			}
+		}
+	}
+	unlock:
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+void pool_host_heartbeat(struct PoolHost *host, const struct WireHeartbeat *load, uint32_t currentTime) {
+	pthread_mutex_lock(&pool_mutex);
+	if(host->stalled)
+		uprintf("Instance %p recovered\n", (void*)host->link);
+	host->load = *load;
+	host->lastHeartbeat = currentTime;
+	host->stalled = false;
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+// Stalled links stay attached, since their rooms may still be running and the TCP connection will drop on its own if the peer is gone
+void pool_host_check(struct NetContext *owner, uint32_t currentTime, uint32_t *nextTick) {
+	pthread_mutex_lock(&pool_mutex);
+	for(uint32_t i = 0; i < hosts_len; ++i) {
+		struct PoolHost *host = hosts[i];
+		if(!host->link || host->owner != owner || host->stalled)
+			continue;
+		uint32_t deadline = host->lastHeartbeat + WIRE_HEARTBEAT_TIMEOUT_MS;
+		if((int32_t)(currentTime - deadline) >= 0) {
+			uprintf("Instance %p stalled (no heartbeat for %ums)\n", (void*)host->link, currentTime - host->lastHeartbeat);
+			host->stalled = true;
+		} else if(deadline - currentTime < *nextTick - currentTime) {
+			*nextTick = deadline;
+		}
+	}
+	pthread_mutex_unlock(&pool_mutex);
 }
 
 union WireLink *pool_host_wire(struct PoolHost *host) {
-	return host->link;
+	pthread_mutex_lock(&pool_mutex);
+	union WireLink *link = host->link;
+	pthread_mutex_unlock(&pool_mutex);
+	return link;
+}
+
+struct NetContext *pool_host_owner(struct PoolHost *host) {
+	pthread_mutex_lock(&pool_mutex);
+	struct NetContext *owner = host->owner;
+	pthread_mutex_unlock(&pool_mutex);
+	return owner;
 }
 
 struct PoolHost *pool_host_lookup(union WireLink *link) {
-	for(struct PoolHost *host = hosts; host < &hosts[hosts_len]; ++host)
-		if(host->link == link)
-			return host;
-	return NULL;
+	pthread_mutex_lock(&pool_mutex);
+	struct PoolHost *out = NULL;
+	for(uint32_t i = 0; i < hosts_len; ++i) {
+		if(hosts[i]->link == link) {
+			out = hosts[i];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&pool_mutex);
+	return out;
 }
 
 static uint32_t globalRoomCount = 0;
 
-static struct PoolHost *_pool_handle_new(uint32_t *room_out, ServerCode code) {
-	struct PoolHost *host = &hosts[0]; // TODO: multiple hosts + load balancing
-	if(!host->discover || Counter64_isEmpty(host->blocks)) {
-		uprintf("Error: instance not available\n");
+static struct PoolHost *_pool_handle_lookup(uint32_t *room_out, ServerCode code) {
+	if(!index_entries || code == ServerCode_NONE)
+		return NULL;
+	struct PoolIndexEntry *entry = pool_index_find(code);
+	if(entry->code == ServerCode_NONE)
 		return NULL;
+	*room_out = entry->room;
+	return entry->host;
+}
+
+static bool PoolHost_better(const struct PoolHost *host, const struct PoolHost *than) {
+	float delta = host->load.load - than->load.load;
+	if(delta < -POOL_LOAD_TOLERANCE || delta > POOL_LOAD_TOLERANCE)
+		return delta < 0;
+	return host->rooms < than->rooms;
+}
+
+// Power of two choices: the better of two hosts sampled uniformly from those able to take a room
+// Heartbeats are up to a second old, so always taking the least loaded host would send every spawn in that second to the same one
+static struct PoolHost *pool_place() {
+	struct PoolHost *pick[2] = {NULL, NULL};
+	uint32_t seen = 0;
+	for(uint32_t i = 0; i < hosts_len; ++i) {
+		struct PoolHost *host = hosts[i];
+		if(!host->link || !host->discover || host->stalled || Counter64_isEmpty(host->blocks))
+			continue;
+		if(seen < 2) {
+			pick[seen++] = host;
+			continue;
+		}
+		placementSeed ^= placementSeed << 13, placementSeed ^= placementSeed >> 7, placementSeed ^= placementSeed << 17;
+		uint32_t slot = placementSeed % ++seen;
+		if(slot < 2)
+			pick[slot] = host;
 	}
+	return (pick[1] && PoolHost_better(pick[1], pick[0])) ? pick[1] : pick[0];
+}
+
+static bool PoolHost_claim(struct PoolHost *host, uint32_t *room_out, ServerCode code) {
+	if(pool_index_reserve())
+		return true;
 	uint32_t block = __builtin_ctzll(host->blocks.bits), freeCount = 0;
 	for(uint32_t start = host->capacity * block / 64, i = host->capacity * (block + 1) / 64; i > start;)
 		if(host->codes[--i] == ServerCode_NONE)
@@ -109,50 +346,191 @@ static struct PoolHost *_pool_handle_new(uint32_t *room_out, ServerCode code) {
 	if(freeCount < 2)
 		Counter64_clear(&host->blocks, block);
 	host->codes[*room_out] = code;
+	++host->rooms;
+	*pool_index_find(code) = (struct PoolIndexEntry){code, *room_out, host};
+	++index_count;
+	return false;
+}
+
+static uint32_t pool_code_round(uint32_t round, uint32_t half) {
+	uint8_t block[16] = {round, half, half >> 8, half >> 16, half >> 24}, out[16];
+	mbedtls_aes_crypt_ecb(&codeKey, MBEDTLS_AES_ENCRYPT, block, out);
+	return (out[0] | out[1] << 8 | out[2] << 16 | (uint32_t)out[3] << 24) & ((1u << POOL_CODE_HALF_BITS) - 1);
+}
+
+// Feistel network over `2 * POOL_CODE_HALF_BITS` bits, cycle-walking until the result lands in `[0, POOL_CODE_COUNT)`
+static uint32_t pool_code_permute(uint32_t value) {
+	do {
+		uint32_t left = value >> POOL_CODE_HALF_BITS, right = value & ((1u << POOL_CODE_HALF_BITS) - 1);
+		for(uint32_t round = 0; round < POOL_CODE_ROUNDS; ++round) {
+			uint32_t next = left ^ pool_code_round(round, right);
+			left = right, right = next;
+		}
+		value = left << POOL_CODE_HALF_BITS | right;
+	} while(value >= POOL_CODE_COUNT);
+	return value;
+}
+
+// Returns `ServerCode_NONE` only if every 5-character code is taken
+static ServerCode pool_code_next(bool random) {
+	for(uint32_t attempt = 0; attempt <= index_count; ++attempt) {
+		uint32_t *counter = random ? &codeCounter : &sequentialCounter, value = *counter;
+		*counter = (value + 1) % POOL_CODE_COUNT;
+		ServerCode code = MAX_SERVER_CODE - POOL_CODE_COUNT + 1 + (random ? pool_code_permute(value) : value);
+		if(!index_entries || pool_index_find(code)->code == ServerCode_NONE)
+			return code;
+	}
+	return ServerCode_NONE;
+}
+
+static struct PoolHost *_pool_handle_new(uint32_t *room_out, ServerCode code) {
+	struct PoolHost *host = pool_place();
+	if(!host) {
+		uprintf("Error: instance not available\n");
+		return NULL;
+	}
+	if(PoolHost_claim(host, room_out, code))
+		return NULL;
 	++globalRoomCount, uprintf("%u room%s open\n", globalRoomCount, (globalRoomCount == 1) ? "" : "s");
 	return host;
 }
 
-struct PoolHost *pool_handle_new(uint32_t *room_out, bool random) { // TODO: fix performance here utilizing hash lookups
-	if(random) {
-		uprintf("TODO: randomized room codes\n");
-		return NULL;
+struct PoolHost *pool_handle_new(uint32_t *room_out, bool random) {
+	pthread_mutex_lock(&pool_mutex);
+	struct PoolHost *host = NULL;
+	if(random && !codeKeyed) {
+		uprintf("Error: room code key not set\n");
+		goto unlock;
 	}
-	for(ServerCode code = 0; code < 16; ++code) {
-		if(code == ServerCode_NONE) // `ServerCode_NONE` is an assumed opaque value
-			continue;
-		if(!pool_handle_lookup((uint32_t[]){0}, code))
-			return _pool_handle_new(room_out, code);
+	ServerCode code = pool_code_next(random);
+	if(code == ServerCode_NONE) {
+		uprintf("Error: room codes exhausted\n");
+		goto unlock;
 	}
-	return NULL;
+	host = _pool_handle_new(room_out, code);
+	unlock:
+	pthread_mutex_unlock(&pool_mutex);
+	return host;
 }
 
 struct PoolHost *pool_handle_new_named(uint32_t *room_out, ServerCode code) {
-	if(code == ServerCode_NONE || pool_handle_lookup((uint32_t[]){0}, code))
-		return NULL;
-	return _pool_handle_new(room_out, code);
+	pthread_mutex_lock(&pool_mutex);
+	struct PoolHost *host = NULL;
+	if(code != ServerCode_NONE && !_pool_handle_lookup((uint32_t[]){0}, code))
+		host = _pool_handle_new(room_out, code);
+	pthread_mutex_unlock(&pool_mutex);
+	return host;
 }
 
 void pool_handle_free(struct PoolHost *host, uint16_t room) {
+	pthread_mutex_lock(&pool_mutex);
+	if(room >= host->capacity)
+		goto unlock;
 	Counter64_set(&host->blocks, room * 64 / host->capacity);
-	if(pool_handle_code(host, room) == ServerCode_NONE)
-		return;
+	if(host->codes[room] == ServerCode_NONE)
+		goto unlock;
+	pool_index_remove(host->codes[room]);
 	host->codes[room] = ServerCode_NONE;
+	--host->rooms;
 	--globalRoomCount, uprintf("%u room%s open\n", globalRoomCount, (globalRoomCount == 1) ? "" : "s");
+	unlock:
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+void pool_handle_reserve(struct PoolHost *host, uint16_t room) {
+	pthread_mutex_lock(&pool_mutex);
+	if(room >= host->capacity) {
+		uprintf("pool_handle_reserve(): room %hu past capacity %hu\n", room, host->capacity);
+		goto unlock;
+	}
+	if(host->codes[room] != ServerCode_NONE)
+		goto unlock;
+	host->codes[room] = POOL_CODE_RESERVED;
+	++host->rooms;
+	++globalRoomCount;
+	uint32_t block = room * 64 / host->capacity, i = host->capacity * block / 64, end = host->capacity * (block + 1) / 64;
+	while(i < end && host->codes[i] != ServerCode_NONE)
+		++i;
+	if(i == end)
+		Counter64_clear(&host->blocks, block);
+	unlock:
+	pthread_mutex_unlock(&pool_mutex);
 }
 
 ServerCode pool_handle_code(struct PoolHost *host, uint32_t room) {
-	return host->codes[room];
+	pthread_mutex_lock(&pool_mutex);
+	ServerCode code = (room < host->capacity) ? host->codes[room] : ServerCode_NONE;
+	pthread_mutex_unlock(&pool_mutex);
+	return code;
+}
+
+struct PoolHost *pool_handle_lookup(uint32_t *room_out, ServerCode code) {
+	pthread_mutex_lock(&pool_mutex);
+	struct PoolHost *host = _pool_handle_lookup(room_out, code);
+	pthread_mutex_unlock(&pool_mutex);
+	return host;
 }
 
-struct PoolHost *pool_handle_lookup(uint32_t *room_out, ServerCode code) { // TODO: use a hash table for this
-	for(struct PoolHost *host = hosts; host < &hosts[hosts_len]; ++host) {
-		for(ServerCode *room = host->codes, *codes_end = &host->codes[host->capacity]; room < codes_end; ++room) {
-			if(*room != code)
-				continue;
-			*room_out = room - host->codes;
-			return host;
+#ifdef BENCHMARK
+#include <inttypes.h>
+
+// Spreads spawns over simulated hosts of uneven background load, delivering heartbeats every `POOL_BENCHMARK_TICK` spawns
+// Leaves the pool empty, as the simulated hosts would otherwise be placed alongside real ones
+#define POOL_BENCHMARK_SPAWNS 10000
+#define POOL_BENCHMARK_TICK 100
+#define POOL_BENCHMARK_ROOM_LOAD .0005f
+void pool_benchmark(uint32_t hostCount) {
+	uint8_t *links = malloc(hostCount);
+	struct PoolHost **simHosts = malloc(hostCount * sizeof(*simHosts));
+	float *baseLoad = malloc(hostCount * sizeof(*baseLoad));
+	if(!links || !simHosts || !baseLoad) {
+		uprintf("alloc error\n");
+		goto fail;
+	}
+	for(uint32_t i = 0; i < hostCount; ++i) {
+		simHosts[i] = pool_host_attach(NULL, (union WireLink*)&links[i]); // Only ever compared, never dereferenced
+		if(!simHosts[i]) {
+			hostCount = i;
+			goto detach;
 		}
+		pool_host_setAttribs(simHosts[i], 512, true);
+		baseLoad[i] = (i % 8) * .08f;
+	}
+	uint32_t placed = 0;
+	uint64_t placeNs = 0;
+	for(; placed < POOL_BENCHMARK_SPAWNS; ++placed) {
+		if(placed % POOL_BENCHMARK_TICK == 0)
+			for(uint32_t i = 0; i < hostCount; ++i)
+				pool_host_heartbeat(simHosts[i], &(struct WireHeartbeat){.load = baseLoad[i] + simHosts[i]->rooms * POOL_BENCHMARK_ROOM_LOAD, .rooms = simHosts[i]->rooms}, 0);
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		pthread_mutex_lock(&pool_mutex);
+		struct PoolHost *host = pool_place();
+		if(host && PoolHost_claim(host, (uint32_t[]){0}, placed + 1))
+			host = NULL;
+		pthread_mutex_unlock(&pool_mutex);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		placeNs += DeltaNs(start, end);
+		if(!host)
+			break;
+	}
+	uint32_t minRooms = ~0u, maxRooms = 0;
+	float minLoad = 1e9f, maxLoad = 0;
+	for(uint32_t i = 0; i < hostCount; ++i) {
+		float load = baseLoad[i] + simHosts[i]->rooms * POOL_BENCHMARK_ROOM_LOAD;
+		minRooms = (simHosts[i]->rooms < minRooms) ? simHosts[i]->rooms : minRooms;
+		maxRooms = (simHosts[i]->rooms > maxRooms) ? simHosts[i]->rooms : maxRooms;
+		minLoad = (load < minLoad) ? load : minLoad;
+		maxLoad = (load > maxLoad) ? load : maxLoad;
 	}
-	return NULL;
+	uprintf("pool benchmark: %u rooms over %u hosts, %"PRIu64"ns per placement; rooms/host %u-%u, load %.3f-%.3f\n", placed, hostCount, placed ? placeNs / placed : 0, minRooms, maxRooms, minLoad, maxLoad);
+	detach:
+	for(uint32_t i = 0; i < hostCount; ++i)
+		pool_host_detach(simHosts[i]);
+	fail:
+	free(baseLoad);
+	free(simHosts);
+	free(links);
+	pool_reset();
 }
+#endif
@@ -4,16 +4,25 @@
 struct PoolHost;
 static const uint32_t POOL_HOST_INVALID = ~0u;
 
-void pool_reset(struct NetContext *self);
+void pool_reset();
+bool pool_seed(mbedtls_ctr_drbg_context *ctr_drbg); // Keys the room code permutation; required before `pool_handle_new(..., true)`
 
-struct PoolHost *pool_host_attach(union WireLink *link);
+struct PoolHost *pool_host_attach(struct NetContext *owner, union WireLink *link);
 void pool_host_detach(struct PoolHost *host);
-void TEMPpool_host_setAttribs(struct PoolHost *host, uint32_t capacity, bool discover);
+void pool_host_setAttribs(struct PoolHost *host, uint32_t capacity, bool discover);
+void pool_host_heartbeat(struct PoolHost *host, const struct WireHeartbeat *load, uint32_t currentTime);
+void pool_host_check(struct NetContext *owner, uint32_t currentTime, uint32_t *nextTick); // Flags hosts owned by `owner` whose heartbeats stopped
 union WireLink *pool_host_wire(struct PoolHost *host);
+struct NetContext *pool_host_owner(struct PoolHost *host);
 struct PoolHost *pool_host_lookup(union WireLink *link);
 
 struct PoolHost *pool_handle_new(uint32_t *room_out, bool random);
 struct PoolHost *pool_handle_new_named(uint32_t *room_out, ServerCode code);
 void pool_handle_free(struct PoolHost *host, uint16_t room);
+void pool_handle_reserve(struct PoolHost *host, uint16_t room); // Marks a room that outlived a previous link as taken, without a code
 ServerCode pool_handle_code(struct PoolHost *host, uint32_t room);
 struct PoolHost *pool_handle_lookup(uint32_t *room_out, ServerCode code);
+
+#ifdef BENCHMARK
+void pool_benchmark(uint32_t hostCount);
+#endif
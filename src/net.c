@@ -12,15 +12,72 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <errno.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 #define net_error() (errno)
 #endif
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 #include <unistd.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define ENCRYPTION_LAYER_SIZE 63
 
+#define NET_PIPELINE_BATCH 32
+#define NET_PIPELINE_SIZE 1024 // must be a power of two
+#define NET_SEAL_CACHE 64 // Expanded send keys kept by the egress stage, indexed by the key's first bytes
+
+// Ingress and egress stages for a context, each a ring with a single consumer
+struct NetPipeline {
+	pthread_t ingressThread, egressThread;
+	bool ingressRunning, egressRunning;
+	pthread_mutex_t ingressMutex;
+	pthread_mutex_t producerMutex; // Held while producing into `egress`, which the `net_recv()` thread and workers flushing their stages share
+	pthread_mutex_t egressMutex;
+	pthread_cond_t egressWake;
+	atomic_bool egressSleeping;
+	uint32_t burst;
+	mbedtls_entropy_context entropy;
+	mbedtls_ctr_drbg_context ingressDrbg, egressDrbg; // One per stage, since each runs on its own thread
+	struct {
+		atomic_uint_fast32_t head, tail;
+		struct NetIngressEntry {
+			struct NetSession *session;
+			void *userdata;
+			uint16_t len;
+			bool encrypted;
+			uint8_t data[1536];
+		} entries[NET_PIPELINE_SIZE];
+	} ingress;
+	struct {
+		atomic_uint_fast32_t head, tail;
+		struct NetEgressEntry { // Carries a snapshot of the send keys, since the session may be freed before the entry is sent
+			struct SS addr;
+			bool encrypt;
+			uint32_t sequence;
+			uint16_t len;
+			uint8_t sendKey[32], sendMacKey[64];
+			uint8_t data[1536];
+		} entries[NET_PIPELINE_SIZE];
+	} egress;
+	struct NetSealKey {
+		bool set;
+		uint8_t key[32];
+		mbedtls_aes_context aes;
+	} sealKeys[NET_SEAL_CACHE];
+	struct NetStage { // Sends from workers, moved into `egress` by `net_flush_staged()`
+		uint32_t len, capacity;
+		struct NetEgressEntry *entries;
+	} stages[NET_STAGE_SLOTS];
+};
+
+static _Thread_local struct NetContext *net_thread_context = NULL; // The context whose `net_recv()` loop runs on this thread
+static _Thread_local uint32_t net_thread_stage = ~0u;
+
 static const uint32_t PossibleMtu[] = {
 	576 - ENCRYPTION_LAYER_SIZE - 68,
 	1024 - ENCRYPTION_LAYER_SIZE,
@@ -61,7 +118,7 @@ bool NetSession_signature(const struct NetSession*, struct NetContext *ctx, cons
 		uprintf("mbedtls_md() failed: %s\n", mbedtls_high_level_strerr(err));
 		return true;
 	}
-	err = mbedtls_rsa_pkcs1_sign(rsa, mbedtls_ctr_drbg_random, &ctx->ctr_drbg, MBEDTLS_MD_SHA256, 32, hash, out->data);
+	err = mbedtls_rsa_pkcs1_sign(rsa, mbedtls_ctr_drbg_random, net_get_ctr_drbg(ctx), MBEDTLS_MD_SHA256, 32, hash, out->data);
 	if(err != 0) {
 		uprintf("mbedtls_rsa_pkcs1_sign() failed: %s\n", mbedtls_high_level_strerr(err));
 		return true;
@@ -80,12 +137,15 @@ bool NetSession_set_clientPublicKey(struct NetSession *session, struct NetContex
 	}
 	mbedtls_mpi preMasterSecret;
 	mbedtls_mpi_init(&preMasterSecret);
-	err = mbedtls_ecdh_compute_shared(&ctx->grp, &preMasterSecret, &clientPublicKey, &session->keys.secret, mbedtls_ctr_drbg_random, &ctx->ctr_drbg);
+	err = mbedtls_ecdh_compute_shared(&ctx->grp, &preMasterSecret, &clientPublicKey, &session->keys.secret, mbedtls_ctr_drbg_random, net_get_ctr_drbg(ctx));
 	if(err != 0) {
 		uprintf("mbedtls_ecdh_compute_shared() failed: %s\n", mbedtls_high_level_strerr(err));
 		return true;
 	}
-	return EncryptionState_init(&session->encryptionState, &preMasterSecret, session->keys.random, session->clientRandom, 0);
+	net_ingress_lock(ctx); // The ingress stage may be decrypting with the previous state
+	bool res = EncryptionState_init(&session->encryptionState, &preMasterSecret, session->keys.random, session->clientRandom, 0);
+	net_ingress_unlock(ctx);
+	return res;
 }
 uint32_t NetSession_get_lastKeepAlive(struct NetSession *session) {
 	return session->lastKeepAlive;
@@ -98,8 +158,45 @@ int32_t net_get_sockfd(struct NetContext *ctx) {
 	return ctx->sockfd;
 }
 
+static _Thread_local mbedtls_ctr_drbg_context *net_thread_ctr_drbg = NULL;
+void net_set_thread_ctr_drbg(mbedtls_ctr_drbg_context *ctr_drbg) {
+	net_thread_ctr_drbg = ctr_drbg;
+}
+
+void net_defer_accept(struct NetContext *ctx) {
+	ctx->deferAccept = true;
+}
+
+bool net_recv_encrypted(struct NetContext *ctx) {
+	return ctx->recvEncrypted;
+}
+
+void net_set_thread_stage(uint32_t slot) {
+	net_thread_stage = (slot < NET_STAGE_SLOTS) ? slot : ~0u;
+}
+
+double net_get_load(struct NetContext *ctx) {
+	return ctx->perf.load;
+}
+
+struct Traffic net_get_traffic(struct NetContext *ctx) {
+	return (struct Traffic){
+		.packetsIn = atomic_load_explicit(&ctx->perf.packetsIn, memory_order_relaxed),
+		.packetsOut = atomic_load_explicit(&ctx->perf.packetsOut, memory_order_relaxed),
+		.bytesOut = atomic_load_explicit(&ctx->perf.bytesOut, memory_order_relaxed),
+	};
+}
+
+uint32_t net_get_backlog(struct NetContext *ctx) {
+	struct NetPipeline *pipeline = ctx->pipeline;
+	if(!pipeline)
+		return 0;
+	return (uint32_t)(atomic_load(&pipeline->ingress.tail) - atomic_load(&pipeline->ingress.head)) +
+	       (uint32_t)(atomic_load(&pipeline->egress.tail) - atomic_load(&pipeline->egress.head));
+}
+
 mbedtls_ctr_drbg_context *net_get_ctr_drbg(struct NetContext *ctx) {
-	return &ctx->ctr_drbg;
+	return net_thread_ctr_drbg ? net_thread_ctr_drbg : &ctx->ctr_drbg;
 }
 
 void net_tostr(const struct SS *address, char out[static INET6_ADDRSTRLEN + 8]) {
@@ -136,6 +233,25 @@ bool SS_equal(const struct SS *a0, const struct SS *a1) {
 	return false;
 }
 
+// FNV-1a over the fields compared by `SS_equal()`
+uint32_t SS_hash(const struct SS *addr) {
+	const uint8_t *data = NULL;
+	size_t data_len = 0;
+	uint16_t port = 0;
+	if(addr->ss.ss_family == AF_INET) {
+		data = (const uint8_t*)&addr->in.sin_addr, data_len = sizeof(addr->in.sin_addr);
+		port = addr->in.sin_port;
+	} else if(addr->ss.ss_family == AF_INET6) {
+		data = addr->in6.sin6_addr.s6_addr, data_len = sizeof(addr->in6.sin6_addr);
+		port = addr->in6.sin6_port;
+	}
+	uint32_t hash = 2166136261u;
+	for(size_t i = 0; i < data_len; ++i)
+		hash = (hash ^ data[i]) * 16777619u;
+	hash = (hash ^ (port & 0xff)) * 16777619u;
+	return (hash ^ (port >> 8)) * 16777619u;
+}
+
 static void net_cookie(mbedtls_ctr_drbg_context *ctr_drbg, uint8_t *out) {
 	mbedtls_ctr_drbg_random(ctr_drbg, out, 32);
 }
@@ -152,10 +268,111 @@ uint32_t net_time() {
 	return (uint64_t)now.tv_sec * 1000llu + (uint64_t)now.tv_nsec / 1000000llu;
 }
 
+// Snapshots everything the egress stage needs, since the session may be freed before the entry is sent
+static void NetEgressEntry_fill(struct NetEgressEntry *entry, struct NetSession *session, const uint8_t *buf, uint32_t len, bool encrypt) {
+	entry->addr = session->addr;
+	entry->encrypt = encrypt && session->encryptionState.initialized;
+	if(entry->encrypt) {
+		entry->sequence = ++session->encryptionState.outboundSequence; // Assigned here to keep per-session order
+		memcpy(entry->sendKey, session->encryptionState.sendKey, sizeof(entry->sendKey));
+		memcpy(entry->sendMacKey, session->encryptionState.sendMacKey, sizeof(entry->sendMacKey));
+	}
+	entry->len = len;
+	memcpy(entry->data, buf, len);
+}
+
+// Waits for space rather than sending around the ring, which would reorder the session's packets; returns NULL once the egress stage has stopped
+static struct NetEgressEntry *net_egress_reserve(struct NetContext *ctx) {
+	struct NetPipeline *pipeline = ctx->pipeline;
+	uint32_t tail = atomic_load_explicit(&pipeline->egress.tail, memory_order_relaxed);
+	while(tail - atomic_load_explicit(&pipeline->egress.head, memory_order_acquire) >= NET_PIPELINE_SIZE) {
+		pthread_mutex_lock(&pipeline->egressMutex);
+		bool running = pipeline->egressRunning;
+		pthread_cond_signal(&pipeline->egressWake);
+		pthread_mutex_unlock(&pipeline->egressMutex);
+		if(!running)
+			return NULL;
+		sched_yield();
+	}
+	return &pipeline->egress.entries[tail % NET_PIPELINE_SIZE];
+}
+
+static void net_egress_commit(struct NetContext *ctx) {
+	struct NetPipeline *pipeline = ctx->pipeline;
+	atomic_store(&pipeline->egress.tail, atomic_load_explicit(&pipeline->egress.tail, memory_order_relaxed) + 1);
+	if(atomic_load(&pipeline->egressSleeping)) {
+		pthread_mutex_lock(&pipeline->egressMutex);
+		pthread_cond_signal(&pipeline->egressWake);
+		pthread_mutex_unlock(&pipeline->egressMutex);
+	}
+}
+
+static void net_seal_send(struct NetContext *ctx, const struct NetEgressEntry *entry, mbedtls_aes_context *sendAes, mbedtls_ctr_drbg_context *ctr_drbg) {
+	uint8_t body[1536];
+	uint32_t body_len = Encryption_seal(entry->encrypt ? sendAes : NULL, entry->sendMacKey, entry->sequence, ctr_drbg, entry->data, entry->len, body);
+	if(body_len)
+		perf_count_out(&ctx->perf, sendto(ctx->sockfd, (char*)body, body_len, 0, &entry->addr.sa, entry->addr.len));
+}
+
+// The thread running `net_recv()` produces into the egress ring directly; scheduler workers stage their sends until they're done with the session, and any other thread sends inline
+static bool net_egress_push(struct NetContext *ctx, struct NetSession *session, const uint8_t *buf, uint32_t len, bool encrypt) {
+	struct NetPipeline *pipeline = ctx->pipeline;
+	if(net_thread_context != ctx) {
+		if(net_thread_stage >= NET_STAGE_SLOTS)
+			return true;
+		struct NetStage *stage = &pipeline->stages[net_thread_stage];
+		if(stage->len >= stage->capacity) {
+			uint32_t capacity = stage->capacity ? stage->capacity * 2 : 64;
+			struct NetEgressEntry *entries = realloc(stage->entries, capacity * sizeof(*entries));
+			if(!entries) {
+				uprintf("alloc error\n");
+				return false;
+			}
+			stage->entries = entries;
+			stage->capacity = capacity;
+		}
+		NetEgressEntry_fill(&stage->entries[stage->len++], session, buf, len, encrypt);
+		return false;
+	}
+	pthread_mutex_lock(&pipeline->producerMutex);
+	struct NetEgressEntry *entry = net_egress_reserve(ctx);
+	if(entry) {
+		NetEgressEntry_fill(entry, session, buf, len, encrypt);
+		net_egress_commit(ctx);
+	}
+	pthread_mutex_unlock(&pipeline->producerMutex);
+	return !entry;
+}
+
+void net_flush_staged(struct NetContext *ctx) {
+	struct NetPipeline *pipeline = ctx->pipeline;
+	if(!pipeline || net_thread_stage >= NET_STAGE_SLOTS || !pipeline->stages[net_thread_stage].len)
+		return;
+	struct NetStage *stage = &pipeline->stages[net_thread_stage];
+	pthread_mutex_lock(&pipeline->producerMutex);
+	for(uint32_t i = 0; i < stage->len; ++i) {
+		struct NetEgressEntry *entry = net_egress_reserve(ctx);
+		if(entry) {
+			*entry = stage->entries[i];
+			net_egress_commit(ctx);
+			continue;
+		}
+		mbedtls_aes_context aes; // Shutting down; nothing is left queued to overtake
+		mbedtls_aes_init(&aes);
+		mbedtls_aes_setkey_enc(&aes, stage->entries[i].sendKey, 256);
+		net_seal_send(ctx, &stage->entries[i], &aes, net_get_ctr_drbg(ctx));
+		mbedtls_aes_free(&aes);
+	}
+	pthread_mutex_unlock(&pipeline->producerMutex);
+	stage->len = 0;
+}
+
 void net_send_internal(struct NetContext *ctx, struct NetSession *session, const uint8_t *buf, uint32_t len, bool encrypt) {
+	if(ctx->pipeline && len <= sizeof(ctx->pipeline->egress.entries->data) && !net_egress_push(ctx, session, buf, len, encrypt))
+		return;
 	uint8_t body[1536];
-	uint32_t body_len = EncryptionState_encrypt(encrypt ? &session->encryptionState : NULL, &ctx->ctr_drbg, buf, len, body);
-	sendto(ctx->sockfd, (char*)body, body_len, 0, &session->addr.sa, session->addr.len);
+	uint32_t body_len = EncryptionState_encrypt(encrypt ? &session->encryptionState : NULL, net_get_ctr_drbg(ctx), buf, len, body);
+	perf_count_out(&ctx->perf, sendto(ctx->sockfd, (char*)body, body_len, 0, &session->addr.sa, session->addr.len));
 }
 
 static struct NetSession *onResolve_stub(void*, struct SS, void**) {return NULL;}
@@ -180,7 +397,18 @@ static const char *net_strerror(int32_t err) {
 }
 
 bool net_useIPv4 = 0;
-static int32_t net_bind_udp(uint16_t port) {
+static void net_set_reuseport(int32_t sockfd, bool reusePort) {
+	if(!reusePort)
+		return;
+	#ifdef SO_REUSEPORT
+	if(setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, (char*)(int32_t[]){1}, sizeof(int32_t)) < 0)
+		uprintf("Failed to set SO_REUSEPORT: %s\n", net_strerror(net_error()));
+	#else
+	uprintf("SO_REUSEPORT not supported on this platform\n");
+	#endif
+}
+
+static int32_t net_bind_udp(uint16_t port, bool reusePort) {
 	#ifdef WINDOWS
 	int err = WSAStartup(MAKEWORD(2,0), &(WSADATA){0});
 	if(err) {
@@ -196,6 +424,7 @@ static int32_t net_bind_udp(uint16_t port) {
 		#endif
 		return -1;
 	}
+	net_set_reuseport(sockfd, reusePort);
 	struct SS addr;
 	if(net_useIPv4) {
 		addr.len = sizeof(struct sockaddr_in);
@@ -222,7 +451,7 @@ static int32_t net_bind_udp(uint16_t port) {
 	return sockfd;
 }
 
-int32_t net_bind_tcp(uint16_t port, uint32_t backlog) {
+int32_t net_bind_tcp(uint16_t port, uint32_t backlog, bool reusePort) {
 	#ifdef WINDOWS
 	int err = WSAStartup(MAKEWORD(2,0), &(WSADATA){0});
 	if(err) {
@@ -241,6 +470,7 @@ int32_t net_bind_tcp(uint16_t port, uint32_t backlog) {
 		return -1;
 	}
 	setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, (char*)(int32_t[]){1}, sizeof(int32_t));
+	net_set_reuseport(listenfd, reusePort);
 
 	struct SS addr;
 	if(net_useIPv4) {
@@ -283,28 +513,34 @@ void net_close(int32_t sockfd) {
 	#endif
 }
 
-bool net_init(struct NetContext *ctx, uint16_t port, bool filterUnencrypted) {
+bool net_init(struct NetContext *ctx, uint16_t port, bool filterUnencrypted, bool reusePort) {
 	*ctx = (struct NetContext){
 		._typeid = WireLinkType_LOCAL,
-		.sockfd = net_bind_udp(port),
-		.listenfd = net_bind_tcp(port, 16),
+		.sockfd = net_bind_udp(port, reusePort),
+		.listenfd = net_bind_tcp(port, 16, reusePort),
+		.unixfd = -1,
 		.run = false,
 		.filterUnencrypted = filterUnencrypted,
+		.deferAccept = false,
+		.recvEncrypted = false,
 		.mutex = PTHREAD_MUTEX_INITIALIZER,
+		.wakePending = false,
+		.wakefd = {-1, -1},
 		// .ctr_drbg = {},
 		// .entropy = {},
 		// .grp = {},
 		.remoteLinks_len = 0,
-		.cookies_len = 0,
 		.remoteLinks = {NULL},
-		.cookies = NULL,
+		.cookies = {0, 0, NULL, 0, 0, NULL},
 		.userptr = NULL,
 		.onResolve = onResolve_stub,
 		.onResend = onResend_stub,
 		.onWireLink = NULL,
 		.onWireMessage = onWireMessage_stub,
+		.pipeline = NULL,
 		.perf = perf_init(),
 	};
+	ctx->perf.frameStart = GetTime();
 	mbedtls_ctr_drbg_init(&ctx->ctr_drbg);
 	mbedtls_entropy_init(&ctx->entropy);
 	mbedtls_ecp_group_init(&ctx->grp);
@@ -315,6 +551,24 @@ bool net_init(struct NetContext *ctx, uint16_t port, bool filterUnencrypted) {
 		uprintf("pthread_mutex_init() failed\n");
 		goto fail;
 	}
+	ctx->tasks.tail = 0;
+	ctx->tasks.head = 0;
+	for(uint32_t i = 0; i < NET_TASK_QUEUE_SIZE; ++i)
+		ctx->tasks.slots[i].sequence = i;
+	#if defined(__linux__)
+	ctx->wakefd[0] = ctx->wakefd[1] = eventfd(0, EFD_NONBLOCK);
+	if(ctx->wakefd[0] == -1) {
+		uprintf("eventfd() failed: %s\n", net_strerror(net_error()));
+		goto fail;
+	}
+	#elif !defined(WINDOWS)
+	if(pipe(ctx->wakefd)) {
+		uprintf("pipe() failed: %s\n", net_strerror(net_error()));
+		goto fail;
+	}
+	fcntl(ctx->wakefd[0], F_SETFL, O_NONBLOCK);
+	fcntl(ctx->wakefd[1], F_SETFL, O_NONBLOCK);
+	#endif
 	if(ctx->sockfd == -1 || ctx->listenfd == -1) {
 		uprintf("Socket creation failed\n");
 		goto fail;
@@ -340,6 +594,42 @@ bool net_init(struct NetContext *ctx, uint16_t port, bool filterUnencrypted) {
 	return true;
 }
 
+// Only the socket's file permissions authenticate peers, so links accepted here skip TLS entirely
+bool net_listen_unix(struct NetContext *ctx, const char *path) {
+	#ifdef WINDOWS
+	uprintf("Unix domain wire sockets are not supported on this platform\n");
+	return true;
+	#else
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		uprintf("Socket path too long: %s\n", path);
+		return true;
+	}
+	strcpy(addr.sun_path, path);
+	int32_t unixfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(unixfd == -1) {
+		uprintf("Failed to open Unix socket: %s\n", net_strerror(net_error()));
+		return true;
+	}
+	unlink(path); // Stale from a previous run
+	if(bind(unixfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		uprintf("Cannot bind socket to %s: %s\n", path, net_strerror(net_error()));
+		goto fail;
+	}
+	if(chmod(path, S_IRUSR | S_IWUSR) || listen(unixfd, 16) < 0) { // Nothing can connect before `listen()`
+		uprintf("Failed to listen on %s: %s\n", path, net_strerror(net_error()));
+		unlink(path);
+		goto fail;
+	}
+	ctx->unixfd = unixfd;
+	uprintf("Bound %s\n", path);
+	return false;
+	fail:
+	close(unixfd);
+	return true;
+	#endif
+}
+
 void net_session_init(struct NetContext *ctx, struct NetSession *session, struct SS addr) {
 	session->addr = addr;
 	session->encryptionState.initialized = 0;
@@ -358,8 +648,8 @@ void net_keypair_init(struct NetKeypair *keys) {
 }
 
 void net_keypair_gen(struct NetContext *ctx, struct NetKeypair *keys) {
-	net_cookie(&ctx->ctr_drbg, keys->random);
-	if(mbedtls_ecp_gen_keypair(&ctx->grp, &keys->secret, &keys->public, mbedtls_ctr_drbg_random, &ctx->ctr_drbg)) {
+	net_cookie(net_get_ctr_drbg(ctx), keys->random);
+	if(mbedtls_ecp_gen_keypair(&ctx->grp, &keys->secret, &keys->public, mbedtls_ctr_drbg_random, net_get_ctr_drbg(ctx))) {
 		uprintf("mbedtls_ecp_gen_keypair() failed\n");
 		abort();
 	}
@@ -383,11 +673,12 @@ static void net_set_mtu(struct NetSession *session, uint8_t idx) {
 }
 
 void net_session_reset(struct NetContext *ctx, struct NetSession *session) {
+	net_ingress_lock(ctx);
 	struct SS addr = session->addr;
 	net_session_free(session);
 	memset(session, 0, sizeof(*session));
 	session->version = PV_LEGACY_DEFAULT;
-	net_cookie(&ctx->ctr_drbg, session->cookie);
+	net_cookie(net_get_ctr_drbg(ctx), session->cookie);
 	session->addr = addr;
 	session->lastKeepAlive = net_time();
 	session->mtu = 0;
@@ -397,13 +688,77 @@ void net_session_reset(struct NetContext *ctx, struct NetSession *session) {
 	session->mergeData_end = session->mergeData;
 	net_flush_merged(ctx, session);
 	net_keypair_gen(ctx, &session->keys);
+	net_ingress_unlock(ctx);
 }
 
+static void net_pipeline_stop(struct NetContext *ctx);
+static void net_pipeline_free(struct NetContext *ctx);
 void net_stop(struct NetContext *ctx) {
 	if(ctx->sockfd == -1)
 		return;
 	ctx->run = false;
 	shutdown(ctx->sockfd, SHUT_RDWR);
+	if(ctx->pipeline)
+		net_pipeline_stop(ctx); // `onResolve` must not be called once this returns
+}
+
+// Vyukov's bounded queue; each slot's sequence tells producers and the consumer whose turn it is
+static bool net_task_push(struct NetTaskQueue *queue, struct NetTask *task) {
+	uint_fast32_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+	for(;;) {
+		uint_fast32_t sequence = atomic_load_explicit(&queue->slots[pos % NET_TASK_QUEUE_SIZE].sequence, memory_order_acquire);
+		int32_t diff = (int32_t)(sequence - pos);
+		if(diff == 0) {
+			if(atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if(diff < 0) {
+			return true;
+		} else {
+			pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+		}
+	}
+	queue->slots[pos % NET_TASK_QUEUE_SIZE].task = task;
+	atomic_store_explicit(&queue->slots[pos % NET_TASK_QUEUE_SIZE].sequence, pos + 1, memory_order_release);
+	return false;
+}
+
+static struct NetTask *net_task_pop(struct NetTaskQueue *queue) {
+	uint32_t pos = queue->head;
+	if(atomic_load_explicit(&queue->slots[pos % NET_TASK_QUEUE_SIZE].sequence, memory_order_acquire) != pos + 1)
+		return NULL;
+	struct NetTask *task = queue->slots[pos % NET_TASK_QUEUE_SIZE].task;
+	atomic_store_explicit(&queue->slots[pos % NET_TASK_QUEUE_SIZE].sequence, pos + NET_TASK_QUEUE_SIZE, memory_order_release);
+	queue->head = pos + 1;
+	return task;
+}
+
+static void net_wake(struct NetContext *ctx) {
+	#ifndef WINDOWS
+	if(!atomic_exchange(&ctx->wakePending, true) && write(ctx->wakefd[1], &(uint64_t){1}, sizeof(uint64_t)) < 0 && errno != EAGAIN)
+		uprintf("Failed to wake context: %s\n", net_strerror(errno));
+	#else
+	(void)ctx;
+	#endif
+}
+
+bool net_post(struct NetContext *ctx, struct NetTask *task) {
+	if(net_task_push(&ctx->tasks, task)) {
+		uprintf("Task queue full\n");
+		return true;
+	}
+	net_wake(ctx);
+	return false;
+}
+
+static void net_run_tasks(struct NetContext *ctx) {
+	#ifndef WINDOWS
+	for(uint64_t buf[8]; read(ctx->wakefd[0], buf, sizeof(buf)) > 0;);
+	#endif
+	atomic_store(&ctx->wakePending, false);
+	for(struct NetTask *task; (task = net_task_pop(&ctx->tasks));) {
+		task->run(ctx->userptr, task);
+		free(task);
+	}
 }
 
 static mbedtls_ssl_context **NetContext_remoteLinks(struct NetContext *ctx) {
@@ -413,6 +768,8 @@ static mbedtls_ssl_context **NetContext_remoteLinks(struct NetContext *ctx) {
 void net_cleanup(struct NetContext *ctx) {
 	if(ctx->_typeid != WireLinkType_LOCAL)
 		return;
+	if(ctx->pipeline)
+		net_pipeline_free(ctx);
 	while(ctx->remoteLinks_len) {
 		union WireLink *link = (union WireLink*)*NetContext_remoteLinks(ctx);
 		if(WireLink_cast_remote(link)) {
@@ -424,9 +781,26 @@ void net_cleanup(struct NetContext *ctx) {
 	}
 	if(pthread_mutex_destroy(&ctx->mutex)) // TODO: ensure unlock
 		uprintf("pthread_mutex_destroy() failed\n");
-	free(ctx->cookies);
+	for(struct NetTask *task; (task = net_task_pop(&ctx->tasks));)
+		free(task);
+	#ifndef WINDOWS
+	if(ctx->wakefd[0] != -1)
+		close(ctx->wakefd[0]);
+	if(ctx->wakefd[1] != -1 && ctx->wakefd[1] != ctx->wakefd[0])
+		close(ctx->wakefd[1]);
+	#endif
+	wire_cookies_free(&ctx->cookies);
 	mbedtls_entropy_free(&ctx->entropy);
 	mbedtls_ctr_drbg_free(&ctx->ctr_drbg);
+	#ifndef WINDOWS
+	if(ctx->unixfd != -1) {
+		struct sockaddr_un addr;
+		socklen_t addr_len = sizeof(addr);
+		if(getsockname(ctx->unixfd, (struct sockaddr*)&addr, &addr_len) == 0 && addr_len > offsetof(struct sockaddr_un, sun_path))
+			unlink(addr.sun_path);
+		close(ctx->unixfd);
+	}
+	#endif
 	net_close(ctx->listenfd);
 	net_close(ctx->sockfd);
 	ctx->_typeid = WireLinkType_INVALID;
@@ -503,10 +877,302 @@ static inline int32_t max32(int32_t a, int32_t b) {
 	return a > b ? a : b;
 }
 
+// Resolves and decrypts a single datagram; returns 0 if it was consumed or dropped
+static uint32_t net_open(struct NetContext *ctx, const struct SS *addr, const uint8_t raw[static 1536], ssize_t raw_len, uint8_t out[static 1536], struct NetSession **session, void **userdata_out, bool *encrypted_out) {
+	if(addr->sa.sa_family == AF_UNSPEC) {
+		uprintf("UNSPEC\n");
+		return 0;
+	}
+	if(raw[0] > 1) { // protocol extension for pinging the server
+		sendto(ctx->sockfd, (char*)raw, 1, 0, &addr->sa, addr->len);
+		char namestr[INET6_ADDRSTRLEN + 8];
+		net_tostr(addr, namestr);
+		// uprintf("ping[%s]: %hhu\n", namestr, raw[0]);
+		return 0;
+	}
+	*session = ctx->onResolve(ctx->userptr, *addr, userdata_out);
+	if(!*session)
+		return 0;
+	uint32_t length = EncryptionState_decrypt(&(*session)->encryptionState, raw, &raw[raw_len], out);
+	if(!length) {
+		uprintf("Packet decryption failed\n");
+		return 0;
+	}
+	*encrypted_out = (*raw == 1); // TODO: expose encryption state from `EncryptionState_decrypt`
+	if(!*encrypted_out && ctx->filterUnencrypted)
+		return 0;
+	return length;
+}
+
+// Session bookkeeping for an accepted datagram; always runs on the thread owning the session
+void net_session_accept(struct NetSession *session, uint32_t length, bool encrypted) {
+	if(!encrypted)
+		return;
+	if(session->alive)
+		session->lastKeepAlive = net_time();
+	while(session->mtu < length && session->mtuIdx < lengthof(PossibleMtu) - 1)
+		net_set_mtu(session, session->mtuIdx + 1);
+}
+
+static uint32_t net_read(struct NetContext *ctx, int32_t flags, uint8_t out[static 1536], struct NetSession **session, void **userdata_out, ssize_t *raw_len_out) {
+	struct SS addr = {.len = sizeof(struct sockaddr_storage)};
+	uint8_t raw[1536];
+	#ifdef WINSOCK_VERSION
+	ssize_t raw_len = recvfrom(ctx->sockfd, (char*)raw, sizeof(raw), flags, &addr.sa, &addr.len);
+	#else
+	ssize_t raw_len = recvfrom(ctx->sockfd, raw, sizeof(raw), flags, &addr.sa, &addr.len);
+	#endif
+	*raw_len_out = raw_len;
+	if(raw_len <= 0)
+		return 0;
+	atomic_fetch_add_explicit(&ctx->perf.packetsIn, 1, memory_order_relaxed);
+	bool encrypted = false;
+	uint32_t length = net_open(ctx, &addr, raw, raw_len, out, session, userdata_out, &encrypted);
+	ctx->recvEncrypted = encrypted;
+	if(length && !ctx->deferAccept)
+		net_session_accept(*session, length, encrypted);
+	return length;
+}
+
+static bool net_pipeline_pending(struct NetContext *ctx) {
+	return atomic_load_explicit(&ctx->pipeline->ingress.head, memory_order_relaxed) != atomic_load_explicit(&ctx->pipeline->ingress.tail, memory_order_acquire);
+}
+
+static uint32_t net_pipeline_pop(struct NetContext *ctx, uint8_t out[static 1536], struct NetSession **session, void **userdata_out) {
+	struct NetPipeline *pipeline = ctx->pipeline;
+	for(uint32_t head = atomic_load_explicit(&pipeline->ingress.head, memory_order_relaxed); head != atomic_load_explicit(&pipeline->ingress.tail, memory_order_acquire); ++head) {
+		struct NetIngressEntry *entry = &pipeline->ingress.entries[head % NET_PIPELINE_SIZE];
+		uint32_t length = 0;
+		if(entry->session) { // Cleared by `net_ingress_purge()`
+			memcpy(out, entry->data, entry->len);
+			*session = entry->session;
+			*userdata_out = entry->userdata;
+			length = entry->len;
+			ctx->recvEncrypted = entry->encrypted;
+			if(!ctx->deferAccept)
+				net_session_accept(entry->session, length, entry->encrypted);
+		}
+		atomic_store_explicit(&pipeline->ingress.head, head + 1, memory_order_release);
+		if(length)
+			return length;
+	}
+	return 0;
+}
+
+#ifndef WINDOWS
+static void *net_ingress_thread(struct NetContext *ctx) {
+	struct NetPipeline *pipeline = ctx->pipeline;
+	net_set_thread_ctr_drbg(&pipeline->ingressDrbg); // `onResolve` may create sessions
+	while(ctx->run) {
+		uint32_t tail = atomic_load_explicit(&pipeline->ingress.tail, memory_order_relaxed), count = 0;
+		for(int32_t flags = 0; count < NET_PIPELINE_BATCH; flags = MSG_DONTWAIT, ++count) {
+			struct SS addr = {.len = sizeof(struct sockaddr_storage)};
+			uint8_t raw[1536];
+			ssize_t raw_len = recvfrom(ctx->sockfd, raw, sizeof(raw), flags, &addr.sa, &addr.len);
+			if(raw_len <= 0) {
+				if(raw_len == -1 && flags == 0 && ctx->run)
+					uprintf("recvfrom() failed: %s\n", net_strerror(net_error()));
+				break;
+			}
+			atomic_fetch_add_explicit(&ctx->perf.packetsIn, 1, memory_order_relaxed);
+			if(tail - atomic_load_explicit(&pipeline->ingress.head, memory_order_acquire) >= NET_PIPELINE_SIZE) {
+				uprintf("Ingress queue full\n");
+				continue;
+			}
+			struct NetIngressEntry *entry = &pipeline->ingress.entries[tail % NET_PIPELINE_SIZE];
+			bool encrypted = false;
+			pthread_mutex_lock(&pipeline->ingressMutex); // Held per datagram, so `net_ingress_lock()` callers wait on at most one decrypt
+			uint32_t length = net_open(ctx, &addr, raw, raw_len, entry->data, &entry->session, &entry->userdata, &encrypted);
+			if(length) {
+				entry->len = length;
+				entry->encrypted = encrypted;
+				atomic_store_explicit(&pipeline->ingress.tail, ++tail, memory_order_release);
+			}
+			pthread_mutex_unlock(&pipeline->ingressMutex);
+		}
+		if(count)
+			net_wake(ctx);
+	}
+	net_set_thread_ctr_drbg(NULL);
+	return 0;
+}
+
+static mbedtls_aes_context *net_seal_key(struct NetPipeline *pipeline, const uint8_t key[static 32]) {
+	struct NetSealKey *cached = &pipeline->sealKeys[(key[0] | key[1] << 8) % NET_SEAL_CACHE];
+	if(!cached->set || memcmp(cached->key, key, sizeof(cached->key))) {
+		memcpy(cached->key, key, sizeof(cached->key));
+		mbedtls_aes_setkey_enc(&cached->aes, key, 256);
+		cached->set = true;
+	}
+	return &cached->aes;
+}
+
+static void *net_egress_thread(struct NetContext *ctx) {
+	struct NetPipeline *pipeline = ctx->pipeline;
+	for(;;) {
+		uint32_t head = atomic_load_explicit(&pipeline->egress.head, memory_order_relaxed);
+		if(head == atomic_load_explicit(&pipeline->egress.tail, memory_order_acquire)) {
+			pthread_mutex_lock(&pipeline->egressMutex);
+			atomic_store(&pipeline->egressSleeping, true);
+			while(head == atomic_load(&pipeline->egress.tail) && pipeline->egressRunning)
+				pthread_cond_wait(&pipeline->egressWake, &pipeline->egressMutex);
+			atomic_store(&pipeline->egressSleeping, false);
+			bool stop = (head == atomic_load(&pipeline->egress.tail));
+			pthread_mutex_unlock(&pipeline->egressMutex);
+			if(stop)
+				break;
+			continue;
+		}
+		struct NetEgressEntry *entry = &pipeline->egress.entries[head % NET_PIPELINE_SIZE];
+		net_seal_send(ctx, entry, entry->encrypt ? net_seal_key(pipeline, entry->sendKey) : NULL, &pipeline->egressDrbg);
+		atomic_store_explicit(&pipeline->egress.head, head + 1, memory_order_release);
+	}
+	return 0;
+}
+#endif
+
+void net_ingress_lock(struct NetContext *ctx) {
+	if(ctx->pipeline)
+		pthread_mutex_lock(&ctx->pipeline->ingressMutex);
+}
+
+void net_ingress_unlock(struct NetContext *ctx) {
+	if(ctx->pipeline)
+		pthread_mutex_unlock(&ctx->pipeline->ingressMutex);
+}
+
+// Must be called with the ingress lock held, from the thread running `net_recv()`
+void net_ingress_purge(struct NetContext *ctx, const void *key) {
+	struct NetPipeline *pipeline = ctx->pipeline;
+	if(!pipeline)
+		return;
+	for(uint32_t head = atomic_load(&pipeline->ingress.head), tail = atomic_load(&pipeline->ingress.tail); head != tail; ++head) {
+		struct NetIngressEntry *entry = &pipeline->ingress.entries[head % NET_PIPELINE_SIZE];
+		if(entry->session == key || entry->userdata == key)
+			entry->session = NULL;
+	}
+}
+
+static void net_pipeline_stop(struct NetContext *ctx) {
+	struct NetPipeline *pipeline = ctx->pipeline;
+	net_wake(ctx);
+	if(pipeline->ingressRunning) {
+		ctx->run = false;
+		shutdown(ctx->sockfd, SHUT_RDWR);
+		pthread_join(pipeline->ingressThread, NULL);
+		pipeline->ingressRunning = false;
+	}
+	pthread_mutex_lock(&pipeline->egressMutex);
+	bool egress = pipeline->egressRunning;
+	pipeline->egressRunning = false;
+	pthread_cond_signal(&pipeline->egressWake);
+	pthread_mutex_unlock(&pipeline->egressMutex);
+	if(egress)
+		pthread_join(pipeline->egressThread, NULL); // Flushes everything already queued
+}
+
+static void net_pipeline_free(struct NetContext *ctx) {
+	struct NetPipeline *pipeline = ctx->pipeline;
+	net_pipeline_stop(ctx);
+	pthread_mutex_destroy(&pipeline->ingressMutex);
+	pthread_mutex_destroy(&pipeline->producerMutex);
+	pthread_mutex_destroy(&pipeline->egressMutex);
+	pthread_cond_destroy(&pipeline->egressWake);
+	mbedtls_ctr_drbg_free(&pipeline->egressDrbg);
+	mbedtls_ctr_drbg_free(&pipeline->ingressDrbg);
+	mbedtls_entropy_free(&pipeline->entropy);
+	for(uint32_t i = 0; i < NET_SEAL_CACHE; ++i)
+		mbedtls_aes_free(&pipeline->sealKeys[i].aes);
+	for(uint32_t i = 0; i < NET_STAGE_SLOTS; ++i)
+		free(pipeline->stages[i].entries);
+	free(pipeline);
+	ctx->pipeline = NULL;
+}
+
+// Moves receiving, decryption and encryption onto dedicated threads; call after setting the context's callbacks, before `net_recv()`
+bool net_pipeline_start(struct NetContext *ctx) {
+	#ifdef WINDOWS
+	uprintf("Receive pipeline not supported on this platform\n");
+	return true;
+	#else
+	struct NetPipeline *pipeline = malloc(sizeof(struct NetPipeline));
+	if(!pipeline) {
+		uprintf("alloc error\n");
+		return true;
+	}
+	pipeline->ingressRunning = false;
+	pipeline->egressRunning = false;
+	pipeline->egressSleeping = false;
+	pipeline->burst = 0;
+	pipeline->ingress.head = pipeline->ingress.tail = 0;
+	pipeline->egress.head = pipeline->egress.tail = 0;
+	for(uint32_t i = 0; i < NET_SEAL_CACHE; ++i) {
+		pipeline->sealKeys[i].set = false;
+		mbedtls_aes_init(&pipeline->sealKeys[i].aes);
+	}
+	for(uint32_t i = 0; i < NET_STAGE_SLOTS; ++i)
+		pipeline->stages[i] = (struct NetStage){0, 0, NULL};
+	mbedtls_entropy_init(&pipeline->entropy);
+	mbedtls_ctr_drbg_init(&pipeline->ingressDrbg);
+	mbedtls_ctr_drbg_init(&pipeline->egressDrbg);
+	pthread_mutexattr_t mutexAttribs;
+	if(pthread_mutexattr_init(&mutexAttribs) ||
+	   pthread_mutexattr_settype(&mutexAttribs, PTHREAD_MUTEX_RECURSIVE) ||
+	   pthread_mutex_init(&pipeline->ingressMutex, &mutexAttribs) ||
+	   pthread_mutex_init(&pipeline->producerMutex, NULL) ||
+	   pthread_mutex_init(&pipeline->egressMutex, NULL) ||
+	   pthread_cond_init(&pipeline->egressWake, NULL)) {
+		uprintf("pthread_mutex_init() failed\n");
+		mbedtls_entropy_free(&pipeline->entropy);
+		free(pipeline);
+		return true;
+	}
+	ctx->pipeline = pipeline;
+	if(mbedtls_ctr_drbg_seed(&pipeline->ingressDrbg, mbedtls_entropy_func, &pipeline->entropy, (const uint8_t*)"ingress", 7) ||
+	   mbedtls_ctr_drbg_seed(&pipeline->egressDrbg, mbedtls_entropy_func, &pipeline->entropy, (const uint8_t*)"egress", 6)) {
+		uprintf("mbedtls_ctr_drbg_seed() failed\n");
+		goto fail;
+	}
+	pipeline->egressRunning = true;
+	if(pthread_create(&pipeline->egressThread, NULL, (void*(*)(void*))net_egress_thread, ctx)) {
+		pipeline->egressRunning = false;
+		uprintf("Egress thread creation failed\n");
+		goto fail;
+	}
+	pipeline->ingressRunning = true;
+	if(pthread_create(&pipeline->ingressThread, NULL, (void*(*)(void*))net_ingress_thread, ctx)) {
+		pipeline->ingressRunning = false;
+		uprintf("Ingress thread creation failed\n");
+		goto fail;
+	}
+	return false;
+	fail:
+	net_pipeline_free(ctx);
+	return true;
+	#endif
+}
+
 uint32_t net_recv(struct NetContext *ctx, uint8_t out[static 1536], struct NetSession **session, void **userdata_out) {
+	net_thread_context = ctx;
 	retry:; // __attribute__((musttail)) not available in all compilers
+	if(ctx->pipeline && !ctx->run) {
+		net_run_tasks(ctx); // Peers post their disconnects right before stopping, and may be freed before this context is cleaned up
+		return 0;
+	}
 	uint32_t currentTime = net_time(), nextTick = currentTime + 180000;
 	ctx->onResend(ctx->userptr, currentTime, &nextTick);
+	if(ctx->pipeline && ctx->pipeline->burst < NET_PIPELINE_BATCH) { // Poll links and tasks between bursts
+		uint32_t length = net_pipeline_pop(ctx, out, session, userdata_out);
+		if(length) {
+			++ctx->pipeline->burst;
+			return length;
+		}
+	}
+	for(uint32_t i = 0, len = ctx->remoteLinks_len; i < len; ++i) {
+		wire_flush(ctx, NetContext_remoteLinks(ctx)[i], currentTime, &nextTick); // May invalidate the link, same as `wire_recv()` below
+		if(ctx->remoteLinks_len < len)
+			len = ctx->remoteLinks_len, --i;
+	}
 	nextTick -= currentTime;
 	if(nextTick < 2)
 		nextTick = 2;
@@ -515,27 +1181,54 @@ uint32_t net_recv(struct NetContext *ctx, uint8_t out[static 1536], struct NetSe
 	timeout.tv_usec = (nextTick % 1000) * 1000;
 	fd_set fdSet;
 	FD_ZERO(&fdSet);
-	FD_SET(ctx->sockfd, &fdSet);
 	FD_SET(ctx->listenfd, &fdSet);
-	int32_t fdMax = max32(ctx->sockfd, ctx->listenfd);
+	int32_t fdMax = ctx->listenfd;
+	if(ctx->unixfd != -1) {
+		FD_SET(ctx->unixfd, &fdSet);
+		fdMax = max32(fdMax, ctx->unixfd);
+	}
+	if(ctx->pipeline) {
+		ctx->pipeline->burst = 0;
+		if(net_pipeline_pending(ctx))
+			timeout = (struct timeval){0, 0};
+	} else {
+		FD_SET(ctx->sockfd, &fdSet);
+		fdMax = max32(fdMax, ctx->sockfd);
+	}
+	#ifndef WINDOWS
+	FD_SET(ctx->wakefd[0], &fdSet);
+	fdMax = max32(fdMax, ctx->wakefd[0]);
+	#endif
+	fd_set writeSet, exceptSet;
+	FD_ZERO(&writeSet);
+	FD_ZERO(&exceptSet);
 	for(mbedtls_ssl_context **link = NetContext_remoteLinks(ctx), **end = &link[ctx->remoteLinks_len]; link < end; ++link) {
 		int32_t remotefd = (intptr_t)(*link)->MBEDTLS_PRIVATE(p_bio);
 		FD_SET(remotefd, &fdSet);
+		if(wire_pending(*link)) {
+			FD_SET(remotefd, &writeSet);
+			#ifdef WINDOWS
+			FD_SET(remotefd, &exceptSet); // Winsock reports failed connects here rather than as writable
+			#endif
+		}
 		fdMax = max32(fdMax, remotefd);
 	}
 	net_unlock(ctx);
-	[[maybe_unused]] struct timespec sleepStart = GetTime();
-	bool noData = (select(fdMax + 1, &fdSet, NULL, NULL, &timeout) == 0);
-	[[maybe_unused]] struct timespec sleepEnd = GetTime();
+	struct timespec sleepStart = GetTime();
+	bool noData = (select(fdMax + 1, &fdSet, &writeSet, &exceptSet, &timeout) == 0);
+	struct timespec sleepEnd = GetTime();
 	net_lock(ctx);
-	#ifdef PERFTEST
 	perf_tick(&ctx->perf, sleepStart, sleepEnd);
-	#endif
 	if(noData)
 		goto retry;
+	#ifndef WINDOWS
+	if(FD_ISSET(ctx->wakefd[0], &fdSet))
+	#endif
+		net_run_tasks(ctx);
 	for(uint32_t i = 0, len = ctx->remoteLinks_len; i < len; ++i) {
 		mbedtls_ssl_context *link = NetContext_remoteLinks(ctx)[i];
-		if(!FD_ISSET((intptr_t)link->MBEDTLS_PRIVATE(p_bio), &fdSet))
+		int32_t remotefd = (intptr_t)link->MBEDTLS_PRIVATE(p_bio);
+		if(!FD_ISSET(remotefd, &fdSet) && !FD_ISSET(remotefd, &writeSet) && !FD_ISSET(remotefd, &exceptSet))
 			continue;
 		wire_recv(ctx, link); // May invalidate `link` AND `ctx->remoteLinks`
 
@@ -544,52 +1237,44 @@ uint32_t net_recv(struct NetContext *ctx, uint8_t out[static 1536], struct NetSe
 			len = ctx->remoteLinks_len, --i;
 	}
 	if(FD_ISSET(ctx->listenfd, &fdSet))
-		wire_accept(ctx, ctx->listenfd);
-	if(!FD_ISSET(ctx->sockfd, &fdSet))
+		wire_accept(ctx, ctx->listenfd, true);
+	if(ctx->unixfd != -1 && FD_ISSET(ctx->unixfd, &fdSet))
+		wire_accept(ctx, ctx->unixfd, false);
+	if(ctx->pipeline || !FD_ISSET(ctx->sockfd, &fdSet))
 		goto retry;
-	struct SS addr = {.len = sizeof(struct sockaddr_storage)};
-	uint8_t raw[1536];
-	#ifdef WINSOCK_VERSION
-	ssize_t raw_len = recvfrom(ctx->sockfd, (char*)raw, sizeof(raw), 0, &addr.sa, &addr.len);
-	#else
-	ssize_t raw_len = recvfrom(ctx->sockfd, raw, sizeof(raw), 0, &addr.sa, &addr.len);
-	#endif
+	ssize_t raw_len;
+	uint32_t length = net_read(ctx, 0, out, session, userdata_out, &raw_len);
 	if(raw_len <= 0) {
 		if(ctx->run)
 			goto retry;
 		if(raw_len == -1)
 			uprintf("recvfrom() failed: %s\n", net_strerror(net_error()));
+		net_run_tasks(ctx);
 		return 0;
 	}
-	if(addr.sa.sa_family == AF_UNSPEC) {
-		uprintf("UNSPEC\n");
-		goto retry;
-	}
-	if(raw[0] > 1) { // protocol extension for pinging the server
-		sendto(ctx->sockfd, (char*)raw, 1, 0, &addr.sa, addr.len);
-		char namestr[INET6_ADDRSTRLEN + 8];
-		net_tostr(&addr, namestr);
-		// uprintf("ping[%s]: %hhu\n", namestr, raw[0]);
-		goto retry;
-	}
-	*session = ctx->onResolve(ctx->userptr, addr, userdata_out);
-	if(!*session)
+	if(!length)
 		goto retry;
-	uint32_t length = EncryptionState_decrypt(&(*session)->encryptionState, raw, &raw[raw_len], out);
-	if(!length) {
-		uprintf("Packet decryption failed\n");
-		goto retry;
-	}
-	if(*raw == 1) { // TODO: expose encryption state from `EncryptionState_decrypt`
-		if((*session)->alive)
-			(*session)->lastKeepAlive = net_time();
-		while((*session)->mtu < length && (*session)->mtuIdx < lengthof(PossibleMtu) - 1)
-			net_set_mtu(*session, (*session)->mtuIdx + 1);
-	} else if(ctx->filterUnencrypted) {
-		goto retry;
-	}
 	return length;
 }
+uint32_t net_recv_pending(struct NetContext *ctx, uint8_t out[static 1536], struct NetSession **session, void **userdata_out) {
+	if(ctx->pipeline)
+		return net_pipeline_pop(ctx, out, session, userdata_out);
+	for(ssize_t raw_len = 1; raw_len > 0;) {
+		#ifdef WINDOWS
+		fd_set fdSet;
+		FD_ZERO(&fdSet);
+		FD_SET(ctx->sockfd, &fdSet);
+		if(select(ctx->sockfd + 1, &fdSet, NULL, NULL, &(struct timeval){0, 0}) <= 0)
+			return 0;
+		uint32_t length = net_read(ctx, 0, out, session, userdata_out, &raw_len);
+		#else
+		uint32_t length = net_read(ctx, MSG_DONTWAIT, out, session, userdata_out, &raw_len);
+		#endif
+		if(length)
+			return length;
+	}
+	return 0;
+}
 void net_flush_merged(struct NetContext *ctx, struct NetSession *session) {
 	if(session->mergeData_end - session->mergeData > 3)
 		net_send_internal(ctx, session, session->mergeData, session->mergeData_end - session->mergeData, 1);
@@ -608,3 +1293,169 @@ void net_queue_merged(struct NetContext *ctx, struct NetSession *session, const
 	});
 	pkt_write_bytes(buf, &session->mergeData_end, endof(session->mergeData), session->version, len);
 }
+
+#ifdef __linux__
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <sys/syscall.h>
+
+#define STEERING_MAX_SESSIONS 65536
+#define BPF_INSN(c, dst, src, o, i) (struct bpf_insn){.code = (c), .dst_reg = (dst), .src_reg = (src), .off = (o), .imm = (i)}
+#define BPF_MOV_IMM(dst, i) BPF_INSN(BPF_ALU64 | BPF_MOV | BPF_K, dst, 0, 0, i)
+#define BPF_MOV_REG(dst, src) BPF_INSN(BPF_ALU64 | BPF_MOV | BPF_X, dst, src, 0, 0)
+#define BPF_STACK_PTR(dst, o) BPF_MOV_REG(dst, BPF_REG_10), BPF_INSN(BPF_ALU64 | BPF_ADD | BPF_K, dst, 0, 0, o)
+#define BPF_LD_MAP(dst, fd) BPF_INSN(BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, fd), BPF_INSN(0, 0, 0, 0, 0)
+#define BPF_CALL_FUNC(fn) BPF_INSN(BPF_JMP | BPF_CALL, 0, 0, 0, fn)
+
+// Sessions are keyed by IPv6 (or v4-mapped) address and port, both in network byte order
+struct SteeringKey {
+	uint8_t addr[16];
+	uint16_t port, pad;
+};
+
+static int64_t bpf(enum bpf_cmd cmd, union bpf_attr *attr) {
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static bool SteeringKey_from_SS(struct SteeringKey *out, const struct SS *addr) {
+	*out = (struct SteeringKey){{0}, 0, 0};
+	switch(addr->ss.ss_family) {
+		case AF_INET: {
+			out->addr[10] = 255, out->addr[11] = 255;
+			memcpy(&out->addr[12], &addr->in.sin_addr, 4);
+			out->port = addr->in.sin_port;
+			return false;
+		}
+		case AF_INET6: {
+			memcpy(out->addr, &addr->in6.sin6_addr, 16);
+			out->port = addr->in6.sin6_port;
+			return false;
+		}
+		default:;
+	}
+	return true;
+}
+
+bool net_steering_init(struct NetSteering *steering, uint32_t socketCount) {
+	*steering = (struct NetSteering)CLEAR_NETSTEERING;
+	steering->socketMap = bpf(BPF_MAP_CREATE, &(union bpf_attr){.map_type = BPF_MAP_TYPE_REUSEPORT_SOCKARRAY, .key_size = 4, .value_size = 4, .max_entries = socketCount});
+	steering->sessionMap = bpf(BPF_MAP_CREATE, &(union bpf_attr){.map_type = BPF_MAP_TYPE_HASH, .key_size = sizeof(struct SteeringKey), .value_size = 4, .max_entries = STEERING_MAX_SESSIONS});
+	if(steering->socketMap < 0 || steering->sessionMap < 0) {
+		uprintf("Failed to create steering maps: %s\n", net_strerror(errno));
+		goto fail;
+	}
+	// `data` starts at the UDP header; the source address is read relative to the network header
+	const struct bpf_insn prog[] = {
+		BPF_MOV_REG(BPF_REG_6, BPF_REG_1),
+		BPF_MOV_IMM(BPF_REG_7, 0),
+		BPF_INSN(BPF_STX | BPF_MEM | BPF_DW, BPF_REG_10, BPF_REG_7, -24, 0),
+		BPF_INSN(BPF_STX | BPF_MEM | BPF_DW, BPF_REG_10, BPF_REG_7, -16, 0),
+		BPF_INSN(BPF_STX | BPF_MEM | BPF_DW, BPF_REG_10, BPF_REG_7, -8, 0),
+		BPF_MOV_REG(BPF_REG_1, BPF_REG_6),
+		BPF_MOV_IMM(BPF_REG_2, 0),
+		BPF_STACK_PTR(BPF_REG_3, -24 + (int32_t)offsetof(struct SteeringKey, port)),
+		BPF_MOV_IMM(BPF_REG_4, 2),
+		BPF_CALL_FUNC(BPF_FUNC_skb_load_bytes),
+		BPF_INSN(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_0, 0, 31, 0), // -> pass
+		BPF_INSN(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct sk_reuseport_md, eth_protocol), 0),
+		BPF_MOV_REG(BPF_REG_1, BPF_REG_6),
+		BPF_MOV_IMM(BPF_REG_5, BPF_HDR_START_NET),
+		BPF_INSN(BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_2, 0, 5, htons(ETH_P_IP)), // -> ipv4
+		BPF_MOV_IMM(BPF_REG_2, 8),
+		BPF_STACK_PTR(BPF_REG_3, -24),
+		BPF_MOV_IMM(BPF_REG_4, 16),
+		BPF_INSN(BPF_JMP | BPF_JA, 0, 0, 5, 0), // -> load
+		BPF_MOV_IMM(BPF_REG_2, 12), // ipv4
+		BPF_STACK_PTR(BPF_REG_3, -24 + 12),
+		BPF_MOV_IMM(BPF_REG_4, 4),
+		BPF_INSN(BPF_ST | BPF_MEM | BPF_H, BPF_REG_10, 0, -24 + 10, 0xffff),
+		BPF_CALL_FUNC(BPF_FUNC_skb_load_bytes_relative), // load
+		BPF_INSN(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_0, 0, 15, 0), // -> pass
+		BPF_LD_MAP(BPF_REG_1, steering->sessionMap),
+		BPF_STACK_PTR(BPF_REG_2, -24),
+		BPF_CALL_FUNC(BPF_FUNC_map_lookup_elem),
+		BPF_INSN(BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_0, 0, 9, 0), // -> pass
+		BPF_INSN(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_7, BPF_REG_0, 0, 0),
+		BPF_INSN(BPF_STX | BPF_MEM | BPF_W, BPF_REG_10, BPF_REG_7, -28, 0),
+		BPF_MOV_REG(BPF_REG_1, BPF_REG_6),
+		BPF_LD_MAP(BPF_REG_2, steering->socketMap),
+		BPF_STACK_PTR(BPF_REG_3, -28),
+		BPF_MOV_IMM(BPF_REG_4, 0),
+		BPF_CALL_FUNC(BPF_FUNC_sk_select_reuseport),
+		BPF_MOV_IMM(BPF_REG_0, SK_PASS), // pass; unrouted senders fall back to the kernel's hash
+		BPF_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+	};
+	char log[4096] = {0};
+	steering->progfd = bpf(BPF_PROG_LOAD, &(union bpf_attr){
+		.prog_type = BPF_PROG_TYPE_SK_REUSEPORT,
+		.insn_cnt = lengthof(prog),
+		.insns = (uintptr_t)prog,
+		.license = (uintptr_t)"GPL",
+		.log_level = 1,
+		.log_size = sizeof(log),
+		.log_buf = (uintptr_t)log,
+	});
+	if(steering->progfd < 0) {
+		uprintf("Failed to load steering program: %s\n%s", net_strerror(errno), log);
+		goto fail;
+	}
+	return false;
+	fail:
+	net_steering_cleanup(steering);
+	return true;
+}
+
+void net_steering_cleanup(struct NetSteering *steering) {
+	if(steering->progfd >= 0)
+		close(steering->progfd);
+	if(steering->socketMap >= 0)
+		close(steering->socketMap);
+	if(steering->sessionMap >= 0)
+		close(steering->sessionMap);
+	*steering = (struct NetSteering)CLEAR_NETSTEERING;
+}
+
+bool net_steering_attach(struct NetSteering *steering, struct NetContext *ctx, uint32_t index) {
+	uint32_t sockfd = ctx->sockfd;
+	if(bpf(BPF_MAP_UPDATE_ELEM, &(union bpf_attr){.map_fd = steering->socketMap, .key = (uintptr_t)&index, .value = (uintptr_t)&sockfd, .flags = BPF_ANY}) < 0) {
+		uprintf("Failed to register socket for steering: %s\n", net_strerror(errno));
+		return true;
+	}
+	if(setsockopt(ctx->sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_EBPF, &steering->progfd, sizeof(steering->progfd)) < 0) {
+		uprintf("Failed to attach steering program: %s\n", net_strerror(errno));
+		return true;
+	}
+	return false;
+}
+
+void net_steering_route(struct NetSteering *steering, const struct SS *addr, uint32_t index) {
+	struct SteeringKey key;
+	if(steering->sessionMap < 0 || SteeringKey_from_SS(&key, addr))
+		return;
+	if(bpf(BPF_MAP_UPDATE_ELEM, &(union bpf_attr){.map_fd = steering->sessionMap, .key = (uintptr_t)&key, .value = (uintptr_t)&index, .flags = BPF_ANY}) < 0)
+		uprintf("Failed to route session: %s\n", net_strerror(errno));
+}
+
+// Only drops the route if it still points at `index`; the sender may have since moved to another socket
+void net_steering_unroute(struct NetSteering *steering, const struct SS *addr, uint32_t index) {
+	struct SteeringKey key;
+	uint32_t current = ~0u;
+	if(steering->sessionMap < 0 || SteeringKey_from_SS(&key, addr))
+		return;
+	if(bpf(BPF_MAP_LOOKUP_ELEM, &(union bpf_attr){.map_fd = steering->sessionMap, .key = (uintptr_t)&key, .value = (uintptr_t)&current}) < 0 || current != index)
+		return;
+	bpf(BPF_MAP_DELETE_ELEM, &(union bpf_attr){.map_fd = steering->sessionMap, .key = (uintptr_t)&key});
+}
+#else
+bool net_steering_init(struct NetSteering *steering, uint32_t) {
+	*steering = (struct NetSteering)CLEAR_NETSTEERING;
+	uprintf("Shared port steering is only supported on Linux\n");
+	return true;
+}
+void net_steering_cleanup(struct NetSteering*) {}
+bool net_steering_attach(struct NetSteering*, struct NetContext*, uint32_t) {
+	return true;
+}
+void net_steering_route(struct NetSteering*, const struct SS*, uint32_t) {}
+void net_steering_unroute(struct NetSteering*, const struct SS*, uint32_t) {}
+#endif
@@ -29,6 +29,9 @@ typedef int socklen_t;
 #define NET_MAX_SEQUENCE 32768
 #define NET_MAX_WINDOW_SIZE 64
 #define NET_RESEND_DELAY 27
+#define NET_STAGE_SLOTS 256 // At least `SCHED_MAX_WORKERS`
+
+#define NET_TASK_QUEUE_SIZE 4096 // must be a power of two
 
 #define NET_THREAD_INVALID 0 // TODO: this macro marks all non-portable uses of the pthreads API
 
@@ -43,8 +46,9 @@ struct SS {
 };
 
 bool SS_equal(const struct SS *a0, const struct SS *a1);
+uint32_t SS_hash(const struct SS *addr);
 void net_tostr(const struct SS *a, char out[static INET6_ADDRSTRLEN + 8]);
-int32_t net_bind_tcp(uint16_t port, uint32_t backlog);
+int32_t net_bind_tcp(uint16_t port, uint32_t backlog, bool reusePort);
 void net_close(int32_t sockfd);
 
 struct NetKeypair {
@@ -69,22 +73,42 @@ struct NetSession {
 	uint8_t NET_H_PRIVATE(mergeData)[NET_MAX_PKT_SIZE];
 };
 
+// Deferred work for another thread's context; `run` is called under that context's lock, and the task is freed afterwards
+struct NetTask {
+	void (*run)(void *userptr, struct NetTask *task);
+};
+
+// Bounded lock-free multi-producer, single-consumer ring
+struct NetTaskQueue {
+	atomic_uint_fast32_t tail;
+	uint32_t head;
+	struct {
+		atomic_uint_fast32_t sequence;
+		struct NetTask *task;
+	} slots[NET_TASK_QUEUE_SIZE];
+};
+
 struct NetContext {
 	WireLinkType _typeid; // used to distinguish between local (struct NetContext) and remote (mbedtls_ssl_context) connections
 	int32_t NET_H_PRIVATE(sockfd), NET_H_PRIVATE(listenfd);
+	int32_t NET_H_PRIVATE(unixfd); // Plaintext wire listener for processes on this host
 	atomic_bool NET_H_PRIVATE(run);
 	bool NET_H_PRIVATE(filterUnencrypted);
+	bool NET_H_PRIVATE(deferAccept), NET_H_PRIVATE(recvEncrypted);
 	pthread_mutex_t NET_H_PRIVATE(mutex);
+	atomic_bool NET_H_PRIVATE(wakePending);
+	int32_t NET_H_PRIVATE(wakefd)[2];
+	struct NetTaskQueue NET_H_PRIVATE(tasks);
+	struct NetPipeline *NET_H_PRIVATE(pipeline);
 	mbedtls_ctr_drbg_context ctr_drbg;
 	mbedtls_entropy_context NET_H_PRIVATE(entropy);
 	mbedtls_ecp_group NET_H_PRIVATE(grp);
 	uint32_t NET_H_PRIVATE(remoteLinks_len);
-	uint32_t NET_H_PRIVATE(cookies_len);
 	union {
 		mbedtls_ssl_context *single;
 		mbedtls_ssl_context **list;
 	} NET_H_PRIVATE(remoteLinks);
-	struct WireCookie *NET_H_PRIVATE(cookies);
+	struct WireCookieTable NET_H_PRIVATE(cookies);
 	void *userptr;
 	struct NetSession *(*onResolve)(void *userptr, struct SS addr, void **userdata_out);
 	void (*onResend)(void *userptr, uint32_t currentTime, uint32_t *nextTick);
@@ -108,25 +132,53 @@ bool NetSession_set_clientPublicKey(struct NetSession *session, struct NetContex
 uint32_t NetSession_get_lastKeepAlive(struct NetSession *session);
 const struct SS *NetSession_get_addr(struct NetSession *session);
 
-bool net_init(struct NetContext *ctx, uint16_t port, bool filterUnencrypted);
+bool net_init(struct NetContext *ctx, uint16_t port, bool filterUnencrypted, bool reusePort);
+bool net_listen_unix(struct NetContext *ctx, const char *path);
 void net_stop(struct NetContext *ctx);
 void net_cleanup(struct NetContext *ctx);
 void net_lock(struct NetContext *ctx);
 void net_unlock(struct NetContext *ctx);
+bool net_post(struct NetContext *ctx, struct NetTask *task);
+bool net_pipeline_start(struct NetContext *ctx);
+void net_ingress_lock(struct NetContext *ctx); // Guards everything `onResolve` reads while a pipeline is running; recursive
+void net_ingress_unlock(struct NetContext *ctx);
+void net_ingress_purge(struct NetContext *ctx, const void *key); // Drops queued datagrams resolved to `key`, either a session or its userdata
 void net_session_init(struct NetContext *ctx, struct NetSession *session, struct SS addr);
 void net_session_reset(struct NetContext *ctx, struct NetSession *session);
 void net_session_free(struct NetSession *session);
+void net_session_accept(struct NetSession *session, uint32_t length, bool encrypted); // Keepalive and MTU bookkeeping for a received datagram; `net_recv()` does this itself unless `net_defer_accept()` was called
+void net_defer_accept(struct NetContext *ctx); // For contexts whose sessions are handled on other threads
+bool net_recv_encrypted(struct NetContext *ctx); // Whether the datagram last returned by `net_recv()` or `net_recv_pending()` was encrypted
 bool net_add_remote(struct NetContext *ctx, mbedtls_ssl_context *link);
 bool net_remove_remote(struct NetContext *ctx, mbedtls_ssl_context *link);
 uint32_t net_recv(struct NetContext *ctx, uint8_t out[static 1536], struct NetSession **session, void **userdata_out);
+uint32_t net_recv_pending(struct NetContext *ctx, uint8_t out[static 1536], struct NetSession **session, void **userdata_out); // Non-blocking; returns 0 once the socket is drained
 void net_flush_merged(struct NetContext *ctx, struct NetSession *session);
 void net_queue_merged(struct NetContext *ctx, struct NetSession *session, const uint8_t *buf, uint16_t len);
 void net_send_internal(struct NetContext *ctx, struct NetSession *session, const uint8_t *buf, uint32_t len, bool encrypt);
 int32_t net_get_sockfd(struct NetContext *ctx);
 mbedtls_ctr_drbg_context *net_get_ctr_drbg(struct NetContext *ctx);
+double net_get_load(struct NetContext *ctx); // Fraction of time the context spent awake, smoothed over roughly one-second frames
+struct Traffic net_get_traffic(struct NetContext *ctx); // Running totals since `net_init()`
+uint32_t net_get_backlog(struct NetContext *ctx); // Datagrams waiting on the pipeline's crypto stages
+void net_set_thread_ctr_drbg(mbedtls_ctr_drbg_context *ctr_drbg); // Overrides `net_get_ctr_drbg()` for the calling thread
+void net_set_thread_stage(uint32_t slot); // Lets the calling thread send on pipelined contexts it doesn't own; each slot must belong to one thread
+void net_flush_staged(struct NetContext *ctx); // Queues the calling worker's staged sends; call before another thread may send on the same sessions
 
 uint32_t net_time();
 
+// Steers datagrams on a shared SO_REUSEPORT port to the socket owning the sender's session (Linux only)
+struct NetSteering {
+	int32_t NET_H_PRIVATE(progfd), NET_H_PRIVATE(socketMap), NET_H_PRIVATE(sessionMap);
+};
+#define CLEAR_NETSTEERING {-1, -1, -1}
+
+bool net_steering_init(struct NetSteering *steering, uint32_t socketCount);
+void net_steering_cleanup(struct NetSteering *steering);
+bool net_steering_attach(struct NetSteering *steering, struct NetContext *ctx, uint32_t index);
+void net_steering_route(struct NetSteering *steering, const struct SS *addr, uint32_t index);
+void net_steering_unroute(struct NetSteering *steering, const struct SS *addr, uint32_t index);
+
 static inline int32_t RelativeSequenceNumber(int32_t to, int32_t from) {
 	return (to - from + NET_MAX_SEQUENCE + NET_MAX_SEQUENCE / 2) % NET_MAX_SEQUENCE - NET_MAX_SEQUENCE / 2;
 }
@@ -2604,6 +2604,36 @@ static void _pkt_WireRoomCloseNotify_read(struct WireRoomCloseNotify *restrict d
 static void _pkt_WireRoomCloseNotify_write(const struct WireRoomCloseNotify *restrict data, uint8_t **pkt, const uint8_t *end, struct PacketContext ctx) {
 	_pkt_u32_write(&data->room, pkt, end, ctx);
 }
+static void _pkt_WireRoomReserve_read(struct WireRoomReserve *restrict data, const uint8_t **pkt, const uint8_t *end, struct PacketContext ctx) {
+	_pkt_u32_read(&data->room, pkt, end, ctx);
+}
+static void _pkt_WireRoomReserve_write(const struct WireRoomReserve *restrict data, uint8_t **pkt, const uint8_t *end, struct PacketContext ctx) {
+	_pkt_u32_write(&data->room, pkt, end, ctx);
+}
+static void _pkt_WireHeartbeat_read(struct WireHeartbeat *restrict data, const uint8_t **pkt, const uint8_t *end, struct PacketContext ctx) {
+	_pkt_f32_read(&data->load, pkt, end, ctx);
+	_pkt_u32_read(&data->rooms, pkt, end, ctx);
+	_pkt_u32_read(&data->players, pkt, end, ctx);
+	_pkt_u32_read(&data->packetsPerSecond, pkt, end, ctx);
+	_pkt_u32_read(&data->bytesPerSecond, pkt, end, ctx);
+	_pkt_u32_read(&data->backlog, pkt, end, ctx);
+}
+static void _pkt_WireHeartbeat_write(const struct WireHeartbeat *restrict data, uint8_t **pkt, const uint8_t *end, struct PacketContext ctx) {
+	_pkt_f32_write(&data->load, pkt, end, ctx);
+	_pkt_u32_write(&data->rooms, pkt, end, ctx);
+	_pkt_u32_write(&data->players, pkt, end, ctx);
+	_pkt_u32_write(&data->packetsPerSecond, pkt, end, ctx);
+	_pkt_u32_write(&data->bytesPerSecond, pkt, end, ctx);
+	_pkt_u32_write(&data->backlog, pkt, end, ctx);
+}
+void _pkt_WireFrame_read(struct WireFrame *restrict data, const uint8_t **pkt, const uint8_t *end, struct PacketContext ctx) {
+	_pkt_u16_read(&data->channel, pkt, end, ctx);
+	_pkt_u8_read(&data->type, pkt, end, ctx);
+}
+void _pkt_WireFrame_write(const struct WireFrame *restrict data, uint8_t **pkt, const uint8_t *end, struct PacketContext ctx) {
+	_pkt_u16_write(&data->channel, pkt, end, ctx);
+	_pkt_u8_write(&data->type, pkt, end, ctx);
+}
 void _pkt_WireMessage_read(struct WireMessage *restrict data, const uint8_t **pkt, const uint8_t *end, struct PacketContext ctx) {
 	_pkt_u32_read(&data->cookie, pkt, end, ctx);
 	_pkt_u8_read(&data->type, pkt, end, ctx);
@@ -2614,6 +2644,8 @@ void _pkt_WireMessage_read(struct WireMessage *restrict data, const uint8_t **pk
 		case WireMessageType_WireRoomSpawnResp: _pkt_WireRoomSpawnResp_read(&data->roomSpawnResp, pkt, end, ctx); break;
 		case WireMessageType_WireRoomJoinResp: _pkt_WireRoomJoinResp_read(&data->roomJoinResp, pkt, end, ctx); break;
 		case WireMessageType_WireRoomCloseNotify: _pkt_WireRoomCloseNotify_read(&data->roomCloseNotify, pkt, end, ctx); break;
+		case WireMessageType_WireHeartbeat: _pkt_WireHeartbeat_read(&data->heartbeat, pkt, end, ctx); break;
+		case WireMessageType_WireRoomReserve: _pkt_WireRoomReserve_read(&data->roomReserve, pkt, end, ctx); break;
 		default: uprintf("Invalid value for enum `WireMessageType`\n"); longjmp(fail, 1);
 	}
 }
@@ -2627,6 +2659,8 @@ void _pkt_WireMessage_write(const struct WireMessage *restrict data, uint8_t **p
 		case WireMessageType_WireRoomSpawnResp: _pkt_WireRoomSpawnResp_write(&data->roomSpawnResp, pkt, end, ctx); break;
 		case WireMessageType_WireRoomJoinResp: _pkt_WireRoomJoinResp_write(&data->roomJoinResp, pkt, end, ctx); break;
 		case WireMessageType_WireRoomCloseNotify: _pkt_WireRoomCloseNotify_write(&data->roomCloseNotify, pkt, end, ctx); break;
+		case WireMessageType_WireHeartbeat: _pkt_WireHeartbeat_write(&data->heartbeat, pkt, end, ctx); break;
+		case WireMessageType_WireRoomReserve: _pkt_WireRoomReserve_write(&data->roomReserve, pkt, end, ctx); break;
 		default: uprintf("Invalid value for enum `WireMessageType`\n"); longjmp(fail, 1);
 	}
 }
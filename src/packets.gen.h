@@ -1013,6 +1013,18 @@ enum {
 		default: return "???";
 	}
 }
+typedef uint8_t WireFrameType;
+enum {
+	WireFrameType_Message,
+	WireFrameType_Close,
+};
+[[maybe_unused]] static const char *_reflect_WireFrameType(WireFrameType value) {
+	switch(value) {
+		case WireFrameType_Message: return "Message";
+		case WireFrameType_Close: return "Close";
+		default: return "???";
+	}
+}
 typedef uint8_t WireMessageType;
 enum {
 	WireMessageType_WireSetAttribs,
@@ -1021,6 +1033,8 @@ enum {
 	WireMessageType_WireRoomSpawnResp,
 	WireMessageType_WireRoomJoinResp,
 	WireMessageType_WireRoomCloseNotify,
+	WireMessageType_WireHeartbeat,
+	WireMessageType_WireRoomReserve,
 };
 [[maybe_unused]] static const char *_reflect_WireMessageType(WireMessageType value) {
 	switch(value) {
@@ -1030,6 +1044,8 @@ enum {
 		case WireMessageType_WireRoomSpawnResp: return "WireRoomSpawnResp";
 		case WireMessageType_WireRoomJoinResp: return "WireRoomJoinResp";
 		case WireMessageType_WireRoomCloseNotify: return "WireRoomCloseNotify";
+		case WireMessageType_WireHeartbeat: return "WireHeartbeat";
+		case WireMessageType_WireRoomReserve: return "WireRoomReserve";
 		default: return "???";
 	}
 }
@@ -2163,6 +2179,21 @@ struct WireRoomJoinResp {
 struct WireRoomCloseNotify {
 	uint32_t room;
 };
+struct WireRoomReserve {
+	uint32_t room;
+};
+struct WireHeartbeat {
+	float load;
+	uint32_t rooms;
+	uint32_t players;
+	uint32_t packetsPerSecond;
+	uint32_t bytesPerSecond;
+	uint32_t backlog;
+};
+struct WireFrame {
+	uint16_t channel;
+	WireFrameType type;
+};
 struct WireMessage {
 	uint32_t cookie;
 	WireMessageType type;
@@ -2173,6 +2204,8 @@ struct WireMessage {
 		struct WireRoomSpawnResp roomSpawnResp;
 		struct WireRoomJoinResp roomJoinResp;
 		struct WireRoomCloseNotify roomCloseNotify;
+		struct WireHeartbeat heartbeat;
+		struct WireRoomReserve roomReserve;
 	};
 };
 static const struct PacketContext PV_LEGACY_DEFAULT = {
@@ -2212,6 +2245,8 @@ void _pkt_NetPacketHeader_read(struct NetPacketHeader *restrict data, const uint
 void _pkt_NetPacketHeader_write(const struct NetPacketHeader *restrict data, uint8_t **pkt, const uint8_t *end, struct PacketContext ctx);
 void _pkt_PacketEncryptionLayer_read(struct PacketEncryptionLayer *restrict data, const uint8_t **pkt, const uint8_t *end, struct PacketContext ctx);
 void _pkt_PacketEncryptionLayer_write(const struct PacketEncryptionLayer *restrict data, uint8_t **pkt, const uint8_t *end, struct PacketContext ctx);
+void _pkt_WireFrame_read(struct WireFrame *restrict data, const uint8_t **pkt, const uint8_t *end, struct PacketContext ctx);
+void _pkt_WireFrame_write(const struct WireFrame *restrict data, uint8_t **pkt, const uint8_t *end, struct PacketContext ctx);
 void _pkt_WireMessage_read(struct WireMessage *restrict data, const uint8_t **pkt, const uint8_t *end, struct PacketContext ctx);
 void _pkt_WireMessage_write(const struct WireMessage *restrict data, uint8_t **pkt, const uint8_t *end, struct PacketContext ctx);
 #define reflect(type, value) _reflect_##type(value)
@@ -2220,8 +2255,8 @@ typedef void (*PacketReadFunc)(void *restrict, const uint8_t**, const uint8_t*,
 size_t _pkt_try_read(PacketReadFunc inner, void *restrict data, const uint8_t **pkt, const uint8_t *end, struct PacketContext ctx);
 size_t _pkt_try_write(PacketWriteFunc inner, const void *restrict data, uint8_t **pkt, const uint8_t *end, struct PacketContext ctx);
 #define pkt_write_c(pkt, end, ctx, type, ...) _pkt_try_write((PacketWriteFunc)_pkt_##type##_write, &(struct type)__VA_ARGS__, pkt, end, ctx)
-#define _pkt_read_func(data) ((PacketReadFunc)_Generic(*(data), struct BeatUpMessage: _pkt_BeatUpMessage_read, struct ServerConnectInfo: _pkt_ServerConnectInfo_read, struct ModConnectHeader: _pkt_ModConnectHeader_read, struct MpBeatmapPacket: _pkt_MpBeatmapPacket_read, struct InternalMessage: _pkt_InternalMessage_read, struct RoutingHeader: _pkt_RoutingHeader_read, struct BTRoutingHeader: _pkt_BTRoutingHeader_read, struct MasterServerReliableRequestProxy: _pkt_MasterServerReliableRequestProxy_read, struct UserMessage: _pkt_UserMessage_read, struct HandshakeMessage: _pkt_HandshakeMessage_read, struct SerializeHeader: _pkt_SerializeHeader_read, struct FragmentedHeader: _pkt_FragmentedHeader_read, struct UnconnectedMessage: _pkt_UnconnectedMessage_read, struct MergedHeader: _pkt_MergedHeader_read, struct NetPacketHeader: _pkt_NetPacketHeader_read, struct PacketEncryptionLayer: _pkt_PacketEncryptionLayer_read, struct WireMessage: _pkt_WireMessage_read))
-#define _pkt_write_func(data) ((PacketWriteFunc)_Generic(*(data), struct BeatUpMessage: _pkt_BeatUpMessage_write, struct ServerConnectInfo: _pkt_ServerConnectInfo_write, struct ModConnectHeader: _pkt_ModConnectHeader_write, struct InternalMessage: _pkt_InternalMessage_write, struct RoutingHeader: _pkt_RoutingHeader_write, struct MessageReceivedAcknowledgeProxy: _pkt_MessageReceivedAcknowledgeProxy_write, struct MultipartMessageProxy: _pkt_MultipartMessageProxy_write, struct UserMessage: _pkt_UserMessage_write, struct HandshakeMessage: _pkt_HandshakeMessage_write, struct SerializeHeader: _pkt_SerializeHeader_write, struct FragmentedHeader: _pkt_FragmentedHeader_write, struct UnconnectedMessage: _pkt_UnconnectedMessage_write, struct MergedHeader: _pkt_MergedHeader_write, struct NetPacketHeader: _pkt_NetPacketHeader_write, struct PacketEncryptionLayer: _pkt_PacketEncryptionLayer_write, struct WireMessage: _pkt_WireMessage_write))
+#define _pkt_read_func(data) ((PacketReadFunc)_Generic(*(data), struct BeatUpMessage: _pkt_BeatUpMessage_read, struct ServerConnectInfo: _pkt_ServerConnectInfo_read, struct ModConnectHeader: _pkt_ModConnectHeader_read, struct MpBeatmapPacket: _pkt_MpBeatmapPacket_read, struct InternalMessage: _pkt_InternalMessage_read, struct RoutingHeader: _pkt_RoutingHeader_read, struct BTRoutingHeader: _pkt_BTRoutingHeader_read, struct MasterServerReliableRequestProxy: _pkt_MasterServerReliableRequestProxy_read, struct UserMessage: _pkt_UserMessage_read, struct HandshakeMessage: _pkt_HandshakeMessage_read, struct SerializeHeader: _pkt_SerializeHeader_read, struct FragmentedHeader: _pkt_FragmentedHeader_read, struct UnconnectedMessage: _pkt_UnconnectedMessage_read, struct MergedHeader: _pkt_MergedHeader_read, struct NetPacketHeader: _pkt_NetPacketHeader_read, struct PacketEncryptionLayer: _pkt_PacketEncryptionLayer_read, struct WireFrame: _pkt_WireFrame_read, struct WireMessage: _pkt_WireMessage_read))
+#define _pkt_write_func(data) ((PacketWriteFunc)_Generic(*(data), struct BeatUpMessage: _pkt_BeatUpMessage_write, struct ServerConnectInfo: _pkt_ServerConnectInfo_write, struct ModConnectHeader: _pkt_ModConnectHeader_write, struct InternalMessage: _pkt_InternalMessage_write, struct RoutingHeader: _pkt_RoutingHeader_write, struct MessageReceivedAcknowledgeProxy: _pkt_MessageReceivedAcknowledgeProxy_write, struct MultipartMessageProxy: _pkt_MultipartMessageProxy_write, struct UserMessage: _pkt_UserMessage_write, struct HandshakeMessage: _pkt_HandshakeMessage_write, struct SerializeHeader: _pkt_SerializeHeader_write, struct FragmentedHeader: _pkt_FragmentedHeader_write, struct UnconnectedMessage: _pkt_UnconnectedMessage_write, struct MergedHeader: _pkt_MergedHeader_write, struct NetPacketHeader: _pkt_NetPacketHeader_write, struct PacketEncryptionLayer: _pkt_PacketEncryptionLayer_write, struct WireFrame: _pkt_WireFrame_write, struct WireMessage: _pkt_WireMessage_write))
 #define pkt_read(data, ...) _pkt_try_read(_pkt_read_func(data), data, __VA_ARGS__)
 #define pkt_write(data, ...) _pkt_try_write(_pkt_write_func(data), data, __VA_ARGS__)
 size_t pkt_write_bytes(const uint8_t *restrict data, uint8_t **pkt, const uint8_t *end, struct PacketContext ctx, size_t count);
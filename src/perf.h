@@ -1,14 +1,27 @@
 #include "global.h"
+#include <stdatomic.h>
 #include <time.h>
 
+struct Traffic {
+	uint64_t packetsIn, packetsOut, bytesOut;
+};
+
 struct Performance {
 	struct timespec frameStart;
 	uint64_t frameSleep;
-	double load;
+	_Atomic double load; // Read by other threads for load balancing
+	_Atomic uint64_t packetsIn, packetsOut, bytesOut; // Egress may be counted from a pipeline thread
 };
 
 [[maybe_unused]] static struct Performance perf_init() {
-	return (struct Performance){{0, 0}, 0, 0};
+	return (struct Performance){{0, 0}, 0, 0, 0, 0, 0};
+}
+
+[[maybe_unused]] static void perf_count_out(struct Performance *perf, int64_t sent) {
+	if(sent <= 0)
+		return;
+	atomic_fetch_add_explicit(&perf->packetsOut, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&perf->bytesOut, sent, memory_order_relaxed);
 }
 
 [[maybe_unused]] static uint64_t DeltaNs(struct timespec from, struct timespec to) {
@@ -25,6 +38,8 @@ struct Performance {
 		perf->frameStart = sleepEnd;
 		perf->frameSleep = 0;
 		perf->load = (perf->load + load) / 2;
+		#ifdef PERFTEST
 		uprintf("load: %f (norm %f)\n", load, perf->load);
+		#endif
 	}
 }
@@ -9,13 +9,14 @@
 
 static inline int ssl_error(int intr) {
 	#ifdef WINDOWS
-	(void)intr;
 	if(WSAGetLastError() == WSAECONNRESET)
 		return MBEDTLS_ERR_NET_CONN_RESET;
+	if(WSAGetLastError() == WSAEWOULDBLOCK)
+		return intr;
 	#else
 	if(errno == EPIPE || errno == ECONNRESET)
 		return MBEDTLS_ERR_NET_CONN_RESET;
-	if(errno == EINTR)
+	if(errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) // Wire sockets are non-blocking
 		return intr;
 	#endif
 	return -1;
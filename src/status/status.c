@@ -1,5 +1,6 @@
 #include "../net.h"
 #include "internal.h"
+#include "status.h"
 #include <unistd.h>
 #include <string.h>
 
@@ -30,12 +31,17 @@ static void *status_handler(void*) {
 }
 
 static pthread_t status_thread = NET_THREAD_INVALID;
-bool status_init(const char *path, uint16_t port) {
-	ctx.listenfd = net_bind_tcp(port, 128);
+bool status_init(const char *path, uint16_t port, const struct CpuList *cpus) {
+	ctx.listenfd = net_bind_tcp(port, 128, false);
 	if(ctx.listenfd == -1)
 		return true;
 	ctx.path = path;
-	if(pthread_create(&status_thread, NULL, (void *(*)(void*))status_handler, NULL)) {
+	pthread_attr_t attr;
+	if(affinity_attr_init(&attr, cpus, AFFINITY_ANY, "HTTP")) // Client threads inherit the listener's affinity
+		return true;
+	bool failed = pthread_create(&status_thread, &attr, (void *(*)(void*))status_handler, NULL);
+	pthread_attr_destroy(&attr);
+	if(failed) {
 		status_thread = NET_THREAD_INVALID;
 		return true;
 	}
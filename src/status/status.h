@@ -2,13 +2,22 @@
 #include <mbedtls/x509_crt.h>
 #include <mbedtls/pk.h>
 #include "../packets.h"
+#include "../affinity.h"
 
 typedef uint16_t StatusHandle;
 
-bool status_init(const char *path, uint16_t port);
+struct StatusRoomStats {
+	uint32_t thread; // Where the room was opened; rooms keep their original ID after migrating
+	uint16_t room;
+	uint8_t playerCount;
+	uint64_t packets, deferred, dropped;
+	uint64_t busyNs;
+};
+
+bool status_init(const char *path, uint16_t port, const struct CpuList *cpus);
 void status_cleanup();
 
-bool status_ssl_init(mbedtls_x509_crt certs[2], mbedtls_pk_context keys[2], const char *domain, const char *path, uint16_t port);
+bool status_ssl_init(mbedtls_x509_crt certs[2], mbedtls_pk_context keys[2], const char *domain, const char *path, uint16_t port, const struct CpuList *cpus);
 void status_ssl_cleanup();
 
 void status_internal_init();
@@ -16,3 +25,4 @@ StatusHandle status_entry_new(ServerCode code, uint8_t playerCap);
 void status_entry_set_playerCount(StatusHandle index, uint8_t count);
 void status_entry_set_level(StatusHandle index, const char *name, float nps);
 void status_entry_free(StatusHandle index);
+void status_rooms_publish(uint32_t thread, const struct StatusRoomStats *rooms, uint32_t count); // Replaces everything previously published for `thread`
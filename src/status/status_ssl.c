@@ -1,6 +1,7 @@
 #include "../net.h"
 #include "../ssl.h"
 #include "internal.h"
+#include "status.h"
 #include <mbedtls/ssl.h>
 #include <mbedtls/ctr_drbg.h>
 #include <mbedtls/entropy.h>
@@ -80,8 +81,8 @@ static int status_ssl_sni(struct Context *ctx, mbedtls_ssl_context *ssl, const u
 }
 
 static pthread_t status_thread = NET_THREAD_INVALID;
-bool status_ssl_init(mbedtls_x509_crt certs[2], mbedtls_pk_context keys[2], const char *domain, const char *path, uint16_t port) {
-	ctx.listenfd = net_bind_tcp(port, 128);
+bool status_ssl_init(mbedtls_x509_crt certs[2], mbedtls_pk_context keys[2], const char *domain, const char *path, uint16_t port, const struct CpuList *cpus) {
+	ctx.listenfd = net_bind_tcp(port, 128, false);
 	if(ctx.listenfd == -1)
 		return true;
 	mbedtls_ssl_config_init(&ctx.conf);
@@ -110,7 +111,12 @@ bool status_ssl_init(mbedtls_x509_crt certs[2], mbedtls_pk_context keys[2], cons
 	ctx.keys = keys;
 	ctx.domain = domain;
 	ctx.path = path;
-	if(pthread_create(&status_thread, NULL, (void *(*)(void*))status_ssl_handler, NULL)) {
+	pthread_attr_t attr;
+	if(affinity_attr_init(&attr, cpus, AFFINITY_ANY, "HTTPS")) // Client threads inherit the listener's affinity
+		return true;
+	bool failed = pthread_create(&status_thread, &attr, (void *(*)(void*))status_ssl_handler, NULL);
+	pthread_attr_destroy(&attr);
+	if(failed) {
 		status_thread = NET_THREAD_INVALID;
 		return true;
 	}
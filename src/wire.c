@@ -2,24 +2,68 @@
 #include "net.h"
 #include "ssl.h"
 #include <mbedtls/error.h>
+#include <mbedtls/ssl_ticket.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
 #ifdef WINDOWS
 #include <ws2tcpip.h>
 #else
 #include <netdb.h>
+#include <fcntl.h>
+#include <sys/un.h>
 #endif
-// TODO: heartbeats+timeout to ensure the other side hasn't stalled
 
+#define WIRE_FRAME_MAX 16384 // Each frame is prefixed with its length as a u16
+#define WIRE_RECORD_MAX 16384 // Plaintext handed to `mbedtls_ssl_write()` at once; queued frames share records up to this size
+#define WIRE_QUEUE_MAX (4 * 1024 * 1024) // Sends fail once this much is waiting on a peer that stopped reading
+#define WIRE_HANDSHAKE_TIMEOUT_MS 10000
+#define WIRE_TICKET_PERIOD (12 * 60 * 60) // Seconds between ticket key changes; tickets from the previous period remain valid
+
+// Links are driven from the owner's event loop, so neither a slow TCP connect nor a stalled TLS peer ever blocks it
+enum WireLinkState {
+	WireLinkState_Connecting,
+	WireLinkState_Handshake,
+	WireLinkState_Open,
+};
+
+// Every remote link carries numbered channels, so an instance process shares one TLS session between all of its threads
+// Channels may belong to other threads than the link's owner; `mutex` guards the channel table and `closed`
 struct RemoteLink {
 	mbedtls_ssl_context ctx;
 	mbedtls_ssl_config conf;
+	struct NetContext *owner;
+	pthread_mutex_t mutex;
+	atomic_uint refs; // One for the open connection, plus one per channel and per queued `WireFrameTask`
+	bool server, closed;
+	bool tls; // Unix domain links carry frames in the clear
+	bool wantWrite; // The last TLS call needs the socket writable to make progress
+	enum WireLinkState state;
+	uint32_t deadline; // Handshake timeout
+	uint32_t channels_len;
+	struct WireChannel **channels; // Indexed by channel ID
+	uint32_t out_len, out_cap, out_inflight; // `out_inflight` must be passed unchanged to `mbedtls_ssl_write()` after `MBEDTLS_ERR_SSL_WANT_WRITE`
+	uint8_t *out;
+	uint32_t in_len;
+	uint8_t in[2 * (WIRE_FRAME_MAX + 2)];
+};
+
+struct WireChannel {
+	WireLinkType type;
+	struct RemoteLink *link;
+	struct NetContext *net; // Receives this channel's messages
+	uint16_t id;
+	bool closing; // A `WireCloseTask` is queued on `net`
+	bool released; // Disconnected by `net` while `closing`
 };
 
 union WireLink {
 	WireLinkType type;
 	struct NetContext local;
 	struct RemoteLink remote;
+	struct WireChannel channel;
 };
 
 struct NetContext *WireLink_cast_local(union WireLink *link) {
@@ -30,18 +74,113 @@ mbedtls_ssl_context *WireLink_cast_remote(union WireLink *link) {
 	return (link->type >= WireLinkType_REMOTE_START) ? &link->remote.ctx : NULL;
 }
 
-static struct RemoteLink *RemoteLink_new() {
+static struct RemoteLink *RemoteLink_new(struct NetContext *owner, bool server, bool tls) {
 	struct RemoteLink *out = malloc(sizeof(struct RemoteLink));
-	if(out) {
-		mbedtls_ssl_config_init(&out->conf);
-		mbedtls_ssl_init(&out->ctx);
-	} else {
+	if(!out) {
 		uprintf("alloc error\n");
+		return NULL;
 	}
+	if(pthread_mutex_init(&out->mutex, NULL)) {
+		uprintf("pthread_mutex_init() failed\n");
+		free(out);
+		return NULL;
+	}
+	mbedtls_ssl_config_init(&out->conf);
+	mbedtls_ssl_init(&out->ctx);
+	out->owner = owner;
+	out->refs = 1;
+	out->server = server;
+	out->closed = false;
+	out->tls = tls;
+	out->wantWrite = !server && tls; // Connecting and sending the first handshake record both wait for writability
+	out->state = tls ? WireLinkState_Handshake : WireLinkState_Open;
+	out->deadline = net_time() + WIRE_HANDSHAKE_TIMEOUT_MS;
+	out->channels_len = 0;
+	out->channels = NULL;
+	out->out_len = 0;
+	out->out_cap = 0;
+	out->out_inflight = 0;
+	out->out = NULL;
+	out->in_len = 0;
 	return out;
 }
 
-static intptr_t wire_connect_tcp(const char *address) {
+// Only for links which never made it into `net_add_remote()`
+static void RemoteLink_free(struct RemoteLink *link) {
+	mbedtls_ssl_free(&link->ctx);
+	mbedtls_ssl_config_free(&link->conf);
+	pthread_mutex_destroy(&link->mutex);
+	free(link);
+}
+
+static void RemoteLink_unref(struct RemoteLink *link) {
+	if(atomic_fetch_sub(&link->refs, 1) != 1)
+		return;
+	free(link->out);
+	free(link->channels);
+	pthread_mutex_destroy(&link->mutex);
+	free(link);
+}
+
+// Caller must hold `link->mutex`
+static struct WireChannel *WireChannel_new(struct RemoteLink *link, struct NetContext *net, uint16_t id) {
+	if(id >= link->channels_len) {
+		uint32_t length = link->channels_len ? link->channels_len : 4;
+		while(length <= id)
+			length *= 2;
+		struct WireChannel **channels = realloc(link->channels, length * sizeof(*channels));
+		if(!channels) {
+			uprintf("alloc error\n");
+			return NULL;
+		}
+		memset(&channels[link->channels_len], 0, (length - link->channels_len) * sizeof(*channels));
+		link->channels = channels;
+		link->channels_len = length;
+	}
+	struct WireChannel *channel = malloc(sizeof(*channel));
+	if(!channel) {
+		uprintf("alloc error\n");
+		return NULL;
+	}
+	*channel = (struct WireChannel){
+		.type = WireLinkType_CHANNEL,
+		.link = link,
+		.net = net,
+		.id = id,
+		.closing = false,
+		.released = false,
+	};
+	link->channels[id] = channel;
+	atomic_fetch_add(&link->refs, 1);
+	return channel;
+}
+
+static struct WireChannel *WireChannel_get(struct RemoteLink *link, uint16_t id) {
+	return (id < link->channels_len) ? link->channels[id] : NULL;
+}
+
+static void WireChannel_free(struct WireChannel *channel) {
+	struct RemoteLink *link = channel->link;
+	free(channel);
+	RemoteLink_unref(link);
+}
+
+static bool wire_set_nonblocking(intptr_t sockfd) {
+	#ifdef WINDOWS
+	u_long mode = 1;
+	if(ioctlsocket(sockfd, FIONBIO, &mode) == 0)
+		return false;
+	#else
+	int flags = fcntl(sockfd, F_GETFL);
+	if(flags != -1 && fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) != -1)
+		return false;
+	#endif
+	uprintf("Failed to make wire socket non-blocking\n");
+	return true;
+}
+
+// Sets `pending_out` if the connection is still in progress
+static intptr_t wire_connect_tcp(const char *address, bool *pending_out) {
 	const char *address_end = &address[strlen(address)];
 	const char *host_end = address_end, *port = address_end;
 	char host[65536];
@@ -84,8 +223,18 @@ static intptr_t wire_connect_tcp(const char *address) {
 		sockfd = socket(entry->ai_family, entry->ai_socktype, entry->ai_protocol);
 		if(sockfd == -1)
 			continue;
-		if(connect(sockfd, entry->ai_addr, entry->ai_addrlen) != -1)
+		if(wire_set_nonblocking(sockfd)) {
+			close(sockfd);
+			continue;
+		}
+		if(connect(sockfd, entry->ai_addr, entry->ai_addrlen) != -1) {
+			*pending_out = false;
 			goto end;
+		}
+		if(WSAGetLastError() == WSAEWOULDBLOCK) { // Failures after this point are reported by `wire_handshake()`, so later entries aren't tried
+			*pending_out = true;
+			goto end;
+		}
 		close(sockfd);
 	}
 	sockfd = -1;
@@ -121,24 +270,174 @@ static intptr_t wire_connect_tcp(const char *address) {
 	}
 	char addrstr[INET6_ADDRSTRLEN + 8];
 	net_tostr(&addr, addrstr);
+	if(wire_set_nonblocking(sockfd))
+		goto fail;
 	if(connect(sockfd, &addr.sa, addr.len) != -1) {
 		uprintf("Connected to %s\n", addrstr);
+		*pending_out = false;
+		return sockfd;
+	}
+	if(errno == EINPROGRESS) {
+		uprintf("Connecting to %s\n", addrstr);
+		*pending_out = true;
 		return sockfd;
 	}
 	uprintf("Failed to connect to %s\n", addrstr);
+	fail:
 	close(sockfd);
 	return -1;
 	#endif
 }
 
+static intptr_t wire_connect_unix(const char *path) {
+	#ifdef WINDOWS
+	uprintf("Unix domain wire sockets are not supported on this platform\n");
+	return -1;
+	#else
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		uprintf("Socket path too long: %s\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	intptr_t sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(sockfd == -1) {
+		uprintf("Failed to create Unix socket\n");
+		return -1;
+	}
+	if(connect(sockfd, (struct sockaddr*)&addr, sizeof(addr)) == -1) { // Completes or fails immediately, so there's no need for `WireLinkState_Connecting`
+		uprintf("Failed to connect to %s: %s\n", path, strerror(errno));
+		close(sockfd);
+		return -1;
+	}
+	uprintf("Connected to %s\n", path);
+	return sockfd;
+	#endif
+}
+
 static uint8_t remoteKey_len = 0;
 static uint8_t remoteKey[32];
+
+// Ticket keys are derived from the wire key and the current period, so every master sharing that key, including one which just
+// restarted, accepts the tickets of every other and reconnecting instances complete with an abbreviated handshake
+static pthread_mutex_t ticket_mutex = PTHREAD_MUTEX_INITIALIZER; // Master threads share one ticket context, and mbedtls doesn't lock it
+static bool ticket_ready = false;
+static uint64_t ticket_period = 0;
+static mbedtls_ssl_ticket_context ticket_ctx;
+static mbedtls_ctr_drbg_context ticket_ctr_drbg;
+static mbedtls_entropy_context ticket_entropy;
+
+// Caller must hold `ticket_mutex`
+static int wire_ticket_update() {
+	uint64_t period = (uint64_t)time(NULL) / WIRE_TICKET_PERIOD;
+	if(period == ticket_period)
+		return 0;
+	uint8_t info[19] = "wire ticket", name[4], key[32];
+	for(uint32_t i = 0; i < 8; ++i)
+		info[11 + i] = period >> (i * 8);
+	memcpy(name, &info[11], sizeof(name)); // Lets `mbedtls_ssl_ticket_parse()` pick the matching key of the two it keeps
+	int res = mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), remoteKey, remoteKey_len, info, sizeof(info), key);
+	if(!res) // Outlives the next change, so mbedtls never replaces it with a random key of its own
+		res = mbedtls_ssl_ticket_rotate(&ticket_ctx, name, sizeof(name), key, sizeof(key), 2 * WIRE_TICKET_PERIOD);
+	if(res)
+		uprintf("Failed to change wire ticket key: %s\n", mbedtls_high_level_strerr(res));
+	else
+		ticket_period = period;
+	return res;
+}
+
+static int wire_ticket_write(void *p_ticket, const mbedtls_ssl_session *session, unsigned char *start, const unsigned char *end, size_t *tlen, uint32_t *lifetime) {
+	pthread_mutex_lock(&ticket_mutex);
+	int res = wire_ticket_update();
+	if(!res)
+		res = mbedtls_ssl_ticket_write(p_ticket, session, start, end, tlen, lifetime);
+	pthread_mutex_unlock(&ticket_mutex);
+	return res;
+}
+
+static int wire_ticket_parse(void *p_ticket, mbedtls_ssl_session *session, unsigned char *buf, size_t len) {
+	pthread_mutex_lock(&ticket_mutex);
+	int res = wire_ticket_update();
+	if(!res)
+		res = mbedtls_ssl_ticket_parse(p_ticket, session, buf, len);
+	pthread_mutex_unlock(&ticket_mutex);
+	return res;
+}
+
+// Instances keep the last session to their master, presenting it on the next connect to the same address
+static pthread_mutex_t session_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool session_valid = false;
+static char session_address[256];
+static mbedtls_ssl_session session_cache;
+
+static void wire_session_resume(struct RemoteLink *link, const char *address) {
+	pthread_mutex_lock(&session_mutex);
+	if(strcmp(address, session_address)) {
+		if(session_valid)
+			mbedtls_ssl_session_free(&session_cache);
+		session_valid = false;
+		snprintf(session_address, sizeof(session_address), "%s", address);
+	} else if(session_valid) {
+		int res = mbedtls_ssl_set_session(&link->ctx, &session_cache);
+		if(res)
+			uprintf("mbedtls_ssl_set_session() failed: %s\n", mbedtls_high_level_strerr(res));
+	}
+	pthread_mutex_unlock(&session_mutex);
+}
+
+// Only one master address is connected at a time, so the session is stored for whichever one `wire_session_resume()` saw last
+static void wire_session_save(struct RemoteLink *link) {
+	pthread_mutex_lock(&session_mutex);
+	if(session_valid)
+		mbedtls_ssl_session_free(&session_cache);
+	mbedtls_ssl_session_init(&session_cache);
+	int res = mbedtls_ssl_get_session(&link->ctx, &session_cache);
+	session_valid = (res == 0);
+	if(res) {
+		uprintf("mbedtls_ssl_get_session() failed: %s\n", mbedtls_high_level_strerr(res));
+		mbedtls_ssl_session_free(&session_cache);
+	}
+	pthread_mutex_unlock(&session_mutex);
+}
+
 void wire_set_key(uint8_t key[static 32], uint8_t key_len) {
 	memcpy(remoteKey, key, key_len);
 	remoteKey_len = key_len;
+	if(!key_len || ticket_ready)
+		return;
+	mbedtls_ssl_ticket_init(&ticket_ctx);
+	mbedtls_ctr_drbg_init(&ticket_ctr_drbg);
+	mbedtls_entropy_init(&ticket_entropy);
+	int res = mbedtls_ctr_drbg_seed(&ticket_ctr_drbg, mbedtls_entropy_func, &ticket_entropy, (const uint8_t*)"wire ticket", 11);
+	if(!res)
+		res = mbedtls_ssl_ticket_setup(&ticket_ctx, mbedtls_ctr_drbg_random, &ticket_ctr_drbg, MBEDTLS_CIPHER_AES_256_GCM, WIRE_TICKET_PERIOD);
+	if(!res)
+		res = wire_ticket_update();
+	ticket_ready = (res == 0);
+	if(ticket_ready)
+		return;
+	uprintf("Wire session tickets disabled: %s\n", mbedtls_high_level_strerr(res));
+	mbedtls_ssl_ticket_free(&ticket_ctx);
+	mbedtls_ctr_drbg_free(&ticket_ctr_drbg);
+	mbedtls_entropy_free(&ticket_entropy);
+}
+
+void wire_cleanup() {
+	if(ticket_ready) {
+		mbedtls_ssl_ticket_free(&ticket_ctx);
+		mbedtls_ctr_drbg_free(&ticket_ctr_drbg);
+		mbedtls_entropy_free(&ticket_entropy);
+		ticket_ready = false;
+		ticket_period = 0;
+	}
+	if(session_valid)
+		mbedtls_ssl_session_free(&session_cache);
+	session_valid = false;
+	*session_address = 0;
 }
 
-static bool wire_remote_handshake(struct NetContext *self, struct RemoteLink *link, intptr_t sockfd, bool server) {
+// Plaintext links are set up too, since `WireLink_cast_remote()` relies on the TLS context's config pointer; they just never handshake
+static bool wire_remote_init(struct NetContext *self, struct RemoteLink *link, intptr_t sockfd, bool server) {
 	int res = mbedtls_ssl_config_defaults(&link->conf, server ? MBEDTLS_SSL_IS_SERVER : MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
 	if(res != 0) {
 		uprintf("mbedtls_ssl_config_defaults() failed: %s\n", mbedtls_high_level_strerr(res));
@@ -146,75 +445,300 @@ static bool wire_remote_handshake(struct NetContext *self, struct RemoteLink *li
 	}
 	mbedtls_ssl_conf_rng(&link->conf, mbedtls_ctr_drbg_random, &self->ctr_drbg);
 	mbedtls_ssl_conf_psk(&link->conf, remoteKey, remoteKey_len, (const uint8_t*)"placeholder", 11); // TODO: use `mbedtls_ssl_conf_psk_cb()` on master side
+	if(server && ticket_ready)
+		mbedtls_ssl_conf_session_tickets_cb(&link->conf, wire_ticket_write, wire_ticket_parse, &ticket_ctx);
+	else if(!server)
+		mbedtls_ssl_conf_session_tickets(&link->conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
 	res = mbedtls_ssl_setup(&link->ctx, &link->conf);
 	if(res != 0) {
 		uprintf("mbedtls_ssl_setup() failed: %s\n", mbedtls_high_level_strerr(res));
 		return true;
 	}
 	mbedtls_ssl_set_bio(&link->ctx, (void*)sockfd, ssl_send, ssl_recv, NULL);
-	if(server)
+	return wire_set_nonblocking(sockfd); // The handshake itself is stepped by `wire_handshake()`
+}
+
+// Advances a link towards `WireLinkState_Open`; `ready` is set once `select()` has reported the socket
+static bool wire_handshake(struct RemoteLink *link, bool ready) {
+	if(link->state == WireLinkState_Connecting) {
+		if(!ready)
+			return false;
+		int err = 0;
+		socklen_t err_len = sizeof(err);
+		if(getsockopt((intptr_t)link->ctx.MBEDTLS_PRIVATE(p_bio), SOL_SOCKET, SO_ERROR, (char*)&err, &err_len) || err) {
+			uprintf("Failed to connect: %s\n", strerror(err));
+			return true;
+		}
+		link->state = WireLinkState_Handshake;
+	}
+	int res = mbedtls_ssl_handshake(&link->ctx);
+	link->wantWrite = (res == MBEDTLS_ERR_SSL_WANT_WRITE);
+	if(res == MBEDTLS_ERR_SSL_WANT_READ || res == MBEDTLS_ERR_SSL_WANT_WRITE)
 		return false;
-	while((res = mbedtls_ssl_handshake(&link->ctx))) {
-		if(res == MBEDTLS_ERR_SSL_WANT_READ || res == MBEDTLS_ERR_SSL_WANT_WRITE)
-			continue;
+	if(res) {
 		uprintf("mbedtls_ssl_handshake() failed: %s\n", mbedtls_high_level_strerr(res));
 		return true;
 	}
+	link->state = WireLinkState_Open;
+	if(!link->server)
+		wire_session_save(link);
+	uprintf("Wire handshake complete (%s)\n", link->server ? "server" : "client");
+	return false;
+}
+
+// Writes queued frames until the socket would block; returns true on a fatal error
+static bool wire_write(struct RemoteLink *link) {
+	if(link->state != WireLinkState_Open) // Frames queue up until the handshake completes
+		return false;
+	while(link->out_len) {
+		uint32_t length = link->out_inflight;
+		if(!length)
+			length = (link->out_len < WIRE_RECORD_MAX) ? link->out_len : WIRE_RECORD_MAX;
+		int res = link->tls ? mbedtls_ssl_write(&link->ctx, link->out, length) : ssl_send(link->ctx.MBEDTLS_PRIVATE(p_bio), link->out, length);
+		if(res == MBEDTLS_ERR_SSL_WANT_WRITE || res == MBEDTLS_ERR_SSL_WANT_READ) {
+			link->out_inflight = length;
+			return false;
+		}
+		if(res < 0) {
+			if(res != MBEDTLS_ERR_NET_CONN_RESET)
+				uprintf("mbedtls_ssl_write() failed: %s\n", mbedtls_high_level_strerr(res));
+			return true;
+		}
+		link->out_inflight = 0;
+		link->out_len -= res;
+		memmove(link->out, &link->out[res], link->out_len);
+	}
+	return false;
+}
+
+static bool wire_queue(struct RemoteLink *link, const uint8_t *data, uint32_t length) {
+	uint32_t required = link->out_len + 2 + length;
+	if(required > link->out_cap) {
+		if(required > WIRE_QUEUE_MAX) {
+			uprintf("Wire queue full\n");
+			return true;
+		}
+		uint32_t capacity = link->out_cap ? link->out_cap : 4096;
+		while(capacity < required)
+			capacity *= 2;
+		uint8_t *out = realloc(link->out, capacity);
+		if(!out) {
+			uprintf("alloc error\n");
+			return true;
+		}
+		link->out = out;
+		link->out_cap = capacity;
+	}
+	link->out[link->out_len++] = length & 255;
+	link->out[link->out_len++] = length >> 8;
+	memcpy(&link->out[link->out_len], data, length);
+	link->out_len += length;
+	return false;
+}
+
+// Local links deliver through the receiving context's task queue, so neither side ever takes the other's lock
+struct LocalWireTask {
+	struct NetTask base;
+	struct NetContext *target;
+	union WireLink *from;
+	struct WireMessage message;
+};
+
+static void LocalWireTask_link(void*, struct LocalWireTask *task) {
+	task->target->onWireLink(task->target->userptr, task->from);
+}
+
+static void LocalWireTask_message(void*, struct LocalWireTask *task) {
+	task->target->onWireMessage(task->target->userptr, task->from, &task->message);
+}
+
+static void LocalWireTask_close(void*, struct LocalWireTask *task) {
+	task->target->onWireMessage(task->target->userptr, task->from, NULL);
+}
+
+static bool wire_post_local(union WireLink *from, struct NetContext *link, void (*run)(void*, struct LocalWireTask*), const struct WireMessage *message) {
+	struct LocalWireTask *task = malloc(sizeof(*task));
+	if(!task) {
+		uprintf("alloc error\n");
+		return true;
+	}
+	task->base.run = (void (*)(void*, struct NetTask*))run;
+	task->target = link;
+	task->from = from;
+	if(message)
+		task->message = *message;
+	if(net_post(link, &task->base)) {
+		free(task);
+		return true;
+	}
 	return false;
 }
 
+// Frames for a channel belonging to another thread are written by the link's owner
+struct WireFrameTask {
+	struct NetTask base;
+	struct RemoteLink *link;
+	struct WireFrame frame;
+	struct WireMessage message;
+};
+
+static struct WireCookie *WireCookieTable_get(struct WireCookieTable *table, uint32_t cookie) {
+	uint32_t index = (cookie & ((1u << WIRE_COOKIE_INDEX_BITS) - 1)) - 1;
+	if(index >= table->slots_len)
+		return NULL;
+	struct WireCookie *slot = &table->slots[index];
+	return (slot->link && slot->generation == cookie >> WIRE_COOKIE_INDEX_BITS) ? slot : NULL;
+}
+
+static bool wire_send_frame(struct NetContext *self, struct RemoteLink *link, struct WireFrame frame, const struct WireMessage *message);
+static void WireFrameTask_run(void*, struct WireFrameTask *task) {
+	wire_send_frame(task->link->owner, task->link, task->frame, &task->message);
+	RemoteLink_unref(task->link);
+}
+
+struct WireCloseTask {
+	struct NetTask base;
+	struct WireChannel *channel;
+};
+
+static void WireCloseTask_run(void*, struct WireCloseTask *task) {
+	struct WireChannel *channel = task->channel;
+	pthread_mutex_lock(&channel->link->mutex);
+	bool released = channel->released;
+	pthread_mutex_unlock(&channel->link->mutex);
+	if(!released)
+		channel->net->onWireMessage(channel->net->userptr, (union WireLink*)channel, NULL);
+	WireChannel_free(channel);
+}
+
+// Caller must hold `channel->link->mutex`
+static void WireChannel_post(struct WireChannel *channel, const struct WireMessage *message) {
+	if(message) {
+		wire_post_local((union WireLink*)channel, channel->net, LocalWireTask_message, message);
+		return;
+	}
+	struct WireCloseTask *task = malloc(sizeof(*task));
+	if(!task) {
+		uprintf("alloc error\n");
+		return;
+	}
+	*task = (struct WireCloseTask){
+		.base.run = (void (*)(void*, struct NetTask*))WireCloseTask_run,
+		.channel = channel,
+	};
+	if(net_post(channel->net, &task->base)) {
+		free(task);
+		return;
+	}
+	channel->link->channels[channel->id] = NULL;
+	channel->closing = true;
+}
+
+// Detaches every channel and frees the TLS session; the `RemoteLink` itself lives on until its last reference is dropped
+static void wire_close_remote(struct NetContext *self, struct RemoteLink *link) {
+	net_remove_remote(self, &link->ctx);
+	if(link->state == WireLinkState_Open && !wire_write(link) && link->tls) // Best effort, since the socket won't wait for a slow peer
+		mbedtls_ssl_close_notify(&link->ctx);
+	int32_t sockfd = (intptr_t)link->ctx.MBEDTLS_PRIVATE(p_bio);
+	mbedtls_ssl_free(&link->ctx);
+	mbedtls_ssl_config_free(&link->conf);
+	close(sockfd);
+	pthread_mutex_lock(&link->mutex);
+	link->closed = true;
+	for(uint32_t i = 0; i < link->channels_len; ++i)
+		if(link->channels[i] && link->channels[i]->net != self)
+			WireChannel_post(link->channels[i], NULL);
+	pthread_mutex_unlock(&link->mutex);
+	for(uint32_t i = 0; i < link->channels_len; ++i) { // Only this thread removes its own channels, so these can't change underneath
+		struct WireChannel *channel = link->channels[i];
+		if(!channel || channel->net != self)
+			continue;
+		pthread_mutex_lock(&link->mutex);
+		link->channels[i] = NULL;
+		pthread_mutex_unlock(&link->mutex);
+		self->onWireMessage(self->userptr, (union WireLink*)channel, NULL);
+		WireChannel_free(channel);
+	}
+	RemoteLink_unref(link);
+}
+
 union WireLink *wire_connect_local(struct NetContext *self, struct NetContext *link) {
-	if(!link->onWireLink)
+	if(!link->onWireLink || wire_post_local((union WireLink*)self, link, LocalWireTask_link, NULL))
 		return NULL;
-	net_lock(link);
-	link->onWireLink(link->userptr, (union WireLink*)self);
-	net_unlock(link);
 	return (union WireLink*)link;
 }
 
+// Returns channel 0 of a new connection owned by `self`; other threads join it through `wire_connect_channel()`
+// The connection completes from the owner's event loop, and frames sent before then stay queued
+// Addresses of the form `unix:<path>` connect to a co-located master without TLS
 union WireLink *wire_connect_remote(struct NetContext *self, const char *address) {
-	if(remoteKey_len == 0)
+	bool tls = (strncmp(address, "unix:", 5) != 0);
+	if(tls && remoteKey_len == 0)
 		return NULL;
-	struct RemoteLink *link = RemoteLink_new();
+	struct RemoteLink *link = RemoteLink_new(self, false, tls);
 	if(!link)
 		return NULL;
 
-	intptr_t sockfd = wire_connect_tcp(address);
-	if(sockfd != -1 && !wire_remote_handshake(self, link, sockfd, false)) {
+	bool pending = false;
+	intptr_t sockfd = tls ? wire_connect_tcp(address, &pending) : wire_connect_unix(&address[5]);
+	if(sockfd != -1 && !wire_remote_init(self, link, sockfd, false)) {
+		if(pending)
+			link->state = WireLinkState_Connecting;
+		if(tls)
+			wire_session_resume(link, address);
 		// TODO: TLS ALPN protcol negotiation thing
-		net_add_remote(self, &link->ctx);
-		return (union WireLink*)link;
+		struct WireChannel *channel = WireChannel_new(link, self, 0);
+		if(channel) {
+			net_add_remote(self, &link->ctx);
+			return (union WireLink*)channel;
+		}
 	}
-	mbedtls_ssl_free(&link->ctx);
-	mbedtls_ssl_config_free(&link->conf);
+	RemoteLink_free(link);
 	close(sockfd);
-	free(link);
 	return NULL;
 }
 
-void wire_accept(struct NetContext *self, int32_t listenfd) {
+// Opens another channel over the same connection as `link`, delivering its messages to `self`
+// The master sees each channel as a separate link, attached on its first message
+union WireLink *wire_connect_channel(struct NetContext *self, union WireLink *link) {
+	if(link->type != WireLinkType_CHANNEL)
+		return NULL;
+	struct RemoteLink *remote = link->channel.link;
+	struct WireChannel *channel = NULL;
+	pthread_mutex_lock(&remote->mutex);
+	if(!remote->closed) {
+		uint32_t id = 1;
+		while(id < remote->channels_len && remote->channels[id])
+			++id;
+		if(id <= UINT16_MAX)
+			channel = WireChannel_new(remote, self, id);
+		else
+			uprintf("Too many wire channels\n");
+	}
+	pthread_mutex_unlock(&remote->mutex);
+	return (union WireLink*)channel;
+}
+
+void wire_accept(struct NetContext *self, int32_t listenfd, bool tls) {
 	struct SS addr = {.len = sizeof(struct sockaddr_storage)};
 	intptr_t sockfd = accept(listenfd, &addr.sa, &addr.len);
 	if(sockfd == -1)
 		return;
-	if(remoteKey_len == 0 || !self->onWireLink)
+	if((tls && remoteKey_len == 0) || !self->onWireLink)
 		goto fail;
-	// TODO: don't block during the handshake (plus websocket handshake once that's a thing) since this is in the middle of `net_recv()`
+	// TODO: websocket handshake once that's a thing
 
-	struct RemoteLink *link = RemoteLink_new();
+	struct RemoteLink *link = RemoteLink_new(self, true, tls);
 	if(!link)
 		goto fail;
 
-	if(!wire_remote_handshake(self, link, sockfd, true)) {
+	if(!wire_remote_init(self, link, sockfd, true)) {
 		uprintf("wire_accept(%d)\n", sockfd);
 		// TODO: TLS ALPN protcol negotiation thing
-		net_add_remote(self, &link->ctx);
-		self->onWireLink(self->userptr, (union WireLink*)link);
+		net_add_remote(self, &link->ctx); // `onWireLink()` runs once per channel, on its first message
 		return;
 	}
-	mbedtls_ssl_free(&link->ctx);
-	mbedtls_ssl_config_free(&link->conf);
-	free(link);
+	RemoteLink_free(link);
 	fail:
 	close(sockfd);
 	uprintf("wire_accept(%d) failed\n", sockfd);
@@ -223,120 +747,342 @@ void wire_accept(struct NetContext *self, int32_t listenfd) {
 void wire_disconnect(struct NetContext *self, union WireLink *link) {
 	if(link->type == WireLinkType_INVALID)
 		return;
+	if(link->type >= WireLinkType_REMOTE_START) {
+		wire_close_remote(self, &link->remote);
+		return;
+	}
 	self->onWireMessage(self->userptr, link, NULL);
-	if(link->type == WireLinkType_LOCAL) {
-		link->local.onWireMessage(link->local.userptr, (union WireLink*)self, NULL);
+	if(link->type == WireLinkType_LOCAL) { // A peer torn down before running this drops it along with the rest of its queue
+		if(wire_post_local((union WireLink*)self, &link->local, LocalWireTask_close, NULL))
+			uprintf("Failed to notify local peer of disconnect\n");
 		return;
 	}
-	net_remove_remote(self, &link->remote.ctx);
-	int res = MBEDTLS_ERR_ERROR_CORRUPTION_DETECTED;
-	do {
-		res = mbedtls_ssl_close_notify(&link->remote.ctx);
-	} while(res == MBEDTLS_ERR_SSL_WANT_READ || res == MBEDTLS_ERR_SSL_WANT_WRITE);
-	int32_t sockfd = (intptr_t)link->remote.ctx.MBEDTLS_PRIVATE(p_bio);
-	mbedtls_ssl_free(&link->remote.ctx);
-	mbedtls_ssl_config_free(&link->remote.conf);
-	free(link);
-	close(sockfd);
+	struct WireChannel *channel = &link->channel;
+	struct RemoteLink *remote = channel->link;
+	pthread_mutex_lock(&remote->mutex);
+	bool closing = channel->closing;
+	if(closing)
+		channel->released = true; // Freed by the queued `WireCloseTask`
+	else
+		remote->channels[channel->id] = NULL;
+	bool closed = remote->closed;
+	pthread_mutex_unlock(&remote->mutex);
+	if(!closed)
+		wire_send_frame(self, remote, (struct WireFrame){channel->id, WireFrameType_Close}, NULL);
+	if(!closing)
+		WireChannel_free(channel);
 }
 
-bool wire_send(struct NetContext *self, union WireLink *link, const struct WireMessage *message) {
-	if(link->type == WireLinkType_INVALID)
-		return true;
-	if(link->type == WireLinkType_LOCAL) {
-		uprintf("wire_send_local(%s)\n", reflect(WireMessageType, message->type));
-		net_lock(&link->local);
-		link->local.onWireMessage(link->local.userptr, (union WireLink*)self, message);
-		net_unlock(&link->local);
+static bool wire_send_frame(struct NetContext *self, struct RemoteLink *link, struct WireFrame frame, const struct WireMessage *message) {
+	if(link->owner != self) {
+		struct WireFrameTask *task = malloc(sizeof(*task));
+		if(!task) {
+			uprintf("alloc error\n");
+			return true;
+		}
+		*task = (struct WireFrameTask){
+			.base.run = (void (*)(void*, struct NetTask*))WireFrameTask_run,
+			.link = link,
+			.frame = frame,
+		};
+		if(message)
+			task->message = *message;
+		atomic_fetch_add(&link->refs, 1);
+		if(net_post(link->owner, &task->base)) {
+			RemoteLink_unref(link);
+			free(task);
+			return true;
+		}
 		return false;
 	}
-	uprintf("wire_send(%s)\n", reflect(WireMessageType, message->type));
-	uint32_t cookie = message->cookie - 1;
-	if(cookie < self->cookies_len && self->cookies[cookie].length) {
-		void *buffer = malloc(self->cookies[cookie].length);
+	if(link->closed)
+		return true;
+	uint8_t pkt[WIRE_FRAME_MAX], *pkt_end = pkt;
+	if(!pkt_write(&frame, &pkt_end, endof(pkt), PV_LEGACY_DEFAULT) ||
+	   (frame.type == WireFrameType_Message && !pkt_write(message, &pkt_end, endof(pkt), PV_LEGACY_DEFAULT))) {
+		uprintf("pkt_write() failed\n");
+		return true;
+	}
+	return wire_queue(link, pkt, pkt_end - pkt); // Written out by `wire_flush()` before the owner next waits on its sockets
+}
+
+bool wire_send(struct NetContext *self, union WireLink *link, const struct WireMessage *message) {
+	if(!link || link->type == WireLinkType_INVALID)
+		return true;
+	// Responses arrive asynchronously, so the cookie must outlive the caller's stack
+	struct WireCookie *cookie = WireCookieTable_get(&self->cookies, message->cookie);
+	if(cookie && cookie->length) {
+		void *buffer = malloc(cookie->length);
 		if(!buffer) {
 			uprintf("alloc error\n");
 			return true;
 		}
-		memcpy(buffer, self->cookies[cookie].data, self->cookies[cookie].length);
-		self->cookies[cookie] = (struct WireCookie){buffer, 0};
+		memcpy(buffer, cookie->data, cookie->length);
+		cookie->data = buffer;
+		cookie->length = 0;
 	}
-	uint8_t pkt[16384], *pkt_end = pkt;
-	pkt_write(message, &pkt_end, endof(pkt), PV_LEGACY_DEFAULT);
-	for(int res = MBEDTLS_ERR_ERROR_CORRUPTION_DETECTED; (res = mbedtls_ssl_write(&link->remote.ctx, pkt, pkt_end - pkt)) <= 0;) {
-		if(res == MBEDTLS_ERR_SSL_WANT_WRITE)
-			continue;
-		if(res != MBEDTLS_ERR_NET_CONN_RESET)
-			uprintf("mbedtls_ssl_write() failed: %s\n", mbedtls_high_level_strerr(res));
-		wire_disconnect(self, link);
-		return true;
+	if(link->type == WireLinkType_LOCAL) {
+		if(message->type != WireMessageType_WireHeartbeat)
+			uprintf("wire_send_local(%s)\n", reflect(WireMessageType, message->type));
+		return wire_post_local((union WireLink*)self, &link->local, LocalWireTask_message, message);
 	}
-	return false;
+	if(link->type != WireLinkType_CHANNEL)
+		return true;
+	if(message->type != WireMessageType_WireHeartbeat)
+		uprintf("wire_send(%s)\n", reflect(WireMessageType, message->type));
+	return wire_send_frame(self, link->channel.link, (struct WireFrame){link->channel.id, WireFrameType_Message}, message);
 }
 
-void wire_recv(struct NetContext *self, mbedtls_ssl_context *link) {
-	uint8_t pkt[16384];
-	int res;
-	do {
-		memset(pkt, 0, sizeof(pkt)); // TODO: this doesn't look right
-		res = mbedtls_ssl_read(link, pkt, sizeof(pkt));
-	} while(res == MBEDTLS_ERR_SSL_WANT_READ);
+// Returns true if the frame is malformed
+static bool wire_dispatch(struct NetContext *self, struct RemoteLink *remote, const uint8_t *data, uint32_t length) {
+	const uint8_t *data_end = data;
+	struct WireFrame frame;
 	struct WireMessage message;
-	if(res < 0) {
-		if(res != MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY)
-			uprintf("mbedtls_ssl_read() failed: %s\n", mbedtls_high_level_strerr(res));
-		goto fail;
-	}
-	const uint8_t *pkt_end = pkt;
-	if(!pkt_read(&message, &pkt_end, &pkt[res], PV_LEGACY_DEFAULT)) {
+	if(!pkt_read(&frame, &data_end, &data[length], PV_LEGACY_DEFAULT) ||
+	   (frame.type == WireFrameType_Message && !pkt_read(&message, &data_end, &data[length], PV_LEGACY_DEFAULT))) {
 		uprintf("pkt_read() failed\n");
-		goto fail;
+		return true;
 	}
-	if(pkt_end != &pkt[res]) {
+	if(data_end != &data[length]) {
 		uprintf("bad packet length\n");
+		return true;
+	}
+	pthread_mutex_lock(&remote->mutex);
+	struct WireChannel *channel = WireChannel_get(remote, frame.channel);
+	if(channel && channel->net != self) { // Belongs to another thread sharing this connection
+		WireChannel_post(channel, (frame.type == WireFrameType_Message) ? &message : NULL);
+		pthread_mutex_unlock(&remote->mutex);
+		return false;
+	}
+	bool opened = false;
+	if(!channel && remote->server && frame.type == WireFrameType_Message)
+		opened = (channel = WireChannel_new(remote, self, frame.channel));
+	else if(channel && frame.type == WireFrameType_Close)
+		remote->channels[frame.channel] = NULL;
+	pthread_mutex_unlock(&remote->mutex);
+	if(!channel) {
+		if(frame.type == WireFrameType_Message)
+			uprintf("wire_recv(): unknown channel %hu\n", frame.channel);
+		return false;
+	}
+	if(frame.type == WireFrameType_Close) {
+		self->onWireMessage(self->userptr, (union WireLink*)channel, NULL);
+		WireChannel_free(channel);
+		return false;
+	}
+	if(opened)
+		self->onWireLink(self->userptr, (union WireLink*)channel);
+	if(message.type != WireMessageType_WireHeartbeat)
+		uprintf("wire_recv(%s)\n", reflect(WireMessageType, message.type));
+	self->onWireMessage(self->userptr, (union WireLink*)channel, &message);
+	return false;
+}
+
+// Frames may span TLS records and records may hold several frames, so input is buffered until each frame is complete
+void wire_recv(struct NetContext *self, mbedtls_ssl_context *link) {
+	struct RemoteLink *remote = (struct RemoteLink*)link;
+	if(remote->state != WireLinkState_Open) {
+		if(wire_handshake(remote, true))
+			goto fail;
+		if(remote->state != WireLinkState_Open)
+			return;
+	}
+	if(wire_write(remote))
 		goto fail;
+	remote->wantWrite = false;
+	for(;;) {
+		uint8_t *buf = &remote->in[remote->in_len];
+		size_t buf_len = sizeof(remote->in) - remote->in_len;
+		int res = remote->tls ? mbedtls_ssl_read(link, buf, buf_len) : ssl_recv(link->MBEDTLS_PRIVATE(p_bio), buf, buf_len);
+		if(res == MBEDTLS_ERR_SSL_WANT_READ)
+			return;
+		if(res == MBEDTLS_ERR_SSL_WANT_WRITE) {
+			remote->wantWrite = true;
+			return;
+		}
+		#ifdef MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET
+		if(res == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET) { // TLS 1.3 tickets arrive after the handshake
+			wire_session_save(remote);
+			continue;
+		}
+		#endif
+		if(res <= 0) {
+			if(res != MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY && res != 0)
+				uprintf("mbedtls_ssl_read() failed: %s\n", mbedtls_high_level_strerr(res));
+			goto fail;
+		}
+		remote->in_len += res;
+		const uint8_t *it = remote->in, *end = &remote->in[remote->in_len];
+		for(uint32_t length; end - it >= 2 && end - it - 2 >= (length = it[0] | it[1] << 8); it += 2 + length) {
+			if(length > WIRE_FRAME_MAX) {
+				uprintf("Wire frame too large\n");
+				goto fail;
+			}
+			if(wire_dispatch(self, remote, &it[2], length))
+				goto fail;
+		}
+		if(end - it >= 2 && (it[0] | it[1] << 8) > WIRE_FRAME_MAX) {
+			uprintf("Wire frame too large\n");
+			goto fail;
+		}
+		remote->in_len = end - it;
+		memmove(remote->in, it, remote->in_len);
 	}
-	uprintf("wire_recv(%s)\n", reflect(WireMessageType, message.type));
-	self->onWireMessage(self->userptr, (union WireLink*)link, &message);
-	return;
 	fail:
-	wire_disconnect(self, (union WireLink*)link);
+	wire_close_remote(self, remote);
 }
 
-uint32_t wire_reserveCookie(struct NetContext *self, void *data, size_t length) {
-	for(uint32_t i = 0; i < self->cookies_len; ++i) {
-		if(self->cookies[i].data)
-			continue;
-		self->cookies[i] = (struct WireCookie){data, length};
-		return i + 1;
+// Called by the owning thread before waiting on its sockets; may drop the link
+void wire_flush(struct NetContext *self, mbedtls_ssl_context *link, uint32_t currentTime, uint32_t *nextTick) {
+	struct RemoteLink *remote = (struct RemoteLink*)link;
+	if(remote->state != WireLinkState_Open) {
+		if((int32_t)(currentTime - remote->deadline) >= 0) {
+			uprintf("Wire handshake timed out\n");
+			wire_close_remote(self, remote);
+		} else if(remote->deadline - currentTime < *nextTick - currentTime) {
+			*nextTick = remote->deadline;
+		}
+		return;
+	}
+	if(wire_write(remote))
+		wire_close_remote(self, remote);
+}
+
+bool wire_pending(mbedtls_ssl_context *link) {
+	struct RemoteLink *remote = (struct RemoteLink*)link;
+	return remote->wantWrite || (remote->state == WireLinkState_Open && remote->out_len);
+}
+
+static uint32_t WireCookieTable_cookie(struct WireCookieTable *table, uint32_t index) {
+	return table->slots[index].generation << WIRE_COOKIE_INDEX_BITS | (index + 1);
+}
+
+static struct WireCookieList *WireCookieTable_list(struct WireCookieTable *table, union WireLink *link) {
+	if(!table->lists)
+		return NULL;
+	for(uint32_t i = (uintptr_t)link / 8 * 2654435761u;; ++i) {
+		struct WireCookieList *list = &table->lists[i & table->lists_mask];
+		if(!list->link || list->link == link)
+			return list;
+	}
+}
+
+static bool WireCookieTable_grow(struct WireCookieTable *table) {
+	uint32_t length = table->lists ? (table->lists_mask + 1) * 2 : 8;
+	struct WireCookieList *old = table->lists, *lists = calloc(length, sizeof(*lists));
+	if(!lists) {
+		uprintf("alloc error\n");
+		return true;
 	}
-	struct WireCookie *list = realloc(self->cookies, (self->cookies_len + 1) * sizeof(*list));
-	if(!list) {
-		uprintf("alloc error");
+	uint32_t oldLength = old ? table->lists_mask + 1 : 0;
+	table->lists = lists;
+	table->lists_mask = length - 1;
+	for(uint32_t i = 0; i < oldLength; ++i)
+		if(old[i].link)
+			*WireCookieTable_list(table, old[i].link) = old[i];
+	free(old);
+	return false;
+}
+
+// Backward-shift deletion keeps every probe sequence unbroken without tombstones
+static void WireCookieTable_drop(struct WireCookieTable *table, struct WireCookieList *list) {
+	uint32_t hole = list - table->lists;
+	for(uint32_t i = hole + 1;; ++i) {
+		struct WireCookieList *it = &table->lists[i & table->lists_mask];
+		if(!it->link)
+			break;
+		uint32_t home = (uintptr_t)it->link / 8 * 2654435761u;
+		if(((i - home) & table->lists_mask) >= ((i - hole) & table->lists_mask)) {
+			table->lists[hole & table->lists_mask] = *it;
+			hole = i;
+		}
+	}
+	table->lists[hole & table->lists_mask] = (struct WireCookieList){NULL, 0};
+	--table->lists_count;
+}
+
+uint32_t wire_reserveCookie(struct NetContext *self, union WireLink *link, void *data, size_t length) {
+	struct WireCookieTable *table = &self->cookies;
+	if(!link)
 		return 0;
+	struct WireCookieList *list = WireCookieTable_list(table, link);
+	if(!list || !list->link) {
+		if((table->lists_count + 1) * 2 > (table->lists ? table->lists_mask + 1 : 0)) {
+			if(WireCookieTable_grow(table))
+				return 0;
+		}
+		list = WireCookieTable_list(table, link);
 	}
-	self->cookies = list;
-	list[self->cookies_len] = (struct WireCookie){data, length};
-	return ++self->cookies_len;
+	if(!table->free) {
+		if(table->slots_len >= (1u << WIRE_COOKIE_INDEX_BITS) - 1) {
+			uprintf("Too many wire cookies\n");
+			return 0;
+		}
+		uint32_t slots_len = table->slots_len ? table->slots_len * 2 : 16;
+		if(slots_len > (1u << WIRE_COOKIE_INDEX_BITS) - 1)
+			slots_len = (1u << WIRE_COOKIE_INDEX_BITS) - 1;
+		struct WireCookie *slots = realloc(table->slots, slots_len * sizeof(*slots));
+		if(!slots) {
+			uprintf("alloc error\n");
+			return 0;
+		}
+		for(uint32_t i = slots_len; i > table->slots_len; --i) {
+			slots[i - 1] = (struct WireCookie){NULL, 0, NULL, 0, 0, table->free};
+			table->free = i;
+		}
+		table->slots = slots;
+		table->slots_len = slots_len;
+	}
+	if(!list->link) {
+		*list = (struct WireCookieList){link, 0};
+		++table->lists_count;
+	}
+	uint32_t index = table->free - 1;
+	struct WireCookie *slot = &table->slots[index];
+	table->free = slot->next;
+	*slot = (struct WireCookie){data, length, link, slot->generation, 0, list->head};
+	if(list->head)
+		table->slots[list->head - 1].prev = index + 1;
+	list->head = index + 1;
+	return WireCookieTable_cookie(table, index);
 }
 
 void *wire_getCookie(struct NetContext *self, uint32_t cookie) {
-	--cookie;
-	return (cookie < self->cookies_len) ? self->cookies[cookie].data : NULL;
+	struct WireCookie *slot = WireCookieTable_get(&self->cookies, cookie);
+	return slot ? slot->data : NULL;
 }
 
-uint32_t wire_nextCookie(struct NetContext *self, uint32_t start) {
-	for(uint32_t i = start; i < self->cookies_len; ++i)
-		if(self->cookies[i].data)
-			return i + 1;
-	return 0;
+uint32_t wire_nextCookie(struct NetContext *self, union WireLink *link) {
+	struct WireCookieList *list = WireCookieTable_list(&self->cookies, link);
+	return (list && list->link) ? WireCookieTable_cookie(&self->cookies, list->head - 1) : 0;
 }
 
 void wire_releaseCookie(struct NetContext *self, uint32_t cookie) {
-	--cookie;
-	if(cookie >= self->cookies_len)
+	struct WireCookieTable *table = &self->cookies;
+	struct WireCookie *slot = WireCookieTable_get(table, cookie);
+	if(!slot)
 		return;
-	if(!self->cookies[cookie].length)
-		free(self->cookies[cookie].data);
-	self->cookies[cookie] = (struct WireCookie){NULL, 0};
+	if(!slot->length)
+		free(slot->data);
+	if(slot->prev) {
+		table->slots[slot->prev - 1].next = slot->next;
+	} else {
+		struct WireCookieList *list = WireCookieTable_list(table, slot->link);
+		list->head = slot->next;
+		if(!list->head)
+			WireCookieTable_drop(table, list);
+	}
+	if(slot->next)
+		table->slots[slot->next - 1].prev = slot->prev;
+	*slot = (struct WireCookie){NULL, 0, NULL, (slot->generation + 1) & ((1u << (32 - WIRE_COOKIE_INDEX_BITS)) - 1), 0, table->free};
+	table->free = slot - table->slots + 1;
+}
+
+void wire_cookies_free(struct WireCookieTable *table) {
+	for(uint32_t i = 0; i < table->slots_len; ++i)
+		if(table->slots[i].link && !table->slots[i].length)
+			free(table->slots[i].data);
+	free(table->slots);
+	free(table->lists);
+	*table = (struct WireCookieTable){0, 0, NULL, 0, 0, NULL};
 }
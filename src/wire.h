@@ -6,12 +6,32 @@ typedef uintptr_t WireLinkType;
 enum { // Take advantage of the first entry in `struct mbedtls_ssl_context` being an aligned pointer
 	WireLinkType_INVALID,
 	WireLinkType_LOCAL,
+	WireLinkType_CHANNEL,
 	WireLinkType_REMOTE_START,
 };
 
+#define WIRE_HEARTBEAT_INTERVAL_MS 1000
+#define WIRE_HEARTBEAT_TIMEOUT_MS 10000 // Hosts silent for this long are considered stalled
+
+#define WIRE_COOKIE_INDEX_BITS 20 // The rest of each cookie is a generation, so a response to a released cookie doesn't match its slot's next owner
+
 struct WireCookie {
 	void *data;
-	size_t length;
+	size_t length; // Nonzero while `data` still points to the caller's memory
+	union WireLink *link; // NULL while free
+	uint32_t generation;
+	uint32_t prev, next; // 1-based; neighbours in `link`'s list, or the free list through `next`
+};
+
+// Slot map of outstanding requests, with a list per link so a disconnect only visits that link's cookies
+struct WireCookieTable {
+	uint32_t slots_len, free;
+	struct WireCookie *slots;
+	uint32_t lists_count, lists_mask; // Open addressing, keyed by link
+	struct WireCookieList {
+		union WireLink *link;
+		uint32_t head;
+	} *lists;
 };
 
 union WireLink;
@@ -20,13 +40,18 @@ mbedtls_ssl_context *WireLink_cast_remote(union WireLink *link);
 
 struct NetContext;
 void wire_set_key(uint8_t key[static 32], uint8_t key_len);
+void wire_cleanup();
 union WireLink *wire_connect_local(struct NetContext *self, struct NetContext *link);
 union WireLink *wire_connect_remote(struct NetContext *self, const char *address);
+union WireLink *wire_connect_channel(struct NetContext *self, union WireLink *link);
 void wire_disconnect(struct NetContext *self, union WireLink *link);
-void wire_accept(struct NetContext *self, int32_t listenfd);
+void wire_accept(struct NetContext *self, int32_t listenfd, bool tls);
 bool wire_send(struct NetContext *self, union WireLink *link, const struct WireMessage *message);
 void wire_recv(struct NetContext *self, mbedtls_ssl_context *link);
-uint32_t wire_reserveCookie(struct NetContext *self, void *data, size_t length);
+void wire_flush(struct NetContext *self, mbedtls_ssl_context *link, uint32_t currentTime, uint32_t *nextTick);
+bool wire_pending(mbedtls_ssl_context *link);
+uint32_t wire_reserveCookie(struct NetContext *self, union WireLink *link, void *data, size_t length);
 void *wire_getCookie(struct NetContext *self, uint32_t cookie);
-uint32_t wire_nextCookie(struct NetContext *self, uint32_t start);
+uint32_t wire_nextCookie(struct NetContext *self, union WireLink *link); // First cookie still reserved for `link`, or 0
 void wire_releaseCookie(struct NetContext *self, uint32_t cookie);
+void wire_cookies_free(struct WireCookieTable *table);